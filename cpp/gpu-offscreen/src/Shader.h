@@ -6,9 +6,16 @@
 #include <spirv_cross/spirv_reflect.hpp>
 #include <vulkan/vulkan.h>
 
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <map>
 #include <optional>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace dhh::shader
 {
@@ -20,6 +27,35 @@ namespace dhh::shader
         kCompute,
     };
 
+    // Compiled SPIR-V is kept here, one file per shader revision.
+    const std::filesystem::path kShaderCacheDirectory = "shader_cache";
+
+    // Bump when the way shaders are compiled changes in a way the cache key does not see.
+    constexpr uint32_t kShaderCacheVersion = 2;
+
+    // The shaderc build the shaders are compiled with, set by CMake from the library's path, size and time stamp.
+#ifdef SHADERC_VERSION
+    constexpr const char* kShadercVersion = SHADERC_VERSION;
+#else
+    constexpr const char* kShadercVersion = "unknown";
+#endif
+
+    constexpr uint32_t kSpirvMagic = 0x07230203;
+
+    // FNV-1a of size bytes of data, continuing from hash; chains the parts of a shader cache key.
+    inline uint64_t Fnv1a(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // Preprocessor definitions, name and value, passed to the compiler.
+    using Defines = std::vector<std::pair<std::string, std::string>>;
+
     struct DescriptorInfo
     {
         uint32_t binding;
@@ -101,11 +137,14 @@ namespace dhh::shader
     class Shader
     {
     public:
-        Shader(std::filesystem::path glslPath) : glsl_path(glslPath), stageInputSize_(0)
+        // Compiling is skipped when the cache holds SPIR-V for the same source, definitions and compiler.
+        Shader(std::filesystem::path glslPath, Defines defines = {},
+            std::filesystem::path cacheDirectory = kShaderCacheDirectory)
+            : glsl_path(glslPath), defines_(std::move(defines)), stageInputSize_(0)
         {
             glslText_ = dhh::filesystem::LoadFile(glslPath, false);
             type      = GetShaderType(glslPath);
-            spirv_    = Compile();
+            spirv_    = LoadOrCompile(cacheDirectory);
             Reflect();
         }
 
@@ -165,10 +204,66 @@ namespace dhh::shader
 
     private:
         std::vector<char> glslText_;
+        Defines defines_;
         std::vector<uint32_t> spirv_;
         std::vector<VkVertexInputAttributeDescription> vertexInputAttributeDescriptions_;
         size_t stageInputSize_;
 
+        // Hash of everything the SPIR-V depends on: the source, the definitions, the optimisation level and the
+        // compiler build.
+        uint64_t CacheKey(bool optimize) const
+        {
+            const uint32_t kOptions[] = {kShaderCacheVersion, uint32_t(optimize), uint32_t(type)};
+
+            uint64_t key = Fnv1a(glslText_.data(), glslText_.size());
+            key          = Fnv1a(kOptions, sizeof(kOptions), key);
+            key          = Fnv1a(kShadercVersion, std::strlen(kShadercVersion), key);
+            for (const auto& [name, value] : defines_)
+            {
+                // The terminating zeros keep ("AB", "C") apart from ("A", "BC").
+                key = Fnv1a(name.c_str(), name.size() + 1, key);
+                key = Fnv1a(value.c_str(), value.size() + 1, key);
+            }
+            return key;
+        }
+
+        std::vector<uint32_t> LoadOrCompile(const std::filesystem::path& cacheDirectory, bool optimize = true)
+        {
+            char name[17];
+            std::snprintf(name, sizeof(name), "%016llx", (unsigned long long) CacheKey(optimize));
+            const std::filesystem::path kPath = cacheDirectory / (glsl_path.filename().string() + "." + name + ".spv");
+
+            std::ifstream in(kPath, std::ios::binary | std::ios::ate);
+            if (in)
+            {
+                const size_t kSize = size_t(in.tellg());
+                std::vector<uint32_t> spirv(kSize / 4);
+                in.seekg(0);
+                if (kSize % 4 == 0 && !spirv.empty() && in.read((char*) spirv.data(), kSize) && spirv[0] == kSpirvMagic)
+                {
+                    return spirv;
+                }
+            }
+
+            std::vector<uint32_t> spirv = Compile(optimize);
+
+            // Published complete or not at all, so a concurrent or interrupted run never reads half a module. A
+            // cache that cannot be written only costs the next run a compile.
+            std::error_code error;
+            std::filesystem::create_directories(cacheDirectory, error);
+            const std::filesystem::path kPart = kPath.string() + ".part";
+            {
+                std::ofstream out(kPart, std::ios::binary | std::ios::trunc);
+                out.write((const char*) spirv.data(), spirv.size() * 4);
+                if (!out)
+                {
+                    return spirv;
+                }
+            }
+            std::filesystem::rename(kPart, kPath, error);
+            return spirv;
+        }
+
         std::vector<uint32_t> Compile(bool optimize = true)
         {
             shaderc::Compiler compiler;
@@ -177,8 +272,12 @@ namespace dhh::shader
             {
                 options.SetOptimizationLevel(shaderc_optimization_level_performance);
             }
-            shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(
-                glslText_.data(), GetShadercShaderType(type), glsl_path.filename().string().c_str(), options);
+            for (const auto& [name, value] : defines_)
+            {
+                options.AddMacroDefinition(name, value);
+            }
+            shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(glslText_.data(), glslText_.size(),
+                GetShadercShaderType(type), glsl_path.filename().string().c_str(), options);
             if (module.GetCompilationStatus() != shaderc_compilation_status_success)
             {
                 throw std::runtime_error(module.GetErrorMessage().c_str());
@@ -13,12 +13,17 @@
 
 #include <algorithm>
 #include <array>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <set>
 
 void VulkanBase::Init()
 {
-    InitWindow();
+    if (!headless)
+    {
+        InitWindow();
+    }
     InitVulkan();
 }
 
@@ -48,22 +53,32 @@ void VulkanBase::InitVulkan()
     FindQueueFamilyIndex();
     CreateLogicalDevice();
     CreateMemoryAllocator();
-    CreateSwapchain();
-    CreateSwapchainImageViews();
-    CreateRenderPass();
-    CreateDepthResources();
-    CreateFramebuffers();
+    CreatePipelineCache();
+    if (!headless)
+    {
+        CreateSwapchain();
+        CreateSwapchainImageViews();
+        CreateRenderPass();
+        CreateDepthResources();
+        CreateFramebuffers();
+    }
     CreateCommandPool();
-    CreateSyncObjects();
+    if (!headless)
+    {
+        CreateSyncObjects();
+    }
     CreateDescriptorPool();
-    AllocateCommandbuffers();
+    if (!headless)
+    {
+        AllocateCommandbuffers();
+    }
 }
 
 void VulkanBase::CreateInstance()
 {
     VkApplicationInfo app_create_info;
     app_create_info.sType              = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-    app_create_info.apiVersion         = VK_API_VERSION_1_1;
+    app_create_info.apiVersion         = VK_API_VERSION_1_2;
     app_create_info.applicationVersion = kAppVersion;
     app_create_info.engineVersion      = kEngineVersion;
     app_create_info.pApplicationName   = app_name.c_str();
@@ -100,7 +115,10 @@ void VulkanBase::CreateInstance()
     {
         instance_create_info.pNext = nullptr;
     }
-    vkCreateInstance(&instance_create_info, nullptr, &instance);
+    if (vkCreateInstance(&instance_create_info, nullptr, &instance) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create instance");
+    }
 }
 
 void VulkanBase::SetupDebugMessenger()
@@ -149,10 +167,14 @@ void VulkanBase::CreateLogicalDevice()
 {
     float queue_priority                   = 1.f;
     std::set<uint32_t> unique_queue_family = {
-        queue_family_index.graphics_family.value(),
-        queue_family_index.present_family.value(),
         queue_family_index.transfer_family.value(),
+        queue_family_index.compute_family.value(),
     };
+    if (!headless)
+    {
+        unique_queue_family.insert(queue_family_index.graphics_family.value());
+        unique_queue_family.insert(queue_family_index.present_family.value());
+    }
 
     std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
 
@@ -168,26 +190,60 @@ void VulkanBase::CreateLogicalDevice()
         queue_create_infos.push_back(queue_create_info);
     }
 
+    // The tracer works in double precision; not every CPU implementation has it. Readback is paced with timeline
+    // semaphores.
+    VkPhysicalDeviceVulkan12Features supported_features_12 = {};
+    supported_features_12.sType                            = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+    VkPhysicalDeviceFeatures2 supported_features = {};
+    supported_features.sType                     = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    supported_features.pNext                     = &supported_features_12;
+    vkGetPhysicalDeviceFeatures2(physical_device, &supported_features);
+    if (!supported_features.features.shaderFloat64)
+    {
+        throw std::runtime_error("device does not support shaderFloat64");
+    }
+    if (!supported_features_12.timelineSemaphore)
+    {
+        throw std::runtime_error("device does not support timeline semaphores");
+    }
+
     VkPhysicalDeviceFeatures features = {};
     features.shaderFloat64            = VK_TRUE;
     features.fillModeNonSolid         = VK_FALSE;
+
+    // Optional; only counts shader invocations for the GPU report.
+    features.pipelineStatisticsQuery = supported_features.features.pipelineStatisticsQuery;
+    pipeline_statistics              = features.pipelineStatisticsQuery;
+
+    VkPhysicalDeviceVulkan12Features features_12 = {};
+    features_12.sType                            = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    features_12.timelineSemaphore                = VK_TRUE;
+
     VkDeviceCreateInfo device_create_info;
     device_create_info.sType                   = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    device_create_info.enabledExtensionCount   = static_cast<uint32_t>(kDeviceExtensions.size());
-    device_create_info.ppEnabledExtensionNames = kDeviceExtensions.data();
+    device_create_info.enabledExtensionCount   = headless ? 0 : static_cast<uint32_t>(kDeviceExtensions.size());
+    device_create_info.ppEnabledExtensionNames = headless ? nullptr : kDeviceExtensions.data();
     device_create_info.enabledLayerCount       = 0;
     device_create_info.ppEnabledLayerNames     = nullptr;
     device_create_info.flags                   = VK_NULL_HANDLE;
     device_create_info.queueCreateInfoCount    = static_cast<uint32_t>(queue_create_infos.size());
     device_create_info.pQueueCreateInfos       = queue_create_infos.data();
     device_create_info.pEnabledFeatures        = &features;
-    device_create_info.pNext                   = nullptr;
+    device_create_info.pNext                   = &features_12;
 
-    vkCreateDevice(physical_device, &device_create_info, nullptr, &device);
+    if (vkCreateDevice(physical_device, &device_create_info, nullptr, &device) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create logical device");
+    }
 
-    vkGetDeviceQueue(device, queue_family_index.graphics_family.value(), 0, &graphics_queue);
-    vkGetDeviceQueue(device, queue_family_index.present_family.value(), 0, &present_queue);
+    if (!headless)
+    {
+        vkGetDeviceQueue(device, queue_family_index.graphics_family.value(), 0, &graphics_queue);
+        vkGetDeviceQueue(device, queue_family_index.present_family.value(), 0, &present_queue);
+    }
     vkGetDeviceQueue(device, queue_family_index.transfer_family.value(), 0, &transfer_queue);
+    vkGetDeviceQueue(device, queue_family_index.compute_family.value(), 0, &compute_queue);
 }
 
 void VulkanBase::CreateMemoryAllocator()
@@ -339,9 +395,11 @@ void VulkanBase::CreateFramebuffers()
 
 void VulkanBase::CreateCommandPool()
 {
+    // Windowed, the compute family is the graphics family, so the pool serves both queues.
     VkCommandPoolCreateInfo pool_info = {};
     pool_info.sType                   = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    pool_info.queueFamilyIndex        = queue_family_index.graphics_family.value();
+    pool_info.queueFamilyIndex        = headless ? queue_family_index.compute_family.value()
+                                                 : queue_family_index.graphics_family.value();
 
     if (vkCreateCommandPool(device, &pool_info, nullptr, &command_pool) != VK_SUCCESS)
     {
@@ -378,20 +436,81 @@ void VulkanBase::CreateDescriptorPool()
 {
     std::vector<VkDescriptorPoolSize> pool_sizes = {
         {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
-        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
     };
 
     VkDescriptorPoolCreateInfo pool_create_info;
     pool_create_info.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     pool_create_info.pNext         = nullptr;
     pool_create_info.flags         = VK_NULL_HANDLE;
-    pool_create_info.maxSets       = static_cast<uint32_t>(swapchain_images.size());
+    pool_create_info.maxSets       = static_cast<uint32_t>(std::max<size_t>(swapchain_images.size(), 1));
     pool_create_info.poolSizeCount = pool_sizes.size();
     pool_create_info.pPoolSizes    = pool_sizes.data();
 
     vkCreateDescriptorPool(device, &pool_create_info, nullptr, &descriptor_pool);
 }
 
+void VulkanBase::CreatePipelineCache()
+{
+    std::vector<char> blob;
+    if (std::filesystem::exists(pipeline_cache_path))
+    {
+        blob = dhh::filesystem::LoadFile(pipeline_cache_path, true);
+    }
+
+    // Header version one: header size, header version, vendor, device and the cache UUID.
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    uint32_t header[4];
+    if (blob.size() < sizeof(header) + VK_UUID_SIZE)
+    {
+        blob.clear();
+    }
+    else
+    {
+        std::memcpy(header, blob.data(), sizeof(header));
+        if (header[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || header[2] != properties.vendorID
+            || header[3] != properties.deviceID
+            || std::memcmp(blob.data() + sizeof(header), properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+        {
+            blob.clear();
+        }
+    }
+
+    VkPipelineCacheCreateInfo create_info = {};
+    create_info.sType                     = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    create_info.initialDataSize           = blob.size();
+    create_info.pInitialData              = blob.data();
+    if (vkCreatePipelineCache(device, &create_info, nullptr, &pipeline_cache) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create pipeline cache");
+    }
+}
+
+// Written next to the final file and renamed over it, so an interrupted run never leaves half a blob behind. A cache
+// that cannot be written only costs the next run its pipeline compiles.
+void VulkanBase::SavePipelineCache()
+{
+    size_t size = 0;
+    vkGetPipelineCacheData(device, pipeline_cache, &size, nullptr);
+    std::vector<char> blob(size);
+    vkGetPipelineCacheData(device, pipeline_cache, &size, blob.data());
+
+    const std::filesystem::path kPart = pipeline_cache_path.string() + ".part";
+    {
+        std::ofstream out(kPart, std::ios::binary | std::ios::trunc);
+        out.write(blob.data(), size);
+        if (!out)
+        {
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(kPart, pipeline_cache_path, error);
+}
+
 void VulkanBase::AllocateCommandbuffers()
 {
     command_buffers.resize(3);
@@ -486,9 +605,13 @@ VkBool32 VulkanBase::DebugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messag
 
 std::vector<const char*> VulkanBase::GetRequiredExtensions()
 {
-    uint32_t extension_count              = 0;
-    const char** glfw_required_extensions = glfwGetRequiredInstanceExtensions(&extension_count);
-    std::vector<const char*> required_extensions(glfw_required_extensions, glfw_required_extensions + extension_count);
+    std::vector<const char*> required_extensions;
+    if (!headless)
+    {
+        uint32_t extension_count              = 0;
+        const char** glfw_required_extensions = glfwGetRequiredInstanceExtensions(&extension_count);
+        required_extensions.assign(glfw_required_extensions, glfw_required_extensions + extension_count);
+    }
 
     if (enable_validation)
     {
@@ -499,7 +622,12 @@ std::vector<const char*> VulkanBase::GetRequiredExtensions()
 
 std::vector<const char*> VulkanBase::GetRequiredLayers()
 {
-    std::vector<const char*> required_layers(kExtraLayers);
+    // The monitor layer draws on presented frames, so a headless instance has no use for it.
+    std::vector<const char*> required_layers;
+    if (!headless)
+    {
+        required_layers = kExtraLayers;
+    }
     if (enable_validation)
     {
         required_layers.push_back("VK_LAYER_KHRONOS_validation");
@@ -514,28 +642,45 @@ void VulkanBase::FindQueueFamilyIndex()
     std::vector<VkQueueFamilyProperties> queue_family_properties(queue_family_count);
     vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_family_properties.data());
 
-    /// Find Graphics queue family index
-    for (size_t i = 0; i < queue_family_properties.size(); i++)
+    if (!headless)
     {
-        if (queue_family_properties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+        /// Find Graphics queue family index
+        for (size_t i = 0; i < queue_family_properties.size(); i++)
         {
-            queue_family_index.graphics_family = i;
-            break;
+            if (queue_family_properties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+            {
+                queue_family_index.graphics_family = i;
+                break;
+            }
         }
-    }
 
-    // Get window surface from GLFW
-    glfwCreateWindowSurface(instance, window, nullptr, &surface);
+        // Get window surface from GLFW
+        glfwCreateWindowSurface(instance, window, nullptr, &surface);
 
-    /// Find queue family that support presentation
-    VkBool32 present_support;
-    for (size_t i = 0; i < queue_family_properties.size(); i++)
+        /// Find queue family that support presentation
+        VkBool32 present_support;
+        for (size_t i = 0; i < queue_family_properties.size(); i++)
+        {
+            vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, static_cast<uint32_t>(i), surface, &present_support);
+            if (present_support)
+            {
+                queue_family_index.present_family = i;
+                break;
+            }
+        }
+    }
+
+    /// Find Compute queue family index, the graphics family when it can compute
+    const std::optional<uint32_t> kGraphics = queue_family_index.graphics_family;
+    if (kGraphics && (queue_family_properties[*kGraphics].queueFlags & VK_QUEUE_COMPUTE_BIT))
+    {
+        queue_family_index.compute_family = kGraphics;
+    }
+    for (size_t i = 0; i < queue_family_properties.size() && !queue_family_index.compute_family; i++)
     {
-        vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, static_cast<uint32_t>(i), surface, &present_support);
-        if (present_support)
+        if (queue_family_properties[i].queueFlags & VK_QUEUE_COMPUTE_BIT)
         {
-            queue_family_index.present_family = i;
-            break;
+            queue_family_index.compute_family = i;
         }
     }
 
@@ -549,14 +694,20 @@ void VulkanBase::FindQueueFamilyIndex()
         }
     }
 
-    if (!queue_family_index.IsComplete())
+    // Compute queues can always transfer, whether or not they report it.
+    if (!queue_family_index.transfer_family)
+    {
+        queue_family_index.transfer_family = queue_family_index.compute_family;
+    }
+
+    if (!queue_family_index.IsComplete(headless))
     {
         throw std::runtime_error("queue family incomplete");
     }
 }
 
-VkImageView VulkanBase::CreateImageView(
-    VkImage image, VkFormat format, VkImageAspectFlagBits aspectFlags, uint32_t mipLevels, VkImageViewType view_type)
+VkImageView VulkanBase::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlagBits aspectFlags,
+    uint32_t mipLevels, VkImageViewType view_type, uint32_t layers)
 {
     VkImageViewCreateInfo view_create_info;
     view_create_info.sType                           = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -571,7 +722,7 @@ VkImageView VulkanBase::CreateImageView(
     view_create_info.subresourceRange.aspectMask     = aspectFlags;
     view_create_info.subresourceRange.baseArrayLayer = 0;
     view_create_info.subresourceRange.baseMipLevel   = 0;
-    view_create_info.subresourceRange.layerCount     = 1;
+    view_create_info.subresourceRange.layerCount     = layers;
     view_create_info.subresourceRange.levelCount     = mipLevels;
     view_create_info.pNext                           = nullptr;
 
@@ -6,6 +6,7 @@
 #include <GLFW/glfw3.h>
 #include <vk_mem_alloc.h>
 
+#include <filesystem>
 #include <optional>
 #include <string>
 #include <vector>
@@ -15,10 +16,13 @@ struct QueueFamilyIndex
     std::optional<uint32_t> graphics_family;
     std::optional<uint32_t> present_family;
     std::optional<uint32_t> transfer_family;
+    std::optional<uint32_t> compute_family;
 
-    bool IsComplete()
+    // A headless device needs neither graphics nor presentation.
+    bool IsComplete(bool headless)
     {
-        return graphics_family.has_value() && present_family.has_value() && transfer_family.has_value();
+        return (headless || (graphics_family.has_value() && present_family.has_value())) && transfer_family.has_value()
+               && compute_family.has_value();
     }
 };
 
@@ -41,6 +45,13 @@ public:
     bool enable_validation        = true;
     QueueFamilyIndex queue_family_index;
 
+    // No window, surface or swapchain: only a compute queue, for offscreen work. Runs on display-less machines and on
+    // CPU implementations such as lavapipe.
+    bool headless = false;
+
+    // Whether the device was created with pipelineStatisticsQuery, so compute invocations can be counted.
+    bool pipeline_statistics = false;
+
 private:
     VkDebugUtilsMessengerEXT debugMessenger_;
 
@@ -75,8 +86,13 @@ public:
     VkQueue graphics_queue;
     VkQueue transfer_queue;
     VkQueue present_queue;
+    VkQueue compute_queue;
     VkDescriptorSetLayout descriptor_set_layout;
     VkDescriptorPool descriptor_pool;
+
+    // Compiled pipelines, kept on disk between runs. Blobs from another device or driver are not reused.
+    VkPipelineCache pipeline_cache;
+    std::filesystem::path pipeline_cache_path = "pipeline.cache";
     std::vector<VkDescriptorSet> descriptor_sets;
     std::vector<VkBuffer> uniform_buffers;
     std::vector<VmaAllocation> uniform_buffer_allocation;
@@ -86,7 +102,10 @@ public:
 
 
 public:
-    explicit VulkanBase(bool enableValidation) : enable_validation(enableValidation) {}
+    explicit VulkanBase(bool enableValidation, bool runHeadless = false)
+        : enable_validation(enableValidation), headless(runHeadless)
+    {
+    }
 
     void Init();
 
@@ -109,11 +128,13 @@ private:
     void CreateCommandPool();
     void CreateSyncObjects();
     void CreateDescriptorPool();
+    void CreatePipelineCache();
     void AllocateCommandbuffers();
     VkPresentModeKHR ChoosePresentMode();
 
 public:
     void DrawFrame();
+    void SavePipelineCache();
     void CreateUniformBuffer(VkDeviceSize bufferSize);
 
 protected:
@@ -123,7 +144,7 @@ protected:
     std::vector<const char*> GetRequiredExtensions();
     std::vector<const char*> GetRequiredLayers();
     VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlagBits aspectFlags, uint32_t mipLevels,
-        VkImageViewType view_type = VK_IMAGE_VIEW_TYPE_2D);
+        VkImageViewType view_type = VK_IMAGE_VIEW_TYPE_2D, uint32_t layers = 1);
     VkSurfaceFormatKHR ChooseSurfaceFormat();
     void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage, VkBuffer& buffer,
         VmaAllocation& allocation);
@@ -13,6 +13,10 @@
 #include <functional>
 #include <chrono>
 #include <iomanip>
+#include <iostream>
+#include <fstream>
+#include <numeric>
+#include <optional>
 
 namespace vks
 {
@@ -31,6 +35,28 @@ namespace vks
 		double runtime = 0.0;
 		uint32_t frameCount = 0;
 
+		// GPU time and shader invocations of one pass of a frame, e.g. from timestamp and pipeline statistics queries.
+		// Invocations are left empty where the device does not count them, and saved as null in JSON, blank in CSV
+		struct Pass {
+			std::string name;
+			double ms;
+			std::optional<uint64_t> invocations;
+		};
+		std::vector<std::vector<Pass>> framePasses;
+
+		// For applications that render and time their frames themselves instead of through run()
+		void begin(VkPhysicalDeviceProperties deviceProps) {
+			active = true;
+			this->deviceProps = deviceProps;
+		}
+
+		void addFrame(double ms, std::vector<Pass> passes = {}) {
+			frameTimes.push_back(ms);
+			framePasses.push_back(std::move(passes));
+			runtime += ms;
+			frameCount++;
+		}
+
 		void run(std::function<void()> renderFunc, VkPhysicalDeviceProperties deviceProps) {
 			active = true;
 			this->deviceProps = deviceProps;
@@ -70,7 +96,13 @@ namespace vks
 			}
 		}
 
+		// Writes JSON instead of CSV if the filename ends in .json
 		void saveResults() {
+			const std::string json = ".json";
+			if (filename.size() >= json.size() && filename.compare(filename.size() - json.size(), json.size(), json) == 0) {
+				saveJson();
+				return;
+			}
 			std::ofstream result(filename, std::ios::out);
 			if (result.is_open()) {
 				result << std::fixed << std::setprecision(4);
@@ -92,11 +124,70 @@ namespace vks
 					std::cout << std::endl;
 				}
 
+				if (!framePasses.empty()) {
+					result << std::endl << "frame,pass,ms,invocations" << std::endl;
+					for (size_t i = 0; i < framePasses.size(); i++) {
+						for (const Pass& pass : framePasses[i]) {
+							result << i << "," << pass.name << "," << pass.ms << ",";
+							if (pass.invocations)
+								result << *pass.invocations;
+							result << std::endl;
+						}
+					}
+				}
+
 				result.flush();
 #if defined(_WIN32)
 				FreeConsole();
 #endif
 			}
 		}
+
+		// Same results as saveResults, with every frame and its passes
+		void saveJson() {
+			std::ofstream result(filename, std::ios::out);
+			if (!result.is_open()) {
+				return;
+			}
+			auto quoted = [](const std::string &text) {
+				std::string out = "\"";
+				for (char c : text) {
+					if (c == '"' || c == '\\') {
+						out += '\\';
+					}
+					out += c;
+				}
+				return out + "\"";
+			};
+
+			result << std::fixed << std::setprecision(4);
+			result << "{" << std::endl;
+			result << "  \"device\": " << quoted(deviceProps.deviceName) << "," << std::endl;
+			result << "  \"driverversion\": " << deviceProps.driverVersion << "," << std::endl;
+			result << "  \"duration_ms\": " << runtime << "," << std::endl;
+			result << "  \"frames\": " << frameCount << "," << std::endl;
+			result << "  \"fps\": " << frameCount / (runtime / 1000.0) << "," << std::endl;
+			result << "  \"frame_times\": [";
+			for (size_t i = 0; i < frameTimes.size(); i++) {
+				result << (i ? ", " : "") << frameTimes[i];
+			}
+			result << "]," << std::endl;
+			result << "  \"passes\": [";
+			for (size_t i = 0; i < framePasses.size(); i++) {
+				result << (i ? "," : "") << std::endl << "    [";
+				for (size_t j = 0; j < framePasses[i].size(); j++) {
+					const Pass &pass = framePasses[i][j];
+					result << (j ? ", " : "") << "{\"name\": " << quoted(pass.name) << ", \"ms\": " << pass.ms
+						<< ", \"invocations\": ";
+					if (pass.invocations)
+						result << *pass.invocations;
+					else
+						result << "null";
+					result << "}";
+				}
+				result << "]";
+			}
+			result << std::endl << "  ]" << std::endl << "}" << std::endl;
+		}
 	};
 }
\ No newline at end of file
@@ -1,3 +1,8 @@
+#include "../../offline/src/disk_texture.h"
+#include "../../offline/src/ktx2.h"
+#include "../../offline/src/movie.h"
+#include "../../offline/src/ray_class.h"
+#include "../../offline/src/redshift.h"
 #include "Filesystem.h"
 #include "Shader.h"
 #include "VulkanBase.h"
@@ -6,6 +11,7 @@
 
 #include <VulkanTexture.hpp>
 #include <VulkanTools.h>
+#include <benchmark.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -14,27 +20,229 @@
 #include <stb_image.h>
 #include <stb_image_write.h>
 
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
 #include <chrono>
+#include <cstddef>
+#include <numeric>
+#include <optional>
 
 const int32_t kWidth  = 512;
 const int32_t kHeight = 512;
 
+// Edge of a work group, in pixels. The shader takes it as specialization constants, so dispatches always match it.
+const uint32_t kLocalSize = 8;
+
+// Edge of the tile one submit traces, in every frame of a batch. However large the image, no submit runs long enough
+// to trip the driver's watchdog.
+const uint32_t kTileSize = 128;
+
+// Frames of the camera path.
+const uint32_t kFrames = 8;
+
+// Frames traced per batch. Each tile's command buffer traces the tile in every frame of the batch back to back, so a
+// batch costs the CPU one command buffer per tile however many frames it holds.
+const uint32_t kBatchFrames = 4;
+
+// Frames in flight between the GPU and the encoder, two batches, each frame with its own layer of the result image
+// and its own readback buffer: while the host hands the frames of one batch to the MovieWriter, the GPU traces and
+// copies the next batch.
+const uint32_t kReadbackSlots = 2 * kBatchFrames;
+
+// Converts frames to YUV 4:2:0 on the GPU with yuv420.comp: 1.5 bytes per pixel are read back instead of 4, and the
+// encoder gets its planes without converting anything. Otherwise the RGBA frames are converted by MovieWriter.
+const bool kGpuYuv = true;
+
+// Planes written by yuv420.comp, one after the other in a readback buffer. Rows are padded to whole words.
+const uint32_t kLumaStride        = (kWidth + 7) / 8 * 8;
+const uint32_t kChromaStride      = kLumaStride / 2;
+const uint32_t kChromaHeight      = (kHeight + 1) / 2;
+const VkDeviceSize kChromaOffsetU = VkDeviceSize(kLumaStride) * kHeight;
+const VkDeviceSize kChromaOffsetV = kChromaOffsetU + VkDeviceSize(kChromaStride) * kChromaHeight;
+const VkDeviceSize kYuvSize       = kChromaOffsetV + VkDeviceSize(kChromaStride) * kChromaHeight;
+
+// The camera circles the black hole at this distance and height; frame 0 is the camera the shader used to hard-code.
+const double kCameraDistance = 15;
+const double kCameraHeight   = 2;
+
+// Radial texels of the disk color table, baked from the gradient the shader used to generate itself.
+const uint32_t kDiskTextureSize = 20;
+
+// Traces in single precision, integrating geodesics over 1 / r with compensated sums; only rays near the critical
+// impact parameter go back to double. For GPUs whose double rate is a small fraction of their float rate.
+const bool kFp32Trace = true;
+
+// Entries per half of a frame's deflection table. A pre-pass integrates the sweeps of every impact parameter once per
+// frame, and the tracing pass interpolates them, so every pixel does the same small amount of work.
+const uint32_t kDeflectionSize = 1024;
+
+// Traces each tile as a wavefront: a classification pass sorts its pixels into one queue per dhh::rays::RayClass, and
+// each queue is traced by its own indirect dispatch, so a work group never mixes rays that take different branches
+// of the shader. Otherwise every work group traces a square of pixels, whatever their class.
+const bool kWavefront = true;
+
+// GPU report: timestamps around every pass of every frame, and compute invocations per pass where the device counts
+// them, written through vks::Benchmark when the frames are done; JSON for a .json path, CSV otherwise. nullptr turns
+// the queries off.
+const char* kReportPath = "gpu_report.json";
+
+// The passes of a frame in the GPU report, each with a pair of timestamps and a statistics query of its own: the
+// deflection pass, the readback, then tile n at kTilePasses + n. The frames of a batch take turns in every tile, so a
+// frame is timed as the sum of its own passes, not from its first timestamp to its last.
+enum ReportPass : uint32_t
+{
+    kDeflectionPass,
+    kReadbackPass,
+    kTilePasses
+};
+
+// RAY_QUEUE values of trace.comp besides the ray classes.
+const int32_t kTraceTile    = -1;
+const int32_t kClassifyTile = -2;
+
+// Specialization constants of trace.comp, in constant_id order.
+struct TraceConstants
+{
+    int32_t height;
+    int32_t width;
+    uint32_t local_size_x;
+    uint32_t local_size_y;
+    VkBool32 fp32_trace;
+    VkBool32 deflection_pass;
+    int32_t ray_queue;
+    VkBool32 disk_redshift;
+    float shading_min_g;
+    float shading_max_g;
+    float shading_min_kelvin;
+    float shading_max_kelvin;
+    float disk_peak_kelvin;
+};
+
+// Push constants of trace.comp: the top left pixel of the tile being traced, the frame it belongs to and the layer of
+// the result image that frame goes to.
+struct TileInfo
+{
+    uint32_t col;
+    uint32_t row;
+    uint32_t frame;
+    uint32_t layer;
+};
+
+// Uniform block scene_info of trace.comp, std140: the doubles pack into the tail of the dvec3.
+struct SceneInfo
+{
+    glm::dvec3 bh_position;
+    double disk_outer;
+    double disk_inner;
+};
+static_assert(offsetof(SceneInfo, disk_outer) == 24, "scene_info layout");
+
+// Head of a queue in ray_queue_buf of trace.comp: a VkDispatchIndirectCommand over the queue, then its length.
+struct RayQueue
+{
+    uint32_t groups_x;
+    uint32_t groups_y;
+    uint32_t groups_z;
+    uint32_t count;
+};
+
+// One element of camera_path in trace.comp, std430. The camera looks along -back.
+struct CameraPose
+{
+    glm::dvec4 position;
+    glm::dvec4 right;
+    glm::dvec4 up;
+    glm::dvec4 back;
+};
+
+inline uint32_t DivideRoundUp(uint32_t value, uint32_t divisor)
+{
+    return (value + divisor - 1) / divisor;
+}
+
+// Shades the disk as a black body seen through gravitational redshift and Doppler beaming, as the CPU tracer does with
+// kDiskRedshift; otherwise with the disk colors.
+const bool kDiskRedshift = true;
+
+// Peak temperature of the disk, the brightness reference of the shading table.
+const double kDiskPeakKelvin = 10000;
+
+// Radii of the disk. A redshift shaded disk starts no further in than the innermost stable circular orbit, where the
+// thin disk model ends.
+const double kDiskOuter = 10;
+const double kDiskInner = kDiskRedshift ? std::max(2.0, dhh::disk::kIsco) : 2;
+
+// Half floats, the widest format every device can filter.
+const VkFormat kShadingFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+
 class RayTracer : public VulkanBase
 {
 public:
-    explicit RayTracer(bool enableValidation) : VulkanBase(enableValidation) {}
+    explicit RayTracer(bool enableValidation, bool runHeadless) : VulkanBase(enableValidation, runHeadless) {}
 
     VkPipeline compute_pipeline;
+    VkPipeline deflection_pipeline;
+    VkPipeline classify_pipeline;
+    std::vector<VkPipeline> ray_class_pipelines;
     VkPipelineLayout compute_pipeline_layout;
     VkDescriptorSetLayout compute_descriptor_set_layout;
     VkDescriptorSet compute_descritor_set;
     vks::Texture cube_map;
+    VkFormat cube_map_format = VK_FORMAT_BC3_UNORM_BLOCK;
 
     VkImageView skybox_image_view;
     VmaAllocation skybox_allocation;
     VkImage result_image;
     VkImageView result_image_view;
     VmaAllocation result_image_allocation;
+    VkImage shading_image;
+    VkImageView shading_image_view;
+    VmaAllocation shading_image_allocation;
+    VkSampler shading_sampler;
+    VkBuffer scene_buffer;
+    VmaAllocation scene_buffer_allocation;
+    VkBuffer camera_path_buffer;
+    VmaAllocation camera_path_buffer_allocation;
+    VkImage disk_lut_image;
+    VkImageView disk_lut_image_view;
+    VmaAllocation disk_lut_image_allocation;
+    VkSampler disk_lut_sampler;
+    VkBuffer deflection_buffer;
+    VmaAllocation deflection_buffer_allocation;
+    VkBuffer ray_queue_buffer;
+    VmaAllocation ray_queue_buffer_allocation;
+
+    // One tightly packed RGBA copy of the result image per slot, mapped for the life of the tracer.
+    std::vector<VkBuffer> readback_buffers;
+    std::vector<VmaAllocation> readback_allocations;
+    std::vector<uint8_t*> readback_data;
+
+    // Reaches frame + 1 once that frame is in its readback buffer. A batch signals it for its last frame only, which
+    // the earlier frames of the batch wait on as well.
+    VkSemaphore frame_timeline;
+
+    // Queries of the GPU report. Every frame has its own range in each pool, one ReportPass after the other, reset by
+    // the first command buffer of its batch.
+    bool instrumented           = false;
+    VkQueryPool timestamp_pool  = VK_NULL_HANDLE;
+    VkQueryPool statistics_pool = VK_NULL_HANDLE;
+    uint64_t timestamp_mask     = 0;
+    double timestamp_period     = 0;
+    uint32_t passes_per_frame   = 0;
+    vks::Benchmark report;
+
+    // Ticks of the first and the last timestamp reported so far, and the sum of the frames in between.
+    uint64_t first_tick     = 0;
+    uint64_t last_tick      = 0;
+    uint64_t reported_ticks = 0;
+
+    // The YUV conversion pass, with one descriptor set per readback slot.
+    VkPipeline yuv_pipeline;
+    VkPipelineLayout yuv_pipeline_layout;
+    VkDescriptorSetLayout yuv_descriptor_set_layout;
+    VkDescriptorPool yuv_descriptor_pool;
+    std::vector<VkDescriptorSet> yuv_descriptor_sets;
 
     void CreateSkyboxSampler()
     {
@@ -57,16 +265,261 @@ public:
 
     void CreateSkybox()
     {
-        skybox_image_view = CreateImageView(cube_map.image, VK_FORMAT_BC3_UNORM_BLOCK, VK_IMAGE_ASPECT_COLOR_BIT, 1, VK_IMAGE_VIEW_TYPE_CUBE);
+        skybox_image_view = CreateImageView(
+            cube_map.image, cube_map_format, VK_IMAGE_ASPECT_COLOR_BIT, 1, VK_IMAGE_VIEW_TYPE_CUBE, 6);
     }
 
+    // One layer per readback slot.
     void CreateResultImage()
     {
         CreateImage(kWidth, kHeight, 1, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
             VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_GPU_ONLY, result_image,
-            result_image_allocation, 1);
+            result_image_allocation, kReadbackSlots);
+
+        result_image_view = CreateImageView(result_image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, 1,
+            VK_IMAGE_VIEW_TYPE_2D_ARRAY, kReadbackSlots);
+    }
+
+    // Subresources of the result image, all slots or just one.
+    VkImageSubresourceRange ResultRange(uint32_t first_layer, uint32_t layers) const
+    {
+        VkImageSubresourceRange range = {};
+        range.aspectMask              = VK_IMAGE_ASPECT_COLOR_BIT;
+        range.levelCount              = 1;
+        range.baseArrayLayer          = first_layer;
+        range.layerCount              = layers;
+        return range;
+    }
+
+    // The readback ring is created once and stays mapped; the host reads a slot straight after waiting for its frame.
+    // With kGpuYuv the conversion pass writes its planes straight into the slot.
+    void CreateReadback()
+    {
+        const VkDeviceSize kSize = kGpuYuv ? kYuvSize : VkDeviceSize(kWidth) * kHeight * 4;
+
+        readback_buffers.resize(kReadbackSlots);
+        readback_allocations.resize(kReadbackSlots);
+        readback_data.resize(kReadbackSlots);
+        for (uint32_t slot = 0; slot < kReadbackSlots; ++slot)
+        {
+            CreateBuffer(kSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                VMA_MEMORY_USAGE_GPU_TO_CPU, readback_buffers[slot], readback_allocations[slot]);
+
+            void* mapped;
+            VK_CHECK_RESULT(vmaMapMemory(allocator, readback_allocations[slot], &mapped));
+            readback_data[slot] = static_cast<uint8_t*>(mapped);
+        }
+
+        VkSemaphoreTypeCreateInfo timeline_info = {};
+        timeline_info.sType                     = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        timeline_info.semaphoreType             = VK_SEMAPHORE_TYPE_TIMELINE;
+        timeline_info.initialValue              = 0;
+
+        VkSemaphoreCreateInfo semaphore_info = {};
+        semaphore_info.sType                 = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphore_info.pNext                 = &timeline_info;
+        VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphore_info, nullptr, &frame_timeline));
+    }
+
+    void DestroyReadback()
+    {
+        for (uint32_t slot = 0; slot < kReadbackSlots; ++slot)
+        {
+            vmaUnmapMemory(allocator, readback_allocations[slot]);
+            vmaFreeMemory(allocator, readback_allocations[slot]);
+            vkDestroyBuffer(device, readback_buffers[slot], nullptr);
+        }
+        vkDestroySemaphore(device, frame_timeline, nullptr);
+    }
+
+    void UploadBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer,
+        VmaAllocation& allocation)
+    {
+        CreateBuffer(size, usage, VMA_MEMORY_USAGE_CPU_TO_GPU, buffer, allocation);
+
+        void* mapped;
+        vmaMapMemory(allocator, allocation, &mapped);
+        memcpy(mapped, data, size);
+        vmaUnmapMemory(allocator, allocation);
+    }
+
+    // Everything the shader needs to know about the scene, written once: the black hole and the disk, and the camera
+    // of every frame. A frame only picks its camera by index, so a new camera path needs neither a new shader nor new
+    // command buffers.
+    void CreateSceneBuffers()
+    {
+        const SceneInfo kScene = {glm::dvec3(0, 0, 0), kDiskOuter, kDiskInner};
+        UploadBuffer(
+            &kScene, sizeof(kScene), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, scene_buffer, scene_buffer_allocation);
+
+        // Counter-clockwise about +y, always facing the same way relative to the black hole.
+        std::vector<CameraPose> camera_path(kFrames);
+        for (uint32_t frame = 0; frame < kFrames; ++frame)
+        {
+            const double kAngle = glm::radians(360.0 * frame / kFrames);
+            const double kSin   = std::sin(kAngle);
+            const double kCos   = std::cos(kAngle);
+
+            camera_path[frame].position = glm::dvec4(kCameraDistance * kSin, kCameraHeight, kCameraDistance * kCos, 0);
+            camera_path[frame].right    = glm::dvec4(kCos, 0, -kSin, 0);
+            camera_path[frame].up       = glm::dvec4(0, 1, 0, 0);
+            camera_path[frame].back     = glm::dvec4(kSin, 0, kCos, 0);
+        }
+        UploadBuffer(camera_path.data(), camera_path.size() * sizeof(CameraPose), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            camera_path_buffer, camera_path_buffer_allocation);
+
+        // Written and read on the GPU only.
+        const VkDeviceSize kDeflectionBytes = VkDeviceSize(kFrames) * 2 * kDeflectionSize * sizeof(glm::vec4);
+        CreateBuffer(kDeflectionBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY, deflection_buffer,
+            deflection_buffer_allocation);
+
+        // Room for every pixel of a tile in each class's queue, as the shader splits the buffer evenly.
+        const VkDeviceSize kQueueBytes = dhh::rays::kRayClasses * (sizeof(RayQueue) + kTileSize * kTileSize * 4);
+        CreateBuffer(kQueueBytes,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY, ray_queue_buffer, ray_queue_buffer_allocation);
+    }
+
+    // The redshift table of the CPU tracer, baked once and sampled by the shader with the same bilinear lookup.
+    void CreateShadingLut()
+    {
+        const dhh::disk::ShadingLut kLut(kDiskPeakKelvin);
+        const uint32_t kSize = dhh::disk::kShadingSize;
+
+        VkBuffer staging_buffer;
+        VmaAllocation staging_buffer_allocation;
+        CreateBuffer(kLut.Texels().size() * 4 * sizeof(uint16_t), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VMA_MEMORY_USAGE_CPU_ONLY, staging_buffer, staging_buffer_allocation);
+
+        uint16_t* data;
+        vmaMapMemory(allocator, staging_buffer_allocation, (void**) &data);
+        for (const dhh::disk::Rgb& texel : kLut.Texels())
+        {
+            *data++ = glm::packHalf1x16(texel.r);
+            *data++ = glm::packHalf1x16(texel.g);
+            *data++ = glm::packHalf1x16(texel.b);
+            *data++ = glm::packHalf1x16(1.f);
+        }
+        vmaUnmapMemory(allocator, staging_buffer_allocation);
+
+        CreateImage(kSize, kSize, 1, VK_SAMPLE_COUNT_1_BIT, kShadingFormat, VK_IMAGE_TILING_OPTIMAL,
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VMA_MEMORY_USAGE_GPU_ONLY, shading_image,
+            shading_image_allocation);
+
+        VkBufferImageCopy region           = {};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent                 = {kSize, kSize, 1};
+
+        VkCommandBuffer cmd_buf = CreateCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+        vks::tools::setImageLayout(cmd_buf, shading_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        vkCmdCopyBufferToImage(
+            cmd_buf, staging_buffer, shading_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        vks::tools::setImageLayout(cmd_buf, shading_image, VK_IMAGE_ASPECT_COLOR_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        FlushCommandBuffer(cmd_buf, compute_queue, true);
+
+        vmaFreeMemory(allocator, staging_buffer_allocation);
+        vkDestroyBuffer(device, staging_buffer, nullptr);
+
+        shading_image_view = CreateImageView(shading_image, kShadingFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+        // Clamp to edge, like the CPU lookup.
+        VkSamplerCreateInfo sampler_info = {};
+        sampler_info.sType               = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        sampler_info.magFilter           = VK_FILTER_LINEAR;
+        sampler_info.minFilter           = VK_FILTER_LINEAR;
+        sampler_info.mipmapMode          = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        sampler_info.addressModeU        = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        sampler_info.addressModeV        = sampler_info.addressModeU;
+        sampler_info.addressModeW        = sampler_info.addressModeU;
+        sampler_info.compareOp           = VK_COMPARE_OP_NEVER;
+        sampler_info.borderColor         = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+        sampler_info.maxAnisotropy       = 1.0f;
+        VK_CHECK_RESULT(vkCreateSampler(device, &sampler_info, nullptr, &shading_sampler));
+    }
+
+    // The disk colors as a dhh::disk::DiskLut, every level of its mip chain in the image's, so the shader picks a
+    // level by the footprint of each ray as the CPU tracer does.
+    void CreateDiskLut()
+    {
+        const dhh::disk::DiskLut kLut = dhh::disk::DiskLut::Bake(
+            kDiskTextureSize, 1, [](double u, double) { return dhh::disk::Rgb{float(u), float(1 - u), 0}; });
+        const uint32_t kLevels = uint32_t(kLut.Levels());
+
+        size_t texels = 0;
+        for (uint32_t level = 0; level < kLevels; ++level)
+            texels += kLut.Level(level).size();
+
+        VkBuffer staging_buffer;
+        VmaAllocation staging_buffer_allocation;
+        CreateBuffer(texels * 4 * sizeof(uint16_t), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
+            staging_buffer, staging_buffer_allocation);
+
+        // Levels one after the other, each copied into its own mip level.
+        uint16_t* data;
+        vmaMapMemory(allocator, staging_buffer_allocation, (void**) &data);
+        std::vector<VkBufferImageCopy> regions(kLevels);
+        VkDeviceSize offset = 0;
+        for (uint32_t level = 0; level < kLevels; ++level)
+        {
+            for (const dhh::disk::Rgb& texel : kLut.Level(level))
+            {
+                *data++ = glm::packHalf1x16(texel.r);
+                *data++ = glm::packHalf1x16(texel.g);
+                *data++ = glm::packHalf1x16(texel.b);
+                *data++ = glm::packHalf1x16(1.f);
+            }
+            const VkExtent3D kExtent = {uint32_t(kLut.Radial(level)), uint32_t(kLut.Azimuthal(level)), 1};
+            regions[level].bufferOffset                = offset;
+            regions[level].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            regions[level].imageSubresource.mipLevel   = level;
+            regions[level].imageSubresource.layerCount = 1;
+            regions[level].imageExtent                 = kExtent;
+            offset += kLut.Level(level).size() * 4 * sizeof(uint16_t);
+        }
+        vmaUnmapMemory(allocator, staging_buffer_allocation);
+
+        // DiskLut halves each side down to 1 texel as Vulkan sizes mip levels, so the chains match.
+        CreateImage(uint32_t(kLut.Radial()), uint32_t(kLut.Azimuthal()), kLevels, VK_SAMPLE_COUNT_1_BIT,
+            kShadingFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY, disk_lut_image, disk_lut_image_allocation);
+
+        VkImageSubresourceRange range = {};
+        range.aspectMask              = VK_IMAGE_ASPECT_COLOR_BIT;
+        range.levelCount              = kLevels;
+        range.layerCount              = 1;
+
+        VkCommandBuffer cmd_buf = CreateCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+        vks::tools::setImageLayout(
+            cmd_buf, disk_lut_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, range);
+        vkCmdCopyBufferToImage(cmd_buf, staging_buffer, disk_lut_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            uint32_t(regions.size()), regions.data());
+        vks::tools::setImageLayout(cmd_buf, disk_lut_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, range);
+        FlushCommandBuffer(cmd_buf, compute_queue, true);
+
+        vmaFreeMemory(allocator, staging_buffer_allocation);
+        vkDestroyBuffer(device, staging_buffer, nullptr);
+
+        disk_lut_image_view = CreateImageView(disk_lut_image, kShadingFormat, VK_IMAGE_ASPECT_COLOR_BIT, kLevels);
 
-        result_image_view = CreateImageView(result_image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+        // Clamped along the radius and repeating around the disk, like DiskLut::Sample. Nearest mipmapping, as
+        // DiskLut::LevelFor rounds to a level.
+        VkSamplerCreateInfo sampler_info = {};
+        sampler_info.sType               = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        sampler_info.magFilter           = VK_FILTER_LINEAR;
+        sampler_info.minFilter           = VK_FILTER_LINEAR;
+        sampler_info.mipmapMode          = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        sampler_info.addressModeU        = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        sampler_info.addressModeV        = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        sampler_info.addressModeW        = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        sampler_info.compareOp           = VK_COMPARE_OP_NEVER;
+        sampler_info.maxLod              = float(kLevels - 1);
+        sampler_info.borderColor         = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+        sampler_info.maxAnisotropy       = 1.0f;
+        VK_CHECK_RESULT(vkCreateSampler(device, &sampler_info, nullptr, &disk_lut_sampler));
     }
 
 
@@ -84,11 +537,11 @@ public:
         object_info_binding.descriptorCount              = 1;
         object_info_binding.stageFlags                   = VK_SHADER_STAGE_COMPUTE_BIT;
 
-        VkDescriptorSetLayoutBinding tex_coord_binding = {};
-        tex_coord_binding.binding                      = 2;
-        tex_coord_binding.descriptorType               = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        tex_coord_binding.descriptorCount              = 1;
-        tex_coord_binding.stageFlags                   = VK_SHADER_STAGE_COMPUTE_BIT;
+        VkDescriptorSetLayoutBinding camera_path_binding = {};
+        camera_path_binding.binding                      = 2;
+        camera_path_binding.descriptorType               = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        camera_path_binding.descriptorCount              = 1;
+        camera_path_binding.stageFlags                   = VK_SHADER_STAGE_COMPUTE_BIT;
 
         VkDescriptorSetLayoutBinding result_image_binding = {};
         result_image_binding.binding                      = 3;
@@ -96,8 +549,32 @@ public:
         result_image_binding.descriptorCount              = 1;
         result_image_binding.stageFlags                   = VK_SHADER_STAGE_COMPUTE_BIT;
 
-        std::vector<VkDescriptorSetLayoutBinding> bindings = {
-            skybox_binding, object_info_binding, tex_coord_binding, result_image_binding};
+        VkDescriptorSetLayoutBinding shading_binding = {};
+        shading_binding.binding                      = 4;
+        shading_binding.descriptorType               = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        shading_binding.descriptorCount              = 1;
+        shading_binding.stageFlags                   = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutBinding disk_lut_binding = {};
+        disk_lut_binding.binding                      = 5;
+        disk_lut_binding.descriptorType               = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        disk_lut_binding.descriptorCount              = 1;
+        disk_lut_binding.stageFlags                   = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutBinding deflection_binding = {};
+        deflection_binding.binding                      = 6;
+        deflection_binding.descriptorType               = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        deflection_binding.descriptorCount              = 1;
+        deflection_binding.stageFlags                   = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutBinding ray_queue_binding = {};
+        ray_queue_binding.binding                      = 7;
+        ray_queue_binding.descriptorType               = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        ray_queue_binding.descriptorCount              = 1;
+        ray_queue_binding.stageFlags                   = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        std::vector<VkDescriptorSetLayoutBinding> bindings = {skybox_binding, object_info_binding, camera_path_binding,
+            result_image_binding, shading_binding, disk_lut_binding, deflection_binding, ray_queue_binding};
 
 
         VkDescriptorSetLayoutCreateInfo descriptor_set_layout_info = {};
@@ -106,30 +583,45 @@ public:
         descriptor_set_layout_info.pBindings    = bindings.data();
         vkCreateDescriptorSetLayout(device, &descriptor_set_layout_info, nullptr, &compute_descriptor_set_layout);
 
+        VkPushConstantRange tile_info_range = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(TileInfo)};
+
         auto pipeline_layout_info = dhh::initializer::PipelineLayoutCreateInfo(compute_descriptor_set_layout);
+
+        pipeline_layout_info.pushConstantRangeCount = 1;
+        pipeline_layout_info.pPushConstantRanges    = &tile_info_range;
         VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr, &compute_pipeline_layout));
 
         auto shader_path                     = dhh::shader::FindShaderDirectory();
         dhh::shader::Shader compute_shader   = (shader_path / "trace.comp");
         VkShaderModule compute_shader_module = compute_shader.CreateVulkanShaderModule(device);
 
-        VkSpecializationMapEntry const_height = {};
-        const_height.constantID               = 0;
-        const_height.offset                   = 0;
-        const_height.size                     = sizeof(int32_t);
-
-        VkSpecializationMapEntry const_width = {};
-        const_width.constantID               = 1;
-        const_width.offset                   = 0;
-        const_width.size                     = sizeof(int32_t);
-
-        std::vector<VkSpecializationMapEntry> entries = {const_height, const_width};
+        // The deflection pass and the wavefront passes are the same shader, specialized to fill the table, sort a
+        // tile into queues or trace one queue instead of tracing a tile.
+        TraceConstants constants = {kHeight, kWidth, kLocalSize, kLocalSize, kFp32Trace, VK_FALSE, kTraceTile,
+            kDiskRedshift, float(dhh::disk::kMinG), float(dhh::disk::kMaxG), float(dhh::disk::kMinKelvin),
+            float(dhh::disk::kMaxKelvin), float(kDiskPeakKelvin)};
+
+        std::vector<VkSpecializationMapEntry> entries = {
+            {0, offsetof(TraceConstants, height), sizeof(int32_t)},
+            {1, offsetof(TraceConstants, width), sizeof(int32_t)},
+            {2, offsetof(TraceConstants, local_size_x), sizeof(uint32_t)},
+            {3, offsetof(TraceConstants, local_size_y), sizeof(uint32_t)},
+            {4, offsetof(TraceConstants, fp32_trace), sizeof(VkBool32)},
+            {5, offsetof(TraceConstants, deflection_pass), sizeof(VkBool32)},
+            {6, offsetof(TraceConstants, ray_queue), sizeof(int32_t)},
+            {7, offsetof(TraceConstants, disk_redshift), sizeof(VkBool32)},
+            {8, offsetof(TraceConstants, shading_min_g), sizeof(float)},
+            {9, offsetof(TraceConstants, shading_max_g), sizeof(float)},
+            {10, offsetof(TraceConstants, shading_min_kelvin), sizeof(float)},
+            {11, offsetof(TraceConstants, shading_max_kelvin), sizeof(float)},
+            {12, offsetof(TraceConstants, disk_peak_kelvin), sizeof(float)},
+        };
 
         VkSpecializationInfo constant_info = {};
         constant_info.pMapEntries          = entries.data();
         constant_info.mapEntryCount        = entries.size();
-        constant_info.dataSize             = sizeof(int32_t);
-        constant_info.pData                = &kWidth;
+        constant_info.dataSize             = sizeof(constants);
+        constant_info.pData                = &constants;
 
         VkPipelineShaderStageCreateInfo pipeline_shader_stage_info = {};
 
@@ -146,10 +638,30 @@ public:
         compute_pipeline_info.layout = compute_pipeline_layout;
 
         VK_CHECK_RESULT(
-            vkCreateComputePipelines(device, nullptr, 1, &compute_pipeline_info, nullptr, &compute_pipeline));
+            vkCreateComputePipelines(device, pipeline_cache, 1, &compute_pipeline_info, nullptr, &compute_pipeline));
+
+        constants.deflection_pass = VK_TRUE;
+        VK_CHECK_RESULT(
+            vkCreateComputePipelines(device, pipeline_cache, 1, &compute_pipeline_info, nullptr, &deflection_pipeline));
+
+        constants.deflection_pass = VK_FALSE;
+        constants.ray_queue       = kClassifyTile;
+        VK_CHECK_RESULT(
+            vkCreateComputePipelines(device, pipeline_cache, 1, &compute_pipeline_info, nullptr, &classify_pipeline));
+
+        ray_class_pipelines.resize(dhh::rays::kRayClasses);
+        for (int32_t ray_class = 0; ray_class < dhh::rays::kRayClasses; ++ray_class)
+        {
+            constants.ray_queue = ray_class;
+            VK_CHECK_RESULT(vkCreateComputePipelines(
+                device, pipeline_cache, 1, &compute_pipeline_info, nullptr, &ray_class_pipelines[ray_class]));
+        }
+        SavePipelineCache();
     }
 
-    VkCommandBuffer compute_cmd_buf;
+    // One list per batch, one command buffer per tile, in submission order. The last one of a batch also copies its
+    // frames into their readback buffers.
+    std::vector<std::vector<VkCommandBuffer>> compute_cmd_bufs;
 
     void writeComputeDescriptorSet()
     {
@@ -176,150 +688,580 @@ public:
         auto result_image_write = dhh::initializer::WriteDescriptorSet(
             VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, 3, compute_descritor_set, &result_image_info);
 
-        std::vector<VkWriteDescriptorSet> writes = {skybox_write, result_image_write};
+        VkDescriptorImageInfo shading_image_info = dhh::initializer::DescriptorImageInfo(
+            shading_image_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, shading_sampler);
+        auto shading_write = dhh::initializer::WriteDescriptorSet(
+            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, 4, compute_descritor_set, &shading_image_info);
+
+        VkDescriptorBufferInfo scene_info = dhh::initializer::DescriptorBufferInfo(scene_buffer, 0, VK_WHOLE_SIZE);
+        auto scene_write                  = dhh::initializer::WriteDescriptorSet(
+            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, 1, compute_descritor_set, &scene_info);
+
+        VkDescriptorBufferInfo camera_path_info =
+            dhh::initializer::DescriptorBufferInfo(camera_path_buffer, 0, VK_WHOLE_SIZE);
+        auto camera_path_write = dhh::initializer::WriteDescriptorSet(
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, 2, compute_descritor_set, &camera_path_info);
+
+        VkDescriptorImageInfo disk_lut_info = dhh::initializer::DescriptorImageInfo(
+            disk_lut_image_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, disk_lut_sampler);
+        auto disk_lut_write = dhh::initializer::WriteDescriptorSet(
+            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, 5, compute_descritor_set, &disk_lut_info);
+
+        VkDescriptorBufferInfo deflection_info =
+            dhh::initializer::DescriptorBufferInfo(deflection_buffer, 0, VK_WHOLE_SIZE);
+        auto deflection_write = dhh::initializer::WriteDescriptorSet(
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, 6, compute_descritor_set, &deflection_info);
+
+        VkDescriptorBufferInfo ray_queue_info =
+            dhh::initializer::DescriptorBufferInfo(ray_queue_buffer, 0, VK_WHOLE_SIZE);
+        auto ray_queue_write = dhh::initializer::WriteDescriptorSet(
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, 7, compute_descritor_set, &ray_queue_info);
+
+        std::vector<VkWriteDescriptorSet> writes = {skybox_write, result_image_write, shading_write, scene_write,
+            camera_path_write, disk_lut_write, deflection_write, ray_queue_write};
 
         vkUpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
     }
 
+    // Tiles cover the image row by row; each dispatch launches just enough work groups for its tile, and the shader
+    // skips the pixels of partial groups past the edge. The frames of a batch are dispatched back to back in each
+    // tile's command buffer, told apart only by push constants. Everything is recorded once up front, so a batch costs
+    // the CPU one vkQueueSubmit.
     void BuildComputeCommandBuffers()
     {
-        VkCommandBufferAllocateInfo info =
-            dhh::initializer::CommandBufferAllocateInfo(command_pool, 1, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
-        vkAllocateCommandBuffers(device, &info, &compute_cmd_buf);
-        VkCommandBufferBeginInfo beginInfo = dhh::initializer::CommandBufferBeginInfo();
-        vkBeginCommandBuffer(compute_cmd_buf, &beginInfo);
+        compute_cmd_bufs.resize(DivideRoundUp(kFrames, kBatchFrames));
+        for (uint32_t batch = 0; batch < compute_cmd_bufs.size(); ++batch)
+        {
+            const uint32_t kFirst = batch * kBatchFrames;
+            const uint32_t kLast  = std::min(kFirst + kBatchFrames, kFrames);
+            for (uint32_t row = 0; row < uint32_t(kHeight); row += kTileSize)
+            {
+                for (uint32_t col = 0; col < uint32_t(kWidth); col += kTileSize)
+                {
+                    VkCommandBuffer cmd_buf;
+                    VkCommandBufferAllocateInfo info =
+                        dhh::initializer::CommandBufferAllocateInfo(command_pool, 1, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+                    vkAllocateCommandBuffers(device, &info, &cmd_buf);
+                    VkCommandBufferBeginInfo beginInfo = dhh::initializer::CommandBufferBeginInfo();
+                    vkBeginCommandBuffer(cmd_buf, &beginInfo);
+
+                    vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, compute_pipeline_layout, 0, 1,
+                        &compute_descritor_set, 0, nullptr);
+
+                    if (compute_cmd_bufs[batch].empty())
+                    {
+                        // The submits run in order, so the first one makes the image writable for all of them.
+                        // Later batches only wait for the readbacks out of their layers, two batches earlier.
+                        if (batch == 0)
+                        {
+                            vks::tools::setImageLayout(cmd_buf, result_image, VK_IMAGE_LAYOUT_UNDEFINED,
+                                VK_IMAGE_LAYOUT_GENERAL, ResultRange(0, kReadbackSlots));
+                        }
+                        else
+                        {
+                            vkCmdPipelineBarrier(cmd_buf,
+                                kGpuYuv ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+                        }
+                        for (uint32_t frame = kFirst; frame < kLast; ++frame)
+                        {
+                            ResetQueries(cmd_buf, frame);
+                            BeginPass(cmd_buf, frame, kDeflectionPass);
+                            RecordDeflectionPass(cmd_buf, frame, frame % kReadbackSlots);
+                            EndPass(cmd_buf, frame, kDeflectionPass);
+                        }
+                    }
+
+                    const uint32_t kTileWidth  = std::min(kTileSize, uint32_t(kWidth) - col);
+                    const uint32_t kTileHeight = std::min(kTileSize, uint32_t(kHeight) - row);
+                    const uint32_t kTilePass   = kTilePasses + uint32_t(compute_cmd_bufs[batch].size());
+                    for (uint32_t frame = kFirst; frame < kLast; ++frame)
+                    {
+                        const TileInfo kTile = {col, row, frame, frame % kReadbackSlots};
+                        vkCmdPushConstants(cmd_buf, compute_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                            sizeof(kTile), &kTile);
+
+                        BeginPass(cmd_buf, frame, kTilePass);
+                        if (kWavefront)
+                        {
+                            RecordWavefront(cmd_buf, kTileWidth, kTileHeight);
+                        }
+                        else
+                        {
+                            vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, compute_pipeline);
+                            vkCmdDispatch(cmd_buf, DivideRoundUp(kTileWidth, kLocalSize),
+                                DivideRoundUp(kTileHeight, kLocalSize), 1);
+                        }
+                        EndPass(cmd_buf, frame, kTilePass);
+                    }
+
+                    if (row + kTileSize >= uint32_t(kHeight) && col + kTileSize >= uint32_t(kWidth))
+                    {
+                        for (uint32_t frame = kFirst; frame < kLast; ++frame)
+                        {
+                            BeginPass(cmd_buf, frame, kReadbackPass);
+                            RecordReadback(cmd_buf, frame % kReadbackSlots);
+                            EndPass(cmd_buf, frame, kReadbackPass);
+                        }
+                    }
+
+                    vkEndCommandBuffer(cmd_buf);
+                    compute_cmd_bufs[batch].push_back(cmd_buf);
+                }
+            }
+        }
+    }
+
+    // Needs a compute queue with valid timestamp bits; pipeline statistics are only gathered where supported.
+    void CreateQueries()
+    {
+        uint32_t family_count = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, nullptr);
+        std::vector<VkQueueFamilyProperties> families(family_count);
+        vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, families.data());
+        const uint32_t kValidBits = families[queue_family_index.compute_family.value()].timestampValidBits;
+        if (!kReportPath || kValidBits == 0)
+            return;
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physical_device, &properties);
+        report.begin(properties);
+        report.filename         = kReportPath;
+        report.outputFrameTimes = true;
+
+        instrumented     = true;
+        timestamp_mask   = kValidBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << kValidBits) - 1;
+        timestamp_period = properties.limits.timestampPeriod;
+        passes_per_frame = kTilePasses + DivideRoundUp(kWidth, kTileSize) * DivideRoundUp(kHeight, kTileSize);
+
+        VkQueryPoolCreateInfo pool_info = {};
+        pool_info.sType                 = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        pool_info.queryType             = VK_QUERY_TYPE_TIMESTAMP;
+        pool_info.queryCount            = kFrames * passes_per_frame * 2;
+        VK_CHECK_RESULT(vkCreateQueryPool(device, &pool_info, nullptr, &timestamp_pool));
+
+        if (pipeline_statistics)
+        {
+            pool_info.queryType          = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+            pool_info.queryCount         = kFrames * passes_per_frame;
+            pool_info.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+            VK_CHECK_RESULT(vkCreateQueryPool(device, &pool_info, nullptr, &statistics_pool));
+        }
+    }
 
+    void DestroyQueries()
+    {
+        if (timestamp_pool)
+            vkDestroyQueryPool(device, timestamp_pool, nullptr);
+        if (statistics_pool)
+            vkDestroyQueryPool(device, statistics_pool, nullptr);
+    }
 
-        vkCmdBindPipeline(compute_cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, compute_pipeline);
-        vkCmdBindDescriptorSets(compute_cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, compute_pipeline_layout, 0, 1,
-            &compute_descritor_set, 0, nullptr);
+    void ResetQueries(VkCommandBuffer cmd_buf, uint32_t frame)
+    {
+        if (!instrumented)
+            return;
+        vkCmdResetQueryPool(cmd_buf, timestamp_pool, frame * passes_per_frame * 2, passes_per_frame * 2);
+        if (statistics_pool)
+            vkCmdResetQueryPool(cmd_buf, statistics_pool, frame * passes_per_frame, passes_per_frame);
+    }
 
-        vks::tools::setImageLayout(compute_cmd_buf, result_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
-            VK_IMAGE_LAYOUT_GENERAL);
-        vkCmdDispatch(compute_cmd_buf, 256, 256, 1);
+    // Both timestamps of a pass are taken at the bottom of the pipe, once everything recorded before has completed, so
+    // the passes of all frames are timed over disjoint stretches of the queue.
+    void BeginPass(VkCommandBuffer cmd_buf, uint32_t frame, uint32_t pass)
+    {
+        if (!instrumented)
+            return;
+        vkCmdWriteTimestamp(
+            cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_pool, (frame * passes_per_frame + pass) * 2);
+        if (statistics_pool)
+            vkCmdBeginQuery(cmd_buf, statistics_pool, frame * passes_per_frame + pass, 0);
+    }
 
-        vkEndCommandBuffer(compute_cmd_buf);
+    void EndPass(VkCommandBuffer cmd_buf, uint32_t frame, uint32_t pass)
+    {
+        if (!instrumented)
+            return;
+        if (statistics_pool)
+            vkCmdEndQuery(cmd_buf, statistics_pool, frame * passes_per_frame + pass);
+        vkCmdWriteTimestamp(
+            cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_pool, (frame * passes_per_frame + pass) * 2 + 1);
     }
 
-    void Compute()
+    // Adds a finished frame to the report: the GPU time of each of its passes, and their sum as the frame time.
+    void ReportFrame(uint32_t frame)
     {
-        VkFence completeFence;
+        if (!instrumented)
+            return;
+
+        std::vector<uint64_t> ticks(passes_per_frame * 2);
+        VK_CHECK_RESULT(vkGetQueryPoolResults(device, timestamp_pool, frame * passes_per_frame * 2,
+            passes_per_frame * 2, ticks.size() * sizeof(uint64_t), ticks.data(), sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+        std::vector<uint64_t> invocations(passes_per_frame, 0);
+        if (statistics_pool)
+        {
+            VK_CHECK_RESULT(vkGetQueryPoolResults(device, statistics_pool, frame * passes_per_frame,
+                passes_per_frame, invocations.size() * sizeof(uint64_t), invocations.data(), sizeof(uint64_t),
+                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+        }
 
-        VkFenceCreateInfo fenceCreateInfo = dhh::initializer::FenceCreateInfo();
-        vkCreateFence(device, &fenceCreateInfo, nullptr, &completeFence);
+        std::vector<uint64_t> elapsed(passes_per_frame);
+        for (uint32_t pass = 0; pass < passes_per_frame; ++pass)
+        {
+            elapsed[pass] = (ticks[pass * 2 + 1] - ticks[pass * 2]) & timestamp_mask;
+        }
+        const uint64_t kTraceTicks = std::accumulate(elapsed.begin() + kTilePasses, elapsed.end(), uint64_t(0));
+        const uint64_t kFrameTicks = elapsed[kDeflectionPass] + kTraceTicks + elapsed[kReadbackPass];
+
+        // The frames are consumed in order, and a frame starts with its deflection pass and ends with its readback.
+        if (frame == 0)
+            first_tick = ticks[kDeflectionPass * 2];
+        last_tick = ticks[kReadbackPass * 2 + 1];
+        reported_ticks += kFrameTicks;
+
+        auto milliseconds = [&](uint64_t count) { return double(count) * timestamp_period * 1e-6; };
+        // Left out of the report where the device has no statistics queries, rather than reported as none.
+        auto counted = [&](uint64_t count) {
+            return statistics_pool ? std::optional<uint64_t>(count) : std::nullopt;
+        };
+        const uint64_t kTraceInvocations =
+            std::accumulate(invocations.begin() + kTilePasses, invocations.end(), uint64_t(0));
+
+        report.addFrame(milliseconds(kFrameTicks),
+            {
+                {"deflection", milliseconds(elapsed[kDeflectionPass]), counted(invocations[kDeflectionPass])},
+                {"trace", milliseconds(kTraceTicks), counted(kTraceInvocations)},
+                {kGpuYuv ? "yuv420" : "copy", milliseconds(elapsed[kReadbackPass]),
+                    counted(invocations[kReadbackPass])},
+            });
+    }
 
-        VkSubmitInfo submitInfo       = {};
-        submitInfo.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers    = &compute_cmd_buf;
+    // The passes of all frames are timed over disjoint stretches of the queue, so together they cannot take longer
+    // than the queue took from the first to the last of them. More means frames were timed over each other's work.
+    void CheckReport() const
+    {
+        if (!instrumented)
+            return;
+        if (reported_ticks > ((last_tick - first_tick) & timestamp_mask))
+        {
+            throw std::runtime_error("GPU report: the frame times add up to more than the frames took");
+        }
+    }
 
-        VK_CHECK_RESULT(vkQueueSubmit(graphics_queue, 1, &submitInfo, completeFence));
-        VK_CHECK_RESULT(vkWaitForFences(device, 1, &completeFence, true, DEFAULT_FENCE_TIMEOUT));
-        vkDestroyFence(device, completeFence, nullptr);
+    // Fills the frame's deflection table ahead of its first tile. Each frame has its own table, so none is rewritten
+    // while the tiles of an earlier frame may still read it.
+    void RecordDeflectionPass(VkCommandBuffer cmd_buf, uint32_t frame, uint32_t layer)
+    {
+        vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, deflection_pipeline);
+        const TileInfo kTile = {0, 0, frame, layer};
+        vkCmdPushConstants(cmd_buf, compute_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(kTile), &kTile);
+        vkCmdDispatch(cmd_buf, DivideRoundUp(2 * kDeflectionSize, kLocalSize * kLocalSize), 1, 1);
+
+        VkMemoryBarrier written = vks::initializers::memoryBarrier();
+        written.srcAccessMask   = VK_ACCESS_SHADER_WRITE_BIT;
+        written.dstAccessMask   = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+            &written, 0, nullptr, 0, nullptr);
     }
 
-    void SaveImage()
+    // Empties the queues once the previous tile has traced them, sorts the tile into them, then traces one queue after
+    // the other with the work group count the classification left in its head. Push constants set for the tile stay
+    // valid across the pipelines, which share one layout.
+    void RecordWavefront(VkCommandBuffer cmd_buf, uint32_t tile_width, uint32_t tile_height)
     {
-        VkImage save_image;
-        VmaAllocation save_image_allocation;
-        CreateImage(kHeight, kHeight, 1, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_LINEAR,
-            VK_IMAGE_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_CPU_ONLY, save_image, save_image_allocation);
-        if (!save_image)
-            throw std::runtime_error("failed to create image");
+        vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
 
-        VkCommandBuffer copy_cmd_buf;
-        VkCommandBufferAllocateInfo info =
-            dhh::initializer::CommandBufferAllocateInfo(command_pool, 1, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
-        vkAllocateCommandBuffers(device, &info, &copy_cmd_buf);
-        VkCommandBufferBeginInfo beginInfo = dhh::initializer::CommandBufferBeginInfo();
-        vkBeginCommandBuffer(copy_cmd_buf, &beginInfo);
+        std::vector<RayQueue> empty(dhh::rays::kRayClasses, {0, 1, 1, 0});
+        vkCmdUpdateBuffer(cmd_buf, ray_queue_buffer, 0, empty.size() * sizeof(RayQueue), empty.data());
 
-        vks::tools::setImageLayout(copy_cmd_buf, save_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-        vks::tools::setImageLayout(copy_cmd_buf, result_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_GENERAL,
-            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-
-
-        // Otherwise use image copy (requires us to manually flip components)
-        VkImageCopy imageCopyRegion{};
-        imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageCopyRegion.srcSubresource.layerCount = 1;
-        imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageCopyRegion.dstSubresource.layerCount = 1;
-        imageCopyRegion.extent.width              = kWidth;
-        imageCopyRegion.extent.height             = kHeight;
-        imageCopyRegion.extent.depth              = 1;
-
-        // Issue the copy command
-        vkCmdCopyImage(copy_cmd_buf, result_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, save_image,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageCopyRegion);
-
-        vks::tools::setImageLayout(copy_cmd_buf, save_image, VK_IMAGE_ASPECT_COLOR_BIT,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
-
-        VK_CHECK_RESULT(vkEndCommandBuffer(copy_cmd_buf));
-
-        VkSubmitInfo submitInfo       = vks::initializers::submitInfo();
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers    = &copy_cmd_buf;
-        // Create fence to ensure that the command buffer has finished executing
-        VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo(VK_FLAGS_NONE);
-        VkFence fence;
-        VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &fence));
-        // Submit to the queue
-        VK_CHECK_RESULT(vkQueueSubmit(graphics_queue, 1, &submitInfo, fence));
-        // Wait for the fence to signal that command buffer has finished executing
-        VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT));
-        vkDestroyFence(device, fence, nullptr);
-        if (free)
+        VkMemoryBarrier emptied = vks::initializers::memoryBarrier();
+        emptied.srcAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+        emptied.dstAccessMask   = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+            &emptied, 0, nullptr, 0, nullptr);
+
+        vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, classify_pipeline);
+        vkCmdDispatch(cmd_buf, DivideRoundUp(tile_width, kLocalSize), DivideRoundUp(tile_height, kLocalSize), 1);
+
+        VkMemoryBarrier queued = vks::initializers::memoryBarrier();
+        queued.srcAccessMask   = VK_ACCESS_SHADER_WRITE_BIT;
+        queued.dstAccessMask   = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &queued, 0, nullptr, 0,
+            nullptr);
+
+        for (uint32_t ray_class = 0; ray_class < ray_class_pipelines.size(); ++ray_class)
         {
-            vkFreeCommandBuffers(device, command_pool, 1, &copy_cmd_buf);
+            vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, ray_class_pipelines[ray_class]);
+            vkCmdDispatchIndirect(cmd_buf, ray_queue_buffer, ray_class * sizeof(RayQueue));
         }
+    }
+
+    // Copies a finished layer into the readback buffer of its slot, or converts it there with kGpuYuv, and makes it
+    // visible to the host. The result image stays in the general layout, so nothing has to be transitioned back.
+    void RecordReadback(VkCommandBuffer cmd_buf, uint32_t layer)
+    {
+        if (kGpuYuv)
+        {
+            RecordYuvReadback(cmd_buf, layer);
+            return;
+        }
+
+        VkImageMemoryBarrier written = vks::initializers::imageMemoryBarrier();
+        written.srcAccessMask        = VK_ACCESS_SHADER_WRITE_BIT;
+        written.dstAccessMask        = VK_ACCESS_TRANSFER_READ_BIT;
+        written.oldLayout            = VK_IMAGE_LAYOUT_GENERAL;
+        written.newLayout            = VK_IMAGE_LAYOUT_GENERAL;
+        written.image                = result_image;
+        written.subresourceRange     = ResultRange(layer, 1);
+        vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0,
+            nullptr, 0, nullptr, 1, &written);
+
+        VkBufferImageCopy region               = {};
+        region.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.baseArrayLayer = layer;
+        region.imageSubresource.layerCount     = 1;
+        region.imageExtent                     = {uint32_t(kWidth), uint32_t(kHeight), 1};
+        vkCmdCopyImageToBuffer(
+            cmd_buf, result_image, VK_IMAGE_LAYOUT_GENERAL, readback_buffers[layer], 1, &region);
+
+        VkBufferMemoryBarrier copied = vks::initializers::bufferMemoryBarrier();
+        copied.srcAccessMask         = VK_ACCESS_TRANSFER_WRITE_BIT;
+        copied.dstAccessMask         = VK_ACCESS_HOST_READ_BIT;
+        copied.buffer                = readback_buffers[layer];
+        copied.size                  = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+            &copied, 0, nullptr);
+    }
+
+    void RecordYuvReadback(VkCommandBuffer cmd_buf, uint32_t layer)
+    {
+        VkImageMemoryBarrier written = vks::initializers::imageMemoryBarrier();
+        written.srcAccessMask        = VK_ACCESS_SHADER_WRITE_BIT;
+        written.dstAccessMask        = VK_ACCESS_SHADER_READ_BIT;
+        written.oldLayout            = VK_IMAGE_LAYOUT_GENERAL;
+        written.newLayout            = VK_IMAGE_LAYOUT_GENERAL;
+        written.image                = result_image;
+        written.subresourceRange     = ResultRange(layer, 1);
+        vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+            0, nullptr, 0, nullptr, 1, &written);
+
+        vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, yuv_pipeline);
+        vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, yuv_pipeline_layout, 0, 1,
+            &yuv_descriptor_sets[layer], 0, nullptr);
+        vkCmdPushConstants(
+            cmd_buf, yuv_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(layer), &layer);
+
+        // An invocation per 8x2 block, 8x8 invocations per group.
+        vkCmdDispatch(cmd_buf, DivideRoundUp(DivideRoundUp(kWidth, 8), 8), DivideRoundUp(kChromaHeight, 8), 1);
+
+        VkBufferMemoryBarrier converted = vks::initializers::bufferMemoryBarrier();
+        converted.srcAccessMask         = VK_ACCESS_SHADER_WRITE_BIT;
+        converted.dstAccessMask         = VK_ACCESS_HOST_READ_BIT;
+        converted.buffer                = readback_buffers[layer];
+        converted.size                  = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0,
+            nullptr, 1, &converted, 0, nullptr);
+    }
+
+    // The conversion pass reads a layer of the result image and writes the planes into the readback buffer of the
+    // same slot. Its descriptor sets come from a pool of its own, sized for the slots.
+    void CreateYuvPipeline()
+    {
+        VkDescriptorSetLayoutBinding image_binding = {};
+        image_binding.binding                      = 0;
+        image_binding.descriptorType               = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        image_binding.descriptorCount              = 1;
+        image_binding.stageFlags                   = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutBinding planes_binding = {};
+        planes_binding.binding                      = 1;
+        planes_binding.descriptorType               = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        planes_binding.descriptorCount              = 1;
+        planes_binding.stageFlags                   = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        std::vector<VkDescriptorSetLayoutBinding> bindings = {image_binding, planes_binding};
+
+        VkDescriptorSetLayoutCreateInfo descriptor_set_layout_info = {};
+        descriptor_set_layout_info.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        descriptor_set_layout_info.bindingCount = bindings.size();
+        descriptor_set_layout_info.pBindings    = bindings.data();
+        VK_CHECK_RESULT(
+            vkCreateDescriptorSetLayout(device, &descriptor_set_layout_info, nullptr, &yuv_descriptor_set_layout));
+
+        VkPushConstantRange layer_range = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t)};
+
+        auto pipeline_layout_info = dhh::initializer::PipelineLayoutCreateInfo(yuv_descriptor_set_layout);
+
+        pipeline_layout_info.pushConstantRangeCount = 1;
+        pipeline_layout_info.pPushConstantRanges    = &layer_range;
+        VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr, &yuv_pipeline_layout));
 
-        // Get layout of the image (including row pitch)
-        VkImageSubresource subResource{VK_IMAGE_ASPECT_COLOR_BIT, 0, 0};
-        VkSubresourceLayout subResourceLayout;
-        vkGetImageSubresourceLayout(device, save_image, &subResource, &subResourceLayout);
+        dhh::shader::Shader shader         = (dhh::shader::FindShaderDirectory() / "yuv420.comp");
+        VkShaderModule shader_module       = shader.CreateVulkanShaderModule(device);
+        const int32_t kSize[2]             = {kHeight, kWidth};
+        VkSpecializationMapEntry entries[] = {{0, 0, sizeof(int32_t)}, {1, sizeof(int32_t), sizeof(int32_t)}};
+
+        VkSpecializationInfo constant_info = {};
+        constant_info.pMapEntries          = entries;
+        constant_info.mapEntryCount        = 2;
+        constant_info.dataSize             = sizeof(kSize);
+        constant_info.pData                = kSize;
+
+        VkComputePipelineCreateInfo compute_pipeline_info = {};
+        compute_pipeline_info.sType                       = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        compute_pipeline_info.stage.sType                 = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        compute_pipeline_info.stage.module                = shader_module;
+        compute_pipeline_info.stage.stage                 = VK_SHADER_STAGE_COMPUTE_BIT;
+        compute_pipeline_info.stage.pName                 = "main";
+        compute_pipeline_info.stage.pSpecializationInfo   = &constant_info;
+        compute_pipeline_info.layout                      = yuv_pipeline_layout;
 
-        // Map image memory so we can start copying from it
-        const uint8_t* data;
-        vmaMapMemory(allocator, save_image_allocation, (void**) &data);
-        data += subResourceLayout.offset;
+        VK_CHECK_RESULT(
+            vkCreateComputePipelines(device, pipeline_cache, 1, &compute_pipeline_info, nullptr, &yuv_pipeline));
+        SavePipelineCache();
+
+        std::vector<VkDescriptorPoolSize> pool_sizes = {
+            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, kReadbackSlots},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, kReadbackSlots},
+        };
+
+        VkDescriptorPoolCreateInfo pool_info = {};
+        pool_info.sType                      = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        pool_info.maxSets                    = kReadbackSlots;
+        pool_info.poolSizeCount              = pool_sizes.size();
+        pool_info.pPoolSizes                 = pool_sizes.data();
+        VK_CHECK_RESULT(vkCreateDescriptorPool(device, &pool_info, nullptr, &yuv_descriptor_pool));
+    }
 
-        uint8_t* img = new uint8_t[kHeight * kWidth * 3];
+    // Needs the result image and the readback ring.
+    void WriteYuvDescriptorSets()
+    {
+        std::vector<VkDescriptorSetLayout> layouts(kReadbackSlots, yuv_descriptor_set_layout);
 
-        for (int row = 0; row < kHeight; ++row)
+        VkDescriptorSetAllocateInfo allocate_info = {};
+        allocate_info.sType                       = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocate_info.pSetLayouts                 = layouts.data();
+        allocate_info.descriptorSetCount          = kReadbackSlots;
+        allocate_info.descriptorPool              = yuv_descriptor_pool;
+        yuv_descriptor_sets.resize(kReadbackSlots);
+        VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocate_info, yuv_descriptor_sets.data()));
+
+        VkDescriptorImageInfo image_info =
+            dhh::initializer::DescriptorImageInfo(result_image_view, VK_IMAGE_LAYOUT_GENERAL, VK_NULL_HANDLE);
+        for (uint32_t slot = 0; slot < kReadbackSlots; ++slot)
         {
-            for (int col = 0; col < kWidth; ++col)
-            {
-                img[row * kWidth * 3 + col * 3 + 0] = data[col * 4 + 0];
-                img[row * kWidth * 3 + col * 3 + 1] = data[col * 4 + 1];
-                img[row * kWidth * 3 + col * 3 + 2] = data[col * 4 + 2];
-            }
-            data += subResourceLayout.rowPitch;
+            VkDescriptorBufferInfo planes_info =
+                dhh::initializer::DescriptorBufferInfo(readback_buffers[slot], 0, VK_WHOLE_SIZE);
+
+            std::vector<VkWriteDescriptorSet> writes = {
+                dhh::initializer::WriteDescriptorSet(
+                    VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, 0, yuv_descriptor_sets[slot], &image_info),
+                dhh::initializer::WriteDescriptorSet(
+                    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, 1, yuv_descriptor_sets[slot], &planes_info),
+            };
+            vkUpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
         }
+    }
+
+    // One VkSubmitInfo per tile, so no single one runs into the driver's watchdog; the last one signals the last frame
+    // of the batch, and with it every frame before.
+    void SubmitBatch(uint32_t batch)
+    {
+        const uint64_t kSignal = std::min((batch + 1) * kBatchFrames, kFrames);
 
-        stbi_write_png("raytraced.png", kHeight, kWidth, STBI_rgb, img, kWidth * 3);
+        VkTimelineSemaphoreSubmitInfo timeline_info = {};
+        timeline_info.sType                         = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timeline_info.signalSemaphoreValueCount     = 1;
+        timeline_info.pSignalSemaphoreValues        = &kSignal;
 
-        std::cout << "saved to disk" << std::endl;
+        const std::vector<VkCommandBuffer>& cmd_bufs = compute_cmd_bufs[batch];
+        std::vector<VkSubmitInfo> batches(cmd_bufs.size(), vks::initializers::submitInfo());
+        for (size_t i = 0; i < cmd_bufs.size(); ++i)
+        {
+            batches[i].commandBufferCount = 1;
+            batches[i].pCommandBuffers    = &cmd_bufs[i];
+        }
+        batches.back().pNext                = &timeline_info;
+        batches.back().signalSemaphoreCount = 1;
+        batches.back().pSignalSemaphores    = &frame_timeline;
+
+        VK_CHECK_RESULT(vkQueueSubmit(compute_queue, uint32_t(batches.size()), batches.data(), VK_NULL_HANDLE));
+    }
 
-        // Clean up resources
-        vmaUnmapMemory(allocator, save_image_allocation);
-        vmaFreeMemory(allocator, save_image_allocation);
-        vkDestroyImage(device, save_image, nullptr);
+    // Waits for a frame to land in its readback buffer and hands it to the encoder, which converts it before
+    // returning; the slot is free again afterwards.
+    void ConsumeFrame(uint32_t frame, MovieWriter& movie)
+    {
+        const uint64_t kValue = frame + 1;
+
+        VkSemaphoreWaitInfo wait_info = {};
+        wait_info.sType               = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        wait_info.semaphoreCount      = 1;
+        wait_info.pSemaphores         = &frame_timeline;
+        wait_info.pValues             = &kValue;
+        VK_CHECK_RESULT(vkWaitSemaphores(device, &wait_info, DEFAULT_FENCE_TIMEOUT));
+        ReportFrame(frame);
+
+        const uint32_t kSlot = frame % kReadbackSlots;
+        vmaInvalidateAllocation(allocator, readback_allocations[kSlot], 0, VK_WHOLE_SIZE);
+        if (kGpuYuv)
+        {
+            uint8_t* planes = readback_data[kSlot];
+            movie.addFrame({planes, planes + kChromaOffsetU, planes + kChromaOffsetV, kLumaStride, kChromaStride,
+                kChromaStride});
+        }
+        else
+        {
+            movie.addFrameRgbx(readback_data[kSlot]);
+        }
     }
 
+    // The host stays a batch behind the GPU: the frames of batch n are handed to the encoder while batch n + 1 is
+    // traced. A batch is submitted only once the frames that last used its slots have been consumed, so the GPU waits
+    // on the host only when the encoder falls behind.
+    void Render(MovieWriter& movie)
+    {
+        uint32_t consumed = 0;
+        for (uint32_t batch = 0; batch < compute_cmd_bufs.size(); ++batch)
+        {
+            const uint32_t kLast = std::min((batch + 1) * kBatchFrames, kFrames);
+            while (consumed + kReadbackSlots < kLast)
+            {
+                ConsumeFrame(consumed++, movie);
+            }
+            SubmitBatch(batch);
+        }
+        while (consumed < kFrames)
+        {
+            ConsumeFrame(consumed++, movie);
+        }
+    }
 
+    // Prefers the KTX 2 version of the cubemap when there is one.
     void LoadCubemap()
     {
-        std::filesystem::path filename = "resource/cubemap_yokohama_bc3_unorm.ktx";
-        ktxResult result;
-        ktxTexture* ktxTexture;
+        std::filesystem::path filename = "resource/cubemap_yokohama_bc3_unorm.ktx2";
+        if (!std::filesystem::exists(filename))
+            filename.replace_extension(".ktx");
         if (!std::filesystem::exists(filename))
         {
             throw std::runtime_error("cannot find texture");
         }
 
+        if (filename.extension() == ".ktx2")
+            LoadKtx2Cubemap(filename);
+        else
+            LoadKtxCubemap(filename);
+    }
+
+    void LoadKtxCubemap(const std::filesystem::path& filename)
+    {
+        ktxResult result;
+        ktxTexture* ktxTexture;
         result = ktxTexture_CreateFromNamedFile(
             std::filesystem::absolute(filename).string().c_str(), KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, &ktxTexture);
 
@@ -329,6 +1271,7 @@ public:
         cube_map.width               = ktxTexture->baseWidth;
         cube_map.height              = ktxTexture->baseHeight;
         cube_map.mipLevels           = ktxTexture->numLevels;
+        cube_map_format              = VK_FORMAT_BC3_UNORM_BLOCK;
         ktx_uint8_t* ktxTextureData = ktxTexture_GetData(ktxTexture);
         ktx_size_t ktxTextureSize   = ktxTexture_GetSize(ktxTexture);
 
@@ -340,16 +1283,9 @@ public:
         uint8_t* data;
         vmaMapMemory(allocator, staging_buffer_allocation, (void**) &data);
         memcpy(data, ktxTextureData, ktxTextureSize);
-        CreateImage(cube_map.width, cube_map.height, cube_map.mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_BC3_UNORM_BLOCK,
-            VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-            VMA_MEMORY_USAGE_GPU_ONLY, cube_map.image, cube_map.allocation, 6, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT);
-
-        VkCommandBuffer cmd_buf = CreateCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
 
         // Setup buffer copy regions for each face including all of its miplevels
         std::vector<VkBufferImageCopy> bufferCopyRegions;
-        uint32_t offset = 0;
-
         for (uint32_t face = 0; face < 6; face++)
         {
             for (uint32_t level = 0; level < cube_map.mipLevels; level++)
@@ -358,19 +1294,80 @@ public:
                 ktx_size_t offset;
                 KTX_error_code ret = ktxTexture_GetImageOffset(ktxTexture, level, 0, face, &offset);
                 assert(ret == KTX_SUCCESS);
-                VkBufferImageCopy bufferCopyRegion               = {};
-                bufferCopyRegion.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
-                bufferCopyRegion.imageSubresource.mipLevel       = level;
-                bufferCopyRegion.imageSubresource.baseArrayLayer = face;
-                bufferCopyRegion.imageSubresource.layerCount     = 1;
-                bufferCopyRegion.imageExtent.width               = ktxTexture->baseWidth >> level;
-                bufferCopyRegion.imageExtent.height              = ktxTexture->baseHeight >> level;
-                bufferCopyRegion.imageExtent.depth               = 1;
-                bufferCopyRegion.bufferOffset                    = offset;
-                bufferCopyRegions.push_back(bufferCopyRegion);
+                bufferCopyRegions.push_back(CubemapCopyRegion(face, level, offset));
+            }
+        }
+
+        UploadCubemap(staging_buffer, bufferCopyRegions);
+
+        vmaUnmapMemory(allocator, staging_buffer_allocation);
+        		// Clean up staging resources
+        vmaFreeMemory(allocator, staging_buffer_allocation);
+        vkDestroyBuffer(device, staging_buffer, nullptr);
+        ktxTexture_Destroy(ktxTexture);
+    }
+
+    // The file is mapped rather than read, and every mip level is decompressed on its own thread straight into the
+    // mapped staging buffer, so the texels are written to memory once.
+    void LoadKtx2Cubemap(const std::filesystem::path& filename)
+    {
+        const dhh::texture::Ktx2Texture kTexture(filename.string());
+        if (kTexture.Faces() != 6)
+            throw std::runtime_error(filename.string() + " is not a cubemap");
+
+        cube_map.width     = kTexture.Width();
+        cube_map.height    = kTexture.Height();
+        cube_map.mipLevels = kTexture.Levels();
+        cube_map_format    = static_cast<VkFormat>(kTexture.Format());
+
+        VkBuffer staging_buffer;
+        VmaAllocation staging_buffer_allocation;
+        CreateBuffer(kTexture.DecodedSize(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
+            staging_buffer, staging_buffer_allocation);
+
+        uint8_t* data;
+        vmaMapMemory(allocator, staging_buffer_allocation, (void**) &data);
+        kTexture.Decode(data);
+
+        std::vector<VkBufferImageCopy> copy_regions;
+        for (uint32_t face = 0; face < 6; face++)
+        {
+            for (uint32_t level = 0; level < cube_map.mipLevels; level++)
+            {
+                copy_regions.push_back(CubemapCopyRegion(face, level, kTexture.ImageOffset(level, 0, face)));
             }
         }
 
+        UploadCubemap(staging_buffer, copy_regions);
+
+        vmaUnmapMemory(allocator, staging_buffer_allocation);
+        vmaFreeMemory(allocator, staging_buffer_allocation);
+        vkDestroyBuffer(device, staging_buffer, nullptr);
+    }
+
+    VkBufferImageCopy CubemapCopyRegion(uint32_t face, uint32_t level, VkDeviceSize offset)
+    {
+        VkBufferImageCopy bufferCopyRegion               = {};
+        bufferCopyRegion.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+        bufferCopyRegion.imageSubresource.mipLevel       = level;
+        bufferCopyRegion.imageSubresource.baseArrayLayer = face;
+        bufferCopyRegion.imageSubresource.layerCount     = 1;
+        bufferCopyRegion.imageExtent.width               = std::max(cube_map.width >> level, 1u);
+        bufferCopyRegion.imageExtent.height              = std::max(cube_map.height >> level, 1u);
+        bufferCopyRegion.imageExtent.depth               = 1;
+        bufferCopyRegion.bufferOffset                    = offset;
+        return bufferCopyRegion;
+    }
+
+    // Creates the cubemap image and copies the faces into it from the staging buffer.
+    void UploadCubemap(VkBuffer staging_buffer, const std::vector<VkBufferImageCopy>& bufferCopyRegions)
+    {
+        CreateImage(cube_map.width, cube_map.height, cube_map.mipLevels, VK_SAMPLE_COUNT_1_BIT, cube_map_format,
+            VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY, cube_map.image, cube_map.allocation, 6, VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT);
+
+        VkCommandBuffer cmd_buf = CreateCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+
         // Image barrier for optimal image (target)
         // Set initial layout for all array layers (faces) of the optimal (target) tiled texture
         VkImageSubresourceRange subresourceRange = {};
@@ -391,13 +1388,7 @@ public:
         vks::tools::setImageLayout(
             cmd_buf, cube_map.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, cube_map.imageLayout, subresourceRange);
 
-        FlushCommandBuffer(cmd_buf, graphics_queue, true);
-
-        vmaUnmapMemory(allocator, staging_buffer_allocation);
-        		// Clean up staging resources
-        vmaFreeMemory(allocator, staging_buffer_allocation);
-        vkDestroyBuffer(device, staging_buffer, nullptr);
-        ktxTexture_Destroy(ktxTexture);
+        FlushCommandBuffer(cmd_buf, compute_queue, true);
     }
 };
 
@@ -406,20 +1397,41 @@ int main()
 {
     try
     {
-        RayTracer app(true);
+        // Only computes and reads back, so no window, surface or swapchain is created.
+        RayTracer app(true, true);
         app.Init();
         app.CreateComputePipeline();
         app.CreateSkyboxSampler();
         app.LoadCubemap();
         app.CreateSkybox();
         app.CreateResultImage();
+        app.CreateShadingLut();
+        app.CreateDiskLut();
+        app.CreateSceneBuffers();
+        app.CreateReadback();
+        if (kGpuYuv)
+        {
+            app.CreateYuvPipeline();
+            app.WriteYuvDescriptorSets();
+        }
         app.writeComputeDescriptorSet();
+        app.CreateQueries();
         app.BuildComputeCommandBuffers();
+
+        MovieWriter movie("raytraced", kWidth, kHeight);
         auto start = std::chrono::high_resolution_clock::now();
-        app.Compute();
+        app.Render(movie);
         auto end = std::chrono::high_resolution_clock::now();
-        std::cout << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-        app.SaveImage();
+        std::cout << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms for "
+                  << kFrames << " frames" << std::endl;
+        movie.close();
+        if (app.instrumented)
+        {
+            app.CheckReport();
+            app.report.saveResults();
+        }
+        app.DestroyQueries();
+        app.DestroyReadback();
     }
     catch (std::exception& e)
     {
@@ -1,3 +1,4 @@
 glslc.exe shader.vert -o vert.spv
 glslc.exe shader.frag -o frag.spv
 glslc.exe trace.comp -o trace.spv
+glslc.exe yuv420.comp -o yuv420.spv
@@ -0,0 +1,190 @@
+#include "block_texture.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+// From the ETC decoder vendored with libktx (gpu-offscreen/external/ktx/lib/etcdec.cxx).
+void decompressBlockETC2c(unsigned int block_part1, unsigned int block_part2, unsigned char* img, int width,
+    int height, int startx, int starty, int channels);
+
+namespace dhh::texture
+{
+    namespace
+    {
+        // glInternalFormat values of the KTX formats understood by LoadKtxCubemap.
+        constexpr uint32_t kGlRgbS3tcDxt1        = 0x83f0;
+        constexpr uint32_t kGlRgbaS3tcDxt1       = 0x83f1;
+        constexpr uint32_t kGlRgbaS3tcDxt5       = 0x83f3;
+        constexpr uint32_t kGlSrgbS3tcDxt1       = 0x8c4c;
+        constexpr uint32_t kGlSrgbAlphaS3tcDxt1  = 0x8c4d;
+        constexpr uint32_t kGlSrgbAlphaS3tcDxt5  = 0x8c4f;
+        constexpr uint32_t kGlRgb8Etc2           = 0x9274;
+        constexpr uint32_t kGlSrgb8Etc2          = 0x9275;
+        constexpr uint32_t kGlRgba8Etc2Eac       = 0x9278;
+        constexpr uint32_t kGlSrgb8Alpha8Etc2Eac = 0x9279;
+
+        // KTX stores cube faces as +X, -X, +Y, -Y, +Z, -Z.
+        constexpr int kKtxToFace[6] = {5, 4, 2, 3, 1, 0};
+
+        uint32_t ReadLittleEndian16(const uint8_t* p) { return uint32_t(p[0]) | uint32_t(p[1]) << 8; }
+
+        uint32_t ReadBigEndian32(const uint8_t* p)
+        {
+            return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+        }
+
+        // The color half of a BC1 or BC3 block. BC3 always interpolates four colors.
+        void DecodeBc1Color(const uint8_t* block, bool four_colors, uint8_t* bgr)
+        {
+            const uint32_t kColor0 = ReadLittleEndian16(block);
+            const uint32_t kColor1 = ReadLittleEndian16(block + 2);
+
+            int palette[4][3];
+            for (int i = 0; i < 2; ++i)
+            {
+                const uint32_t kColor = i ? kColor1 : kColor0;
+                const uint32_t kR     = kColor >> 11 & 31;
+                const uint32_t kG     = kColor >> 5 & 63;
+                const uint32_t kB     = kColor & 31;
+                palette[i][0]         = int(kB << 3 | kB >> 2);
+                palette[i][1]         = int(kG << 2 | kG >> 4);
+                palette[i][2]         = int(kR << 3 | kR >> 2);
+            }
+            for (int c = 0; c < 3; ++c)
+            {
+                if (four_colors || kColor0 > kColor1)
+                {
+                    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+                }
+                else
+                {
+                    palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+                    palette[3][c] = 0;
+                }
+            }
+
+            for (int i = 0; i < 16; ++i)
+            {
+                const int kIndex = block[4 + i / 4] >> (i % 4 * 2) & 3;
+                for (int c = 0; c < 3; ++c)
+                {
+                    bgr[i * 3 + c] = uint8_t(palette[kIndex][c]);
+                }
+            }
+        }
+
+        void DecodeEtc2Color(const uint8_t* block, uint8_t* bgr)
+        {
+            uint8_t rgb[16 * 3];
+            decompressBlockETC2c(ReadBigEndian32(block), ReadBigEndian32(block + 4), rgb, 4, 4, 0, 0, 3);
+            for (int i = 0; i < 16; ++i)
+            {
+                bgr[i * 3 + 0] = rgb[i * 3 + 2];
+                bgr[i * 3 + 1] = rgb[i * 3 + 1];
+                bgr[i * 3 + 2] = rgb[i * 3 + 0];
+            }
+        }
+    }
+
+    size_t BlockBytes(BlockFormat format)
+    {
+        return format == kBc3 || format == kEtc2Rgba ? 16 : 8;
+    }
+
+    void DecodeBlock(BlockFormat format, const uint8_t* block, uint8_t* bgr)
+    {
+        switch (format)
+        {
+        case kBc1:
+            DecodeBc1Color(block, false, bgr);
+            break;
+        case kBc3:
+            DecodeBc1Color(block + 8, true, bgr);
+            break;
+        case kEtc2Rgb:
+            DecodeEtc2Color(block, bgr);
+            break;
+        case kEtc2Rgba:
+            DecodeEtc2Color(block + 8, bgr);
+            break;
+        }
+    }
+
+    BlockTexture::BlockTexture(BlockFormat format, int width, int height, std::vector<uint8_t> blocks)
+        : id_(NextId()),
+          format_(format),
+          width_(width),
+          height_(height),
+          blocks_x_(size_t(width + 3) / 4),
+          block_bytes_(BlockBytes(format)),
+          blocks_(std::move(blocks))
+    {
+        if (blocks_.size() < blocks_x_ * ((height + 3) / 4) * block_bytes_)
+            throw std::runtime_error("too few blocks for the texture size");
+    }
+
+    std::vector<BlockTexture> LoadKtxCubemap(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            throw std::runtime_error("cannot open " + path);
+
+        const uint8_t kIdentifier[12] = {0xab, 'K', 'T', 'X', ' ', '1', '1', 0xbb, '\r', '\n', 0x1a, '\n'};
+        uint8_t identifier[12];
+        uint32_t header[13];
+        file.read(reinterpret_cast<char*>(identifier), sizeof(identifier));
+        file.read(reinterpret_cast<char*>(header), sizeof(header));
+        if (!file || std::memcmp(identifier, kIdentifier, sizeof(kIdentifier)) != 0 || header[0] != 0x04030201)
+            throw std::runtime_error(path + " is not a KTX 1 file in native byte order");
+
+        const uint32_t kInternalFormat = header[4];
+        const int kWidth               = int(header[6]);
+        const int kHeight              = int(header[7]);
+        if (header[9] > 1 || header[10] != 6)
+            throw std::runtime_error(path + " is not a cubemap");
+
+        BlockFormat format;
+        switch (kInternalFormat)
+        {
+        case kGlRgbS3tcDxt1:
+        case kGlRgbaS3tcDxt1:
+        case kGlSrgbS3tcDxt1:
+        case kGlSrgbAlphaS3tcDxt1:
+            format = kBc1;
+            break;
+        case kGlRgbaS3tcDxt5:
+        case kGlSrgbAlphaS3tcDxt5:
+            format = kBc3;
+            break;
+        case kGlRgb8Etc2:
+        case kGlSrgb8Etc2:
+            format = kEtc2Rgb;
+            break;
+        case kGlRgba8Etc2Eac:
+        case kGlSrgb8Alpha8Etc2Eac:
+            format = kEtc2Rgba;
+            break;
+        default:
+            throw std::runtime_error(path + " is not BC1, BC3 or ETC2 compressed");
+        }
+
+        file.seekg(header[12], std::ios::cur);
+        uint32_t image_size;
+        file.read(reinterpret_cast<char*>(&image_size), sizeof(image_size));
+
+        // For a cubemap that is not an array, image_size is the size of one face. Block sizes keep every face
+        // 4-byte aligned, so there is no cube padding.
+        std::vector<BlockTexture> faces(6, BlockTexture(format, 0, 0, {}));
+        for (int i = 0; i < 6; ++i)
+        {
+            std::vector<uint8_t> blocks(image_size);
+            file.read(reinterpret_cast<char*>(blocks.data()), image_size);
+            if (!file)
+                throw std::runtime_error(path + " is truncated");
+            faces[kKtxToFace[i]] = BlockTexture(format, kWidth, kHeight, std::move(blocks));
+        }
+        return faces;
+    }
+}
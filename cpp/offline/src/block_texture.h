@@ -0,0 +1,101 @@
+#pragma once
+
+#include "sky_map.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace dhh::texture
+{
+    enum BlockFormat
+    {
+        kBc1,
+        kBc3,
+        kEtc2Rgb,
+        kEtc2Rgba
+    };
+
+    // Entries of the per-thread cache of decoded blocks, shared by all textures.
+    constexpr size_t kBlockCacheSize = 64;
+
+    // Bytes of one 4x4 block: 8 for BC1 and ETC2 RGB, 16 for the formats carrying alpha.
+    size_t BlockBytes(BlockFormat format);
+
+    // Decodes the color of one 4x4 block into 16 BGR texels, row by row. Alpha is ignored.
+    void DecodeBlock(BlockFormat format, const uint8_t* block, uint8_t* bgr);
+
+    // An image kept block-compressed in memory, 4-8 times smaller than BGR8. Lookups decode the 4x4 block holding
+    // the texel; each thread keeps its recently decoded blocks, so neighbouring lookups rarely decode twice.
+    class BlockTexture
+    {
+    public:
+        BlockTexture(BlockFormat format, int width, int height, std::vector<uint8_t> blocks);
+
+        BlockFormat Format() const { return format_; }
+        int Width() const { return width_; }
+        int Height() const { return height_; }
+        size_t Bytes() const { return blocks_.size(); }
+
+        std::array<uint8_t, 3> Texel(int x, int y) const
+        {
+            struct CachedBlock
+            {
+                uint64_t key = ~uint64_t(0);
+                uint8_t bgr[16 * 3];
+            };
+            thread_local std::array<CachedBlock, kBlockCacheSize> cache;
+
+            const size_t kBlock = size_t(y / 4) * blocks_x_ + x / 4;
+            const uint64_t kKey = id_ << 40 | kBlock;
+            CachedBlock& entry  = cache[(kKey * 0x9e3779b97f4a7c15ull) >> 58 & (kBlockCacheSize - 1)];
+            if (entry.key != kKey)
+            {
+                DecodeBlock(format_, &blocks_[kBlock * block_bytes_], entry.bgr);
+                entry.key = kKey;
+            }
+            const uint8_t* texel = &entry.bgr[((y % 4) * 4 + x % 4) * 3];
+            return {texel[0], texel[1], texel[2]};
+        }
+
+    private:
+        static uint64_t NextId()
+        {
+            static std::atomic<uint64_t> next(1);
+            return next.fetch_add(1);
+        }
+
+        uint64_t id_;
+        BlockFormat format_;
+        int width_, height_;
+        size_t blocks_x_;
+        size_t block_bytes_;
+        std::vector<uint8_t> blocks_;
+    };
+
+    // Level 0 of a block-compressed KTX 1 cubemap (BC1, BC3, ETC2 RGB or ETC2 RGBA, linear or sRGB), as six faces
+    // in the order of dhh::skybox::kFaceNames.
+    std::vector<BlockTexture> LoadKtxCubemap(const std::string& path);
+
+    // The sky behind six block-compressed faces in the order of dhh::skybox::kFaceNames.
+    class BlockSkyMap : public skybox::FaceSkyMap
+    {
+    public:
+        explicit BlockSkyMap(std::vector<BlockTexture> faces) : faces_(std::move(faces))
+        {
+            if (faces_.size() != 6)
+                throw std::runtime_error("a cubemap needs six faces");
+        }
+
+        int FaceWidth(int face) const override { return faces_[face].Width(); }
+        int FaceHeight(int face) const override { return faces_[face].Height(); }
+        std::array<uint8_t, 3> FaceTexel(int face, int x, int y) const override { return faces_[face].Texel(x, y); }
+
+    private:
+        std::vector<BlockTexture> faces_;
+    };
+}
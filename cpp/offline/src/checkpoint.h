@@ -0,0 +1,95 @@
+#pragma once
+
+#include "image_writer.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace dhh::checkpoint
+{
+    // Render parameters that must match for finished work to be reused, one "key = value" line each.
+    using Manifest = std::map<std::string, std::string>;
+
+    inline std::string ToString(const Manifest& manifest)
+    {
+        std::ostringstream out;
+        for (const auto& [key, value] : manifest)
+        {
+            out << key << " = " << value << "\n";
+        }
+        return out.str();
+    }
+
+    // FNV-1a, to fingerprint parameters too long for the manifest such as a camera path.
+    inline uint64_t Fingerprint(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // A directory holding the manifest of a job and its finished frames, one HDR file per frame. Frames are only
+    // ever published complete (see dhh::image::WriteImage), so after an interruption every frame file present is
+    // valid and a resumed job traces exactly the missing ones.
+    class Checkpoint
+    {
+    public:
+        // Creates the directory, or reopens it if it was made with the same manifest. Throws if it holds a
+        // different job rather than mixing frames of two renders.
+        Checkpoint(const std::filesystem::path& dir, const Manifest& manifest) : dir_(dir)
+        {
+            std::filesystem::create_directories(dir_);
+
+            const std::string kText = ToString(manifest);
+            const auto kPath        = dir_ / "manifest.txt";
+            if (std::filesystem::exists(kPath))
+            {
+                std::ifstream in(kPath, std::ios::binary);
+                std::stringstream existing;
+                existing << in.rdbuf();
+                if (existing.str() != kText)
+                    throw std::runtime_error(
+                        dir_.string() + " holds a render with different parameters; remove it or pick another");
+                return;
+            }
+
+            // Published like a frame, so an interruption never leaves a truncated manifest that no restart matches.
+            dhh::image::WriteFile(kPath.string(), kText.data(), kText.size());
+        }
+
+        const std::filesystem::path& Dir() const { return dir_; }
+
+        std::filesystem::path FramePath(int frame) const
+        {
+            char name[32];
+            std::snprintf(name, sizeof(name), "frame_%05d.exr", frame);
+            return dir_ / name;
+        }
+
+        bool HasFrame(int frame) const { return std::filesystem::exists(FramePath(frame)); }
+
+        std::vector<int> MissingFrames(int frames) const
+        {
+            std::vector<int> missing;
+            for (int frame = 0; frame < frames; ++frame)
+            {
+                if (!HasFrame(frame))
+                    missing.push_back(frame);
+            }
+            return missing;
+        }
+
+    private:
+        std::filesystem::path dir_;
+    };
+}
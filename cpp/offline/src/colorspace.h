@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace dhh::movie
+{
+    // Destination planes of a YUV 4:2:0 picture, e.g. AVFrame::data / AVFrame::linesize of an AV_PIX_FMT_YUV420P
+    // frame. Chroma planes are (width + 1) / 2 by (height + 1) / 2.
+    struct Yuv420Planes
+    {
+        uint8_t* y;
+        uint8_t* u;
+        uint8_t* v;
+        ptrdiff_t y_stride;
+        ptrdiff_t u_stride;
+        ptrdiff_t v_stride;
+    };
+
+    // Source pixel layouts accepted by RgbToYuv420. Each describes how to fetch normalised R, G, B from one pixel.
+    struct Rgb8
+    {
+        using Component                = uint8_t;
+        static constexpr int kChannels = 3;
+        static constexpr int kR = 0, kG = 1, kB = 2;
+        static float Load(Component c) { return c * (1.f / 255.f); }
+    };
+
+    // Cairo CAIRO_FORMAT_RGB24 / ARGB32 on little-endian hosts.
+    struct Bgrx8
+    {
+        using Component                = uint8_t;
+        static constexpr int kChannels = 4;
+        static constexpr int kR = 2, kG = 1, kB = 0;
+        static float Load(Component c) { return c * (1.f / 255.f); }
+    };
+
+    // Vulkan VK_FORMAT_R8G8B8A8_UNORM, as read back from the GPU tracer; alpha is ignored.
+    struct Rgbx8
+    {
+        using Component                = uint8_t;
+        static constexpr int kChannels = 4;
+        static constexpr int kR = 0, kG = 1, kB = 2;
+        static float Load(Component c) { return c * (1.f / 255.f); }
+    };
+
+    // The tracer's framebuffer: three floats per pixel, nominally in [0, 1].
+    struct Rgb32f
+    {
+        using Component                = float;
+        static constexpr int kChannels = 3;
+        static constexpr int kR = 0, kG = 1, kB = 2;
+        static float Load(Component c) { return std::min(std::max(c, 0.f), 1.f); }
+    };
+
+    // BT.709 coefficients, limited ("TV") range as expected by the video encoders.
+    constexpr float kKr = 0.2126f;
+    constexpr float kKb = 0.0722f;
+    constexpr float kKg = 1.f - kKr - kKb;
+
+    constexpr float kYScale  = 219.f;
+    constexpr float kYOffset = 16.f;
+    constexpr float kCScale  = 224.f;
+    constexpr float kCOffset = 128.f;
+
+    inline uint8_t Quantize(float v)
+    {
+        return static_cast<uint8_t>(std::min(std::max(v + 0.5f, 0.f), 255.f));
+    }
+
+    inline uint8_t LumaFromRgb(float r, float g, float b)
+    {
+        return Quantize(kYOffset + kYScale * (kKr * r + kKg * g + kKb * b));
+    }
+
+    inline uint8_t CbFromRgb(float r, float g, float b)
+    {
+        float y = kKr * r + kKg * g + kKb * b;
+        return Quantize(kCOffset + kCScale * (b - y) / (2.f * (1.f - kKb)));
+    }
+
+    inline uint8_t CrFromRgb(float r, float g, float b)
+    {
+        float y = kKr * r + kKg * g + kKb * b;
+        return Quantize(kCOffset + kCScale * (r - y) / (2.f * (1.f - kKr)));
+    }
+
+    // Converts one pair of source rows (the second may equal the first on an odd last row) into two luma rows and
+    // one chroma row. Chroma is taken from the 2x2 average of RGB, which is linear and therefore equal to averaging
+    // Cb / Cr. The loops are branch-free over the interior so the compiler can vectorise them.
+    template <typename Layout>
+    void ConvertRowPair(const typename Layout::Component* row0, const typename Layout::Component* row1, int width,
+        uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v)
+    {
+        constexpr int kC = Layout::kChannels;
+
+#pragma omp simd
+        for (int x = 0; x < width; ++x)
+        {
+            const typename Layout::Component* p = row0 + x * kC;
+            y0[x] = LumaFromRgb(Layout::Load(p[Layout::kR]), Layout::Load(p[Layout::kG]), Layout::Load(p[Layout::kB]));
+        }
+        if (y1 != y0)
+        {
+#pragma omp simd
+            for (int x = 0; x < width; ++x)
+            {
+                const typename Layout::Component* p = row1 + x * kC;
+                y1[x] =
+                    LumaFromRgb(Layout::Load(p[Layout::kR]), Layout::Load(p[Layout::kG]), Layout::Load(p[Layout::kB]));
+            }
+        }
+
+        const int kChromaWidth = (width + 1) / 2;
+#pragma omp simd
+        for (int cx = 0; cx < kChromaWidth; ++cx)
+        {
+            const int kX0 = 2 * cx * kC;
+            const int kX1 = std::min(2 * cx + 1, width - 1) * kC;
+
+            float r = Layout::Load(row0[kX0 + Layout::kR]) + Layout::Load(row0[kX1 + Layout::kR])
+                      + Layout::Load(row1[kX0 + Layout::kR]) + Layout::Load(row1[kX1 + Layout::kR]);
+            float g = Layout::Load(row0[kX0 + Layout::kG]) + Layout::Load(row0[kX1 + Layout::kG])
+                      + Layout::Load(row1[kX0 + Layout::kG]) + Layout::Load(row1[kX1 + Layout::kG]);
+            float b = Layout::Load(row0[kX0 + Layout::kB]) + Layout::Load(row0[kX1 + Layout::kB])
+                      + Layout::Load(row1[kX0 + Layout::kB]) + Layout::Load(row1[kX1 + Layout::kB]);
+
+            u[cx] = CbFromRgb(r * 0.25f, g * 0.25f, b * 0.25f);
+            v[cx] = CrFromRgb(r * 0.25f, g * 0.25f, b * 0.25f);
+        }
+    }
+
+    // Converts a packed RGB image straight into YUV 4:2:0 planes. stride is the distance between source rows in
+    // bytes. Row pairs are split into tiles across the OpenMP threads; no intermediate image is allocated.
+    template <typename Layout>
+    void RgbToYuv420(const typename Layout::Component* pixels, size_t stride, int width, int height,
+        const Yuv420Planes& planes)
+    {
+        const int kRowPairs = (height + 1) / 2;
+        const uint8_t* base = reinterpret_cast<const uint8_t*>(pixels);
+
+#pragma omp parallel for schedule(static)
+        for (int pair = 0; pair < kRowPairs; ++pair)
+        {
+            const int kRow0 = 2 * pair;
+            const int kRow1 = std::min(kRow0 + 1, height - 1);
+
+            auto row0 = reinterpret_cast<const typename Layout::Component*>(base + kRow0 * stride);
+            auto row1 = reinterpret_cast<const typename Layout::Component*>(base + kRow1 * stride);
+
+            ConvertRowPair<Layout>(row0, row1, width, planes.y + kRow0 * planes.y_stride,
+                planes.y + kRow1 * planes.y_stride, planes.u + pair * planes.u_stride,
+                planes.v + pair * planes.v_stride);
+        }
+    }
+
+    // Copies the visible part of a YUV 4:2:0 picture between planes of any strides; padding is left alone.
+    inline void CopyYuv420(const Yuv420Planes& from, int width, int height, const Yuv420Planes& to)
+    {
+        const int kChromaWidth  = (width + 1) / 2;
+        const int kChromaHeight = (height + 1) / 2;
+        for (int row = 0; row < height; ++row)
+        {
+            std::memcpy(to.y + row * to.y_stride, from.y + row * from.y_stride, width);
+        }
+        for (int row = 0; row < kChromaHeight; ++row)
+        {
+            std::memcpy(to.u + row * to.u_stride, from.u + row * from.u_stride, kChromaWidth);
+            std::memcpy(to.v + row * to.v_stride, from.v + row * from.v_stride, kChromaWidth);
+        }
+    }
+}
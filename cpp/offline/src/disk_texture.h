@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace dhh::disk
+{
+    struct Rgb
+    {
+        float r, g, b;
+    };
+
+    // The color of the accretion disk over (radius, azimuth), baked once into a table with a mip chain. u runs from
+    // the inner (0) to the outer (1) edge and is clamped; v is the azimuth in turns and wraps. Lookups are bilinear
+    // and never leave the table, whatever the coordinates, including NaN. Any number of threads may sample the table
+    // as long as none calls Update.
+    //
+    // Level(l) holds the texels row by row, one row per azimuth step: uploaded as a 2D texture with clamp-to-edge
+    // on u and repeat on v, a GPU sampler returns the same colors.
+    class DiskLut
+    {
+    public:
+        DiskLut(int radial, int azimuthal, std::vector<Rgb> texels)
+        {
+            if (radial <= 0 || azimuthal <= 0 || texels.size() != size_t(radial) * azimuthal)
+                throw std::runtime_error("disk texture size does not match its texels");
+            levels_.push_back({radial, azimuthal, std::move(texels)});
+
+            while (levels_.back().radial > 1 || levels_.back().azimuthal > 1)
+            {
+                const Table& fine = levels_.back();
+                Table coarse      = {std::max(fine.radial / 2, 1), std::max(fine.azimuthal / 2, 1), {}};
+                coarse.texels.resize(size_t(coarse.radial) * coarse.azimuthal);
+                levels_.push_back(std::move(coarse));
+                Filter(Levels() - 1, 0, 0, levels_.back().radial, levels_.back().azimuthal);
+            }
+        }
+
+        // Evaluates color(u, v) at every texel center, on all OpenMP threads.
+        template <typename Function>
+        static DiskLut Bake(int radial, int azimuthal, Function color)
+        {
+            std::vector<Rgb> texels(size_t(radial) * azimuthal);
+#pragma omp parallel for
+            for (int y = 0; y < azimuthal; ++y)
+            {
+                for (int x = 0; x < radial; ++x)
+                {
+                    texels[size_t(y) * radial + x] = color((x + 0.5) / radial, (y + 0.5) / azimuthal);
+                }
+            }
+            return DiskLut(radial, azimuthal, std::move(texels));
+        }
+
+        // An 8-bit BGR image: columns from the inner to the outer edge, rows around the disk.
+        static DiskLut FromImage(const uint8_t* bgr, int width, int height, size_t stride)
+        {
+            std::vector<Rgb> texels(size_t(width) * height);
+            for (int y = 0; y < height; ++y)
+            {
+                const uint8_t* row = bgr + y * stride;
+                for (int x = 0; x < width; ++x)
+                {
+                    texels[size_t(y) * width + x] = FromBgr(row + x * 3);
+                }
+            }
+            return DiskLut(width, height, std::move(texels));
+        }
+
+        // Replaces level 0 with an image of the same size, as FromImage, e.g. the next frame of a movie. Only the
+        // texels of the coarser levels over the part that changed are filtered again.
+        void Update(const uint8_t* bgr, int width, int height, size_t stride)
+        {
+            Table& base = levels_[0];
+            if (width != base.radial || height != base.azimuthal)
+                throw std::runtime_error("disk texture size does not match its texels");
+
+            // The changed texels lie in [x0, x1) x [y0, y1).
+            int x0 = width, y0 = height, x1 = 0, y1 = 0;
+            for (int y = 0; y < height; ++y)
+            {
+                const uint8_t* row = bgr + y * stride;
+                for (int x = 0; x < width; ++x)
+                {
+                    const Rgb kTexel = FromBgr(row + x * 3);
+                    Rgb& texel       = base.texels[size_t(y) * width + x];
+                    if (kTexel.r == texel.r && kTexel.g == texel.g && kTexel.b == texel.b)
+                        continue;
+                    texel = kTexel;
+                    x0    = std::min(x0, x);
+                    y0    = std::min(y0, y);
+                    x1    = std::max(x1, x + 1);
+                    y1    = std::max(y1, y + 1);
+                }
+            }
+
+            for (int level = 1; level < Levels() && x0 < x1; ++level)
+            {
+                const Table& coarse = levels_[level];
+                x0                  = std::min(x0 / 2, coarse.radial - 1);
+                y0                  = std::min(y0 / 2, coarse.azimuthal - 1);
+                x1                  = std::min((x1 - 1) / 2, coarse.radial - 1) + 1;
+                y1                  = std::min((y1 - 1) / 2, coarse.azimuthal - 1) + 1;
+                Filter(level, x0, y0, x1, y1);
+            }
+        }
+
+        int Levels() const { return int(levels_.size()); }
+        int Radial(int level = 0) const { return levels_[level].radial; }
+        int Azimuthal(int level = 0) const { return levels_[level].azimuthal; }
+        const std::vector<Rgb>& Level(int level) const { return levels_[level].texels; }
+
+        // The level to sample for a ray footprint of du along the radius and dv turns around the disk: the one where
+        // the footprint covers about a texel, rounded to the nearest level as a GPU sampler with nearest mipmapping
+        // does. A zero or NaN footprint selects level 0.
+        int LevelFor(double du, double dv) const
+        {
+            const double kTexels = std::max(du * levels_[0].radial, dv * levels_[0].azimuthal);
+            if (!(kTexels > 1))
+                return 0;
+            return std::min(int(std::floor(std::log2(kTexels) + 0.5)), Levels() - 1);
+        }
+
+        Rgb Sample(double u, double v, int level = 0) const
+        {
+            const Table& table = levels_[std::clamp(level, 0, Levels() - 1)];
+
+            // Texel centers sit at (i + 0.5) / size. A NaN radius ends up at the inner edge, an infinite or NaN
+            // azimuth at 0.
+            u               = u > 0 ? std::min(u, 1.0) : 0.0;
+            v               = std::isfinite(v) ? v - std::floor(v) : 0.0;
+            const double kX = std::max(u * table.radial - 0.5, 0.0);
+            const double kY = v * table.azimuthal - 0.5 + table.azimuthal;
+            const int kX0   = std::min(int(kX), table.radial - 1);
+            const int kX1   = std::min(kX0 + 1, table.radial - 1);
+            const int kY0   = int(kY) % table.azimuthal;
+            const int kY1   = (kY0 + 1) % table.azimuthal;
+            const float kFx = float(std::min(kX - kX0, 1.0));
+            const float kFy = float(kY - std::floor(kY));
+
+            const Rgb& a = table.texels[size_t(kY0) * table.radial + kX0];
+            const Rgb& b = table.texels[size_t(kY0) * table.radial + kX1];
+            const Rgb& c = table.texels[size_t(kY1) * table.radial + kX0];
+            const Rgb& d = table.texels[size_t(kY1) * table.radial + kX1];
+            auto mix     = [&](float Rgb::*channel) {
+                const float kTop    = a.*channel + (b.*channel - a.*channel) * kFx;
+                const float kBottom = c.*channel + (d.*channel - c.*channel) * kFx;
+                return kTop + (kBottom - kTop) * kFy;
+            };
+            return {mix(&Rgb::r), mix(&Rgb::g), mix(&Rgb::b)};
+        }
+
+    private:
+        struct Table
+        {
+            int radial;
+            int azimuthal;
+            std::vector<Rgb> texels;
+        };
+
+        static Rgb FromBgr(const uint8_t* bgr) { return {bgr[2] / 255.f, bgr[1] / 255.f, bgr[0] / 255.f}; }
+
+        // Recomputes the texels [x0, x1) x [y0, y1) of level from the level above: a 2x2 box filter, with an odd last
+        // column or row folded into the previous texel.
+        void Filter(int level, int x0, int y0, int x1, int y1)
+        {
+            const Table& fine = levels_[level - 1];
+            Table& coarse     = levels_[level];
+            for (int y = y0; y < y1; ++y)
+            {
+                const int kFineY1 = y == coarse.azimuthal - 1 ? fine.azimuthal : 2 * y + 2;
+                for (int x = x0; x < x1; ++x)
+                {
+                    const int kFineX1 = x == coarse.radial - 1 ? fine.radial : 2 * x + 2;
+                    Rgb sum           = {0, 0, 0};
+                    int count         = 0;
+                    for (int fy = 2 * y; fy < kFineY1; ++fy)
+                    {
+                        for (int fx = 2 * x; fx < kFineX1; ++fx)
+                        {
+                            const Rgb& texel = fine.texels[size_t(fy) * fine.radial + fx];
+                            sum.r += texel.r;
+                            sum.g += texel.g;
+                            sum.b += texel.b;
+                            ++count;
+                        }
+                    }
+                    coarse.texels[size_t(y) * coarse.radial + x] = {sum.r / count, sum.g / count, sum.b / count};
+                }
+            }
+        }
+
+        std::vector<Table> levels_;
+    };
+
+    // sRGB-ish color of a black body, from Tanner Helland's fit to the CIE data, between 1000 K and 40000 K.
+    inline Rgb BlackbodyColor(double kelvin)
+    {
+        const double kT = std::clamp(kelvin, 1000.0, 40000.0) / 100;
+        const double kR = kT <= 66 ? 255 : 329.698727446 * std::pow(kT - 60, -0.1332047592);
+        const double kG =
+            kT <= 66 ? 99.4708025861 * std::log(kT) - 161.1195681661 : 288.1221695283 * std::pow(kT - 60, -0.0755148492);
+        const double kB = kT >= 66 ? 255 : kT <= 19 ? 0 : 138.5177312231 * std::log(kT - 10) - 305.0447927307;
+        return {float(std::clamp(kR, 0.0, 255.0) / 255), float(std::clamp(kG, 0.0, 255.0) / 255),
+            float(std::clamp(kB, 0.0, 255.0) / 255)};
+    }
+
+    // Thin disk temperature at radius r, T ~ (r^-3 (1 - sqrt(inner / r)))^(1/4), scaled so the hottest radius reaches
+    // peak_kelvin. The profile peaks at r = 49/36 inner.
+    inline double DiskTemperature(double r, double inner, double peak_kelvin)
+    {
+        auto profile = [inner](double radius) {
+            return std::pow(std::max(1 - std::sqrt(inner / radius), 0.0) / (radius * radius * radius), 0.25);
+        };
+        return peak_kelvin * profile(r) / profile(inner * 49 / 36);
+    }
+
+    // Black body colors of DiskTemperature. Brightness follows T^4 relative to the peak. Independent of the azimuth,
+    // so one row suffices.
+    inline DiskLut TemperatureProfile(double inner, double outer, double peak_kelvin, int radial = 256)
+    {
+        return DiskLut::Bake(radial, 1, [&](double u, double) {
+            const double kRelative = DiskTemperature(inner + u * (outer - inner), inner, peak_kelvin) / peak_kelvin;
+            const Rgb kColor       = BlackbodyColor(peak_kelvin * kRelative);
+            const float kIntensity = float(std::pow(kRelative, 4));
+            return Rgb{kColor.r * kIntensity, kColor.g * kIntensity, kColor.b * kIntensity};
+        });
+    }
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dhh::movie
+{
+    // Bounded single-producer / single-consumer ring of preallocated slots.
+    //
+    // The producer fills a slot in place (AcquireWrite / CommitWrite) and the consumer drains it in place
+    // (AcquireRead / ReleaseRead), so no frame is ever copied or allocated after construction. Both ends run
+    // lock-free on the fast path; a thread only parks on the condition variable when the ring is full (producer
+    // backpressure) or empty (consumer idle).
+    template <typename T>
+    class FrameQueue
+    {
+    public:
+        explicit FrameQueue(size_t capacity) : slots_(capacity) {}
+
+        FrameQueue(const FrameQueue&) = delete;
+        FrameQueue& operator=(const FrameQueue&) = delete;
+
+        size_t Capacity() const { return slots_.size(); }
+
+        // Direct access to the slot storage, used to preallocate buffers before the consumer is started.
+        T& Slot(size_t index) { return slots_[index]; }
+
+        size_t Size() const { return tail_.load() - head_.load(); }
+
+        // Returns the next free slot, blocking while the ring is full. Returns nullptr once the queue is closed.
+        T* AcquireWrite()
+        {
+            const size_t kTail = tail_.load(std::memory_order_relaxed);
+            if (closed_.load() || !Wait(producer_waiting_, [&] { return kTail - head_.load() < slots_.size(); }))
+            {
+                return nullptr;
+            }
+            return &slots_[kTail % slots_.size()];
+        }
+
+        // Publishes the slot returned by the last AcquireWrite.
+        void CommitWrite()
+        {
+            tail_.fetch_add(1);
+            Notify(consumer_waiting_);
+        }
+
+        // Returns the oldest filled slot, blocking while the ring is empty. Returns nullptr once the queue is closed
+        // and fully drained.
+        T* AcquireRead()
+        {
+            const size_t kHead = head_.load(std::memory_order_relaxed);
+            if (!Wait(consumer_waiting_, [&] { return tail_.load() != kHead; }))
+            {
+                return nullptr;
+            }
+            return &slots_[kHead % slots_.size()];
+        }
+
+        // Hands the slot returned by the last AcquireRead back to the producer.
+        void ReleaseRead()
+        {
+            head_.fetch_add(1);
+            Notify(producer_waiting_);
+        }
+
+        // Blocks until every committed slot has been released by the consumer.
+        void WaitEmpty()
+        {
+            Wait(producer_waiting_, [&] { return head_.load() == tail_.load(); });
+        }
+
+        // Wakes both ends. Pending slots can still be drained by the consumer.
+        void Close()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                closed_.store(true);
+            }
+            cv_.notify_all();
+        }
+
+        bool Closed() const { return closed_.load(); }
+
+    private:
+        static constexpr int kSpinCount = 64;
+
+        template <typename Predicate>
+        bool Wait(std::atomic<bool>& waiting, Predicate ready)
+        {
+            for (int i = 0; i < kSpinCount; ++i)
+            {
+                if (ready())
+                    return true;
+                if (closed_.load())
+                    return false;
+                std::this_thread::yield();
+            }
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            waiting.store(true);
+            cv_.wait(lock, [&] { return ready() || closed_.load(); });
+            waiting.store(false);
+            return ready();
+        }
+
+        void Notify(std::atomic<bool>& waiting)
+        {
+            // Sequentially consistent with the index update, so a waiter either sees the new index or is seen here.
+            if (waiting.load())
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                }
+                cv_.notify_all();
+            }
+        }
+
+        std::vector<T> slots_;
+        std::atomic<size_t> head_{0};
+        std::atomic<size_t> tail_{0};
+        std::atomic<bool> closed_{false};
+        std::atomic<bool> producer_waiting_{false};
+        std::atomic<bool> consumer_waiting_{false};
+        std::mutex mutex_;
+        std::condition_variable cv_;
+    };
+}
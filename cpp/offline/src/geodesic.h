@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+namespace dhh::geodesic
+{
+    // sqrt(27), in units of M: photons with a smaller impact parameter fall in, photons with a larger one turn around
+    // at their closest approach.
+    constexpr double kCriticalImpact = 5.196152422706632;
+
+    // Within this distance of kCriticalImpact photons wind around the photon sphere and single precision loses the
+    // turning point; SweptAngleMixed integrates those in double.
+    constexpr double kSinglePrecisionBand = 0.01;
+
+    // Error allowed per step by SweptAngle in single precision. Smaller values only buy rounding noise.
+    constexpr float kSinglePrecisionTolerance = 1e-5f;
+
+    // The azimuth a photon with impact parameter b sweeps between radii r0 and r1, the same integral as ode23 in
+    // library.h, but over u = 1 / r:
+    //
+    //     dphi / du = 1 / sqrt(1 / b^2 - u^2 (1 - 2 u))
+    //
+    // The integrand has no r^2 factors to overflow or cancel, so the adaptive Bogacki-Shampine steps keep their
+    // accuracy in float. The radicand is evaluated with one rounding, and the angle and u are both accumulated with
+    // Kahan summation, so rounding does not build up over the steps. The last step ends exactly on r1. compute
+    // shaders port this as is, in both precisions.
+    template <typename Real>
+    Real SweptAngle(Real r0, Real r1, Real b, Real tolerance)
+    {
+        Real u0       = 1 / r1;
+        Real u1       = 1 / r0;
+        bool negative = false;
+        if (u0 > u1)
+        {
+            std::swap(u0, u1);
+            negative = true;
+        }
+
+        const Real kInverseB2 = 1 / (b * b);
+        auto integrand        = [kInverseB2](Real u) { return 1 / std::sqrt(std::fma(u * u, 2 * u - 1, kInverseB2)); };
+
+        // Steps below this no longer move u.
+        const Real kMinStep = u1 * Real(1e-6);
+
+        Real y   = 0;
+        Real y_c = 0;
+        Real u_c = 0;
+        Real h   = (u1 - u0) / 16;
+        while (u0 < u1)
+        {
+            h = std::min(h, u1 - u0);
+
+            const Real kK1 = integrand(u0);
+            const Real kK2 = integrand(u0 + h / 2);
+            const Real kK3 = integrand(u0 + h * Real(0.75));
+            const Real kK4 = integrand(u0 + h);
+
+            const Real kError = std::abs(-5 * kK1 + 6 * kK2 + 8 * kK3 - 9 * kK4) / 72 * h;
+            const Real kNext  = h * std::min(std::max(std::sqrt(tolerance / (2 * kError)), Real(0.3)), Real(2));
+            if (kError > tolerance && kNext > kMinStep)
+            {
+                h = kNext;
+                continue;
+            }
+
+            const Real kDy = (2 * kK1 + 3 * kK2 + 4 * kK3) / 9 * h - y_c;
+            const Real kY  = y + kDy;
+            y_c            = (kY - y) - kDy;
+            y              = kY;
+
+            const Real kDu = h - u_c;
+            const Real kU  = u0 + kDu;
+            u_c            = (kU - u0) - kDu;
+            u0             = kU;
+
+            h = kNext;
+        }
+
+        return negative ? -y : y;
+    }
+
+    // SweptAngle in float, promoted to double for impact parameters near the critical one.
+    inline double SweptAngleMixed(double r0, double r1, double b)
+    {
+        if (std::abs(b - kCriticalImpact) < kSinglePrecisionBand)
+            return SweptAngle<double>(r0, r1, b, 1e-9);
+        return SweptAngle<float>(float(r0), float(r1), float(b), kSinglePrecisionTolerance);
+    }
+
+    // The closest approach of a photon from r0 with impact parameter b >= kCriticalImpact, by bisection, as
+    // FindClosestApproach3 in trace.comp, including its offset off the turning point.
+    inline double ClosestApproach(double r0, double b)
+    {
+        double head = 3, tail = r0;
+        while ((tail - head) / 2 >= 1e-9)
+        {
+            const double kMid = (head + tail) / 2;
+            if ((head / std::sqrt(1 - 2 / head) - b) * (kMid / std::sqrt(1 - 2 / kMid) - b) > 0)
+                head = kMid;
+            else
+                tail = kMid;
+        }
+        return (head + tail) / 2 + 1e-3;
+    }
+
+    // The sweeps trace.comp looks up instead of integrating, for a ray from r0 with impact parameter b. Photons that
+    // fall in only use to_outer_edge and in_disk, and in_disk ends at the closest approach of those that turn around
+    // within the disk.
+    struct Deflection
+    {
+        double closest_approach;
+        double to_outer_edge;
+        double in_disk;
+        double to_infinity;
+    };
+
+    // The deflection table of trace.comp on the CPU: BuildDeflectionTable fills it and LookupDeflection interpolates
+    // it, entry for entry, in the same single precision. Two halves of size entries each, below and above
+    // kCriticalImpact, crowded towards it, where the sweeps change fastest.
+    class DeflectionTable
+    {
+    public:
+        // swept(r0, r1, b) is the integrator the shader runs, SweptAngleMixed for FP32_TRACE.
+        template <typename Swept>
+        DeflectionTable(double r0, double disk_inner, double disk_outer, int size, Swept swept)
+            : max_b_(r0 / std::sqrt(1 - 2 / r0)), size_(size), entries_(2 * size_t(size))
+        {
+            const double kEnd = 2000;
+            for (int index = 0; index < 2 * size; ++index)
+            {
+                const double kT = double(index % size) / (size - 1);
+                Entry& entry    = entries_[index];
+                if (index < size)
+                {
+                    const double kB = kCriticalImpact * (1 - (1 - kT) * (1 - kT));
+                    entry = {0, float(swept(r0, disk_outer, kB)), float(swept(disk_outer, disk_inner, kB)), 0};
+                    continue;
+                }
+
+                const double kB  = kCriticalImpact + (max_b_ - kCriticalImpact) * kT * kT;
+                const double kR3 = ClosestApproach(r0, kB);
+                if (kR3 > disk_outer)
+                {
+                    const double kDphi = swept(r0, kR3, kB);
+                    entry              = {float(kR3), float(kDphi), 0, float(kDphi - swept(kR3, kEnd, kB))};
+                }
+                else
+                {
+                    const double kDphi   = swept(r0, disk_outer, kB);
+                    const double kInDisk = swept(disk_outer, std::max(kR3, disk_inner), kB);
+                    entry = {float(kR3), float(kDphi), float(kInDisk),
+                        float(kDphi + 2 * kInDisk - swept(disk_outer, kEnd, kB))};
+                }
+            }
+        }
+
+        Deflection Lookup(double b) const
+        {
+            const int kBase = b < kCriticalImpact ? 0 : size_;
+            const double kX = Position(b) * (size_ - 1);
+            const int kX0   = std::min(int(kX), size_ - 2);
+            const double kF = std::min(kX - kX0, 1.0);
+
+            const Entry& a = entries_[kBase + kX0];
+            const Entry& c = entries_[kBase + kX0 + 1];
+            auto mix       = [&](int i) { return a[i] + (c[i] - a[i]) * kF; };
+            return {mix(0), mix(1), mix(2), mix(3)};
+        }
+
+    private:
+        using Entry = std::array<float, 4>;
+
+        // Where b sits along its half of the table, in [0, 1], as DeflectionPosition in trace.comp.
+        double Position(double b) const
+        {
+            if (b < kCriticalImpact)
+                return 1 - std::sqrt(std::max(1 - b / kCriticalImpact, 0.0));
+            return std::sqrt(std::clamp((b - kCriticalImpact) / (max_b_ - kCriticalImpact), 0.0, 1.0));
+        }
+
+        double max_b_;
+        int size_;
+        std::vector<Entry> entries_;
+    };
+}
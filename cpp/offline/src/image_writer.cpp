@@ -0,0 +1,973 @@
+#include "image_writer.h"
+
+#include <omp.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace dhh::image
+{
+    namespace
+    {
+        void PutBigEndian32(std::vector<uint8_t>& out, uint32_t value)
+        {
+            out.push_back(uint8_t(value >> 24));
+            out.push_back(uint8_t(value >> 16));
+            out.push_back(uint8_t(value >> 8));
+            out.push_back(uint8_t(value));
+        }
+
+        template <typename T>
+        void PutLittleEndian(std::vector<uint8_t>& out, T value)
+        {
+            uint8_t bytes[sizeof(T)];
+            std::memcpy(bytes, &value, sizeof(T));
+            out.insert(out.end(), bytes, bytes + sizeof(T));
+        }
+
+        void PutString(std::vector<uint8_t>& out, const char* text)
+        {
+            out.insert(out.end(), text, text + std::strlen(text) + 1);
+        }
+
+        uint8_t ToByte(float value)
+        {
+            return uint8_t(std::min(std::max(value, 0.f), 1.f) * 255.f + 0.5f);
+        }
+
+        // Reads row y as 8-bit RGB, converting from float if needed. Returns the source row when no conversion is
+        // necessary.
+        const uint8_t* BytesRow(const ImageView& image, int y, std::vector<uint8_t>& scratch)
+        {
+            if (!image.is_float)
+                return image.Row(y);
+            scratch.resize(size_t(image.width) * 3);
+            const float* row = reinterpret_cast<const float*>(image.Row(y));
+            for (size_t i = 0; i < scratch.size(); ++i)
+            {
+                scratch[i] = ToByte(row[i]);
+            }
+            return scratch.data();
+        }
+
+        const float* FloatRow(const ImageView& image, int y, std::vector<float>& scratch)
+        {
+            if (image.is_float)
+                return reinterpret_cast<const float*>(image.Row(y));
+            scratch.resize(size_t(image.width) * 3);
+            const uint8_t* row = image.Row(y);
+            for (size_t i = 0; i < scratch.size(); ++i)
+            {
+                scratch[i] = row[i] * (1.f / 255.f);
+            }
+            return scratch.data();
+        }
+
+        void PutPngChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t size)
+        {
+            PutBigEndian32(out, uint32_t(size));
+            const size_t kStart = out.size();
+            out.insert(out.end(), type, type + 4);
+            out.insert(out.end(), data, data + size);
+            PutBigEndian32(out, uint32_t(crc32(0, out.data() + kStart, uInt(out.size() - kStart))));
+        }
+
+        uint8_t Paeth(int a, int b, int c)
+        {
+            int p  = a + b - c;
+            int pa = std::abs(p - a);
+            int pb = std::abs(p - b);
+            int pc = std::abs(p - c);
+            if (pa <= pb && pa <= pc)
+                return uint8_t(a);
+            return uint8_t(pb <= pc ? b : c);
+        }
+
+        // Filters one row with each of the five PNG filters and keeps the one with the smallest sum of absolute
+        // differences, the heuristic recommended by the PNG specification.
+        void FilterRow(const uint8_t* row, const uint8_t* prior, size_t size, uint8_t* out, uint8_t* candidate)
+        {
+            const int kBpp   = 3;
+            uint64_t best    = UINT64_MAX;
+            const int kTypes = prior ? 5 : 2;
+            for (int type = 0; type < kTypes; ++type)
+            {
+                uint64_t sum = 0;
+                for (size_t i = 0; i < size; ++i)
+                {
+                    int a = i >= kBpp ? row[i - kBpp] : 0;
+                    int b = prior ? prior[i] : 0;
+                    int c = prior && i >= kBpp ? prior[i - kBpp] : 0;
+                    uint8_t predicted;
+                    switch (type)
+                    {
+                    case 0:
+                        predicted = 0;
+                        break;
+                    case 1:
+                        predicted = uint8_t(a);
+                        break;
+                    case 2:
+                        predicted = uint8_t(b);
+                        break;
+                    case 3:
+                        predicted = uint8_t((a + b) / 2);
+                        break;
+                    default:
+                        predicted = Paeth(a, b, c);
+                        break;
+                    }
+                    candidate[i] = uint8_t(row[i] - predicted);
+                    sum += std::abs(int8_t(candidate[i]));
+                }
+                if (sum < best)
+                {
+                    best   = sum;
+                    out[0] = uint8_t(type);
+                    std::memcpy(out + 1, candidate, size);
+                }
+            }
+        }
+
+        // Magic, version and attributes of an uncompressed RGB OpenEXR file, scanline or (tile_size > 0) tiled.
+        std::vector<uint8_t> ExrHeader(int width, int height, bool half, int tile_size)
+        {
+            // Version 2; bit 9 marks a single-part tiled file.
+            std::vector<uint8_t> out = {0x76, 0x2f, 0x31, 0x01, 2, uint8_t(tile_size > 0 ? 0x02 : 0), 0, 0};
+
+            // Channels are listed in alphabetical order, which is also their order inside each chunk.
+            std::vector<uint8_t> channels;
+            for (const char* name : {"B", "G", "R"})
+            {
+                PutString(channels, name);
+                PutLittleEndian<int32_t>(channels, half ? 1 : 2);
+                channels.insert(channels.end(), {0, 0, 0, 0});  // pLinear and reserved
+                PutLittleEndian<int32_t>(channels, 1);
+                PutLittleEndian<int32_t>(channels, 1);
+            }
+            channels.push_back(0);
+
+            auto attribute = [&](const char* name, const char* type, const std::vector<uint8_t>& value) {
+                PutString(out, name);
+                PutString(out, type);
+                PutLittleEndian<int32_t>(out, int32_t(value.size()));
+                out.insert(out.end(), value.begin(), value.end());
+            };
+
+            std::vector<uint8_t> window;
+            for (int32_t value : {0, 0, width - 1, height - 1})
+            {
+                PutLittleEndian(window, value);
+            }
+            std::vector<uint8_t> one, center;
+            PutLittleEndian(one, 1.f);
+            PutLittleEndian(center, 0.f);
+            PutLittleEndian(center, 0.f);
+
+            attribute("channels", "chlist", channels);
+            attribute("compression", "compression", {0});
+            attribute("dataWindow", "box2i", window);
+            attribute("displayWindow", "box2i", window);
+            attribute("lineOrder", "lineOrder", {0});
+            attribute("pixelAspectRatio", "float", one);
+            attribute("screenWindowCenter", "v2f", center);
+            attribute("screenWindowWidth", "float", one);
+            if (tile_size > 0)
+            {
+                // One level of square tiles.
+                std::vector<uint8_t> tiles;
+                PutLittleEndian<uint32_t>(tiles, uint32_t(tile_size));
+                PutLittleEndian<uint32_t>(tiles, uint32_t(tile_size));
+                tiles.push_back(0);
+                attribute("tiles", "tiledesc", tiles);
+            }
+            out.push_back(0);
+            return out;
+        }
+
+        // Stores one row of RGB floats as the planar B, G, R samples of an EXR chunk.
+        void PutExrRow(uint8_t* out, const float* row, int width, bool half)
+        {
+            for (int plane = 0; plane < 3; ++plane)
+            {
+                const int kComponent = 2 - plane;  // B, G, R
+                for (int x = 0; x < width; ++x)
+                {
+                    const float kValue = row[3 * x + kComponent];
+                    if (half)
+                    {
+                        const uint16_t kHalf = FloatToHalf(kValue);
+                        std::memcpy(out, &kHalf, 2);
+                        out += 2;
+                    }
+                    else
+                    {
+                        std::memcpy(out, &kValue, 4);
+                        out += 4;
+                    }
+                }
+            }
+        }
+
+        bool Seek(FILE* file, uint64_t offset)
+        {
+#ifdef _WIN32
+            return _fseeki64(file, int64_t(offset), SEEK_SET) == 0;
+#else
+            return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+        }
+
+        // Flushes file and waits until its data is on the disk, so a later journal entry or rename never gets
+        // there first.
+        bool Sync(FILE* file)
+        {
+            if (std::fflush(file) != 0)
+                return false;
+#ifdef _WIN32
+            return _commit(_fileno(file)) == 0;
+#else
+            return fsync(fileno(file)) == 0;
+#endif
+        }
+
+        // Replaces to with from in one step, so a reader sees either the old file or the new one.
+        bool Replace(const std::string& from, const std::string& to)
+        {
+#ifdef _WIN32
+            return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+            return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+        }
+
+        struct QoiPixel
+        {
+            uint8_t r, g, b, a;
+            bool operator==(const QoiPixel& o) const { return r == o.r && g == o.g && b == o.b && a == o.a; }
+        };
+    }
+
+    Format FormatFromPath(const std::string& path)
+    {
+        const std::string::size_type kDot = path.find_last_of('.');
+        std::string ext                   = kDot == std::string::npos ? "" : path.substr(kDot + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+
+        if (ext == "png")
+            return kPng;
+        if (ext == "qoi")
+            return kQoi;
+        if (ext == "ppm")
+            return kPpm;
+        if (ext == "pfm")
+            return kPfm;
+        if (ext == "exr")
+            return kExr;
+        throw std::runtime_error("unsupported image format: " + path);
+    }
+
+    uint16_t FloatToHalf(float value)
+    {
+        uint32_t x;
+        std::memcpy(&x, &value, sizeof(x));
+        const uint16_t kSign = uint16_t((x >> 16) & 0x8000);
+        x &= 0x7fffffff;
+
+        // NaN, and everything that rounds to or beyond the half range.
+        if (x > 0x7f800000)
+            return kSign | 0x7e00;
+        if (x >= 0x477ff000)
+            return kSign | 0x7c00;
+
+        // Too small even for a subnormal half.
+        if (x < 0x33000000)
+            return kSign;
+
+        uint32_t half, remainder, halfway;
+        if (x < 0x38800000)
+        {
+            // Subnormal: shift the mantissa, implicit one included, down to units of 2^-24.
+            const uint32_t kMantissa = (x & 0x7fffff) | 0x800000;
+            const int kShift         = 126 - int(x >> 23);
+            half                     = kMantissa >> kShift;
+            remainder                = kMantissa & ((1u << kShift) - 1);
+            halfway                  = 1u << (kShift - 1);
+        }
+        else
+        {
+            half      = (((x >> 23) - 112) << 10) | ((x >> 13) & 0x3ff);
+            remainder = x & 0x1fff;
+            halfway   = 0x1000;
+        }
+
+        // Round to nearest even; a carry into the exponent is still correct.
+        if (remainder > halfway || (remainder == halfway && (half & 1)))
+            ++half;
+        return kSign | uint16_t(half);
+    }
+
+    float HalfToFloat(uint16_t value)
+    {
+        const uint32_t kSign = uint32_t(value & 0x8000) << 16;
+        uint32_t exponent    = (value >> 10) & 0x1f;
+        uint32_t mantissa    = value & 0x3ff;
+
+        uint32_t bits;
+        if (exponent == 0x1f)
+        {
+            bits = kSign | 0x7f800000 | (mantissa << 13);
+        }
+        else if (exponent != 0)
+        {
+            bits = kSign | ((exponent + 112) << 23) | (mantissa << 13);
+        }
+        else if (mantissa == 0)
+        {
+            bits = kSign;
+        }
+        else
+        {
+            // Subnormal: normalise the mantissa.
+            exponent = 113;
+            while (!(mantissa & 0x400))
+            {
+                mantissa <<= 1;
+                --exponent;
+            }
+            bits = kSign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+
+        float result;
+        std::memcpy(&result, &bits, sizeof(result));
+        return result;
+    }
+
+    std::vector<uint8_t> EncodePng(const ImageView& image, int level)
+    {
+        const size_t kRowSize = size_t(image.width) * 3;
+        const size_t kRawRow  = kRowSize + 1;
+        level                 = std::min(std::max(level, 0), 9);
+
+        // Filtering only reads unfiltered rows, so every row is independent.
+        std::vector<uint8_t> raw(kRawRow * image.height);
+#pragma omp parallel
+        {
+            std::vector<uint8_t> scratch, prior_scratch, candidate(kRowSize);
+#pragma omp for schedule(static)
+            for (int y = 0; y < image.height; ++y)
+            {
+                const uint8_t* row   = BytesRow(image, y, scratch);
+                const uint8_t* prior = y > 0 ? BytesRow(image, y - 1, prior_scratch) : nullptr;
+                if (level == 0)
+                {
+                    raw[y * kRawRow] = 0;
+                    std::memcpy(&raw[y * kRawRow + 1], row, kRowSize);
+                }
+                else
+                {
+                    FilterRow(row, prior, kRowSize, &raw[y * kRawRow], candidate.data());
+                }
+            }
+        }
+
+        // Each strip becomes a raw deflate stream ending on a byte boundary (a sync flush), the last one with the
+        // final block. Priming each strip with the 32 KiB before it keeps the ratio close to a single-threaded
+        // encoder.
+        const int kStrips = std::max(1, std::min(4 * omp_get_max_threads(), image.height / 16));
+        std::vector<std::vector<uint8_t>> deflated(kStrips);
+        std::vector<uLong> adlers(kStrips);
+        std::vector<size_t> lengths(kStrips);
+        std::atomic<bool> failed(false);
+
+#pragma omp parallel for schedule(dynamic)
+        for (int strip = 0; strip < kStrips; ++strip)
+        {
+            const size_t kBegin = kRawRow * (size_t(image.height) * strip / kStrips);
+            const size_t kEnd   = kRawRow * (size_t(image.height) * (strip + 1) / kStrips);
+            const bool kLast    = strip == kStrips - 1;
+
+            z_stream zs = {};
+            if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            {
+                failed = true;
+                continue;
+            }
+            if (kBegin > 0)
+            {
+                const size_t kDictionary = std::min<size_t>(kBegin, 32768);
+                deflateSetDictionary(&zs, &raw[kBegin - kDictionary], uInt(kDictionary));
+            }
+
+            std::vector<uint8_t>& out = deflated[strip];
+            out.resize(deflateBound(&zs, uLong(kEnd - kBegin)) + 16);
+            zs.next_in   = &raw[kBegin];
+            zs.avail_in  = uInt(kEnd - kBegin);
+            zs.next_out  = out.data();
+            zs.avail_out = uInt(out.size());
+            const int kResult = deflate(&zs, kLast ? Z_FINISH : Z_SYNC_FLUSH);
+            if (kResult != (kLast ? Z_STREAM_END : Z_OK) || zs.avail_in != 0)
+                failed = true;
+            out.resize(out.size() - zs.avail_out);
+            deflateEnd(&zs);
+
+            adlers[strip]  = adler32(adler32(0, nullptr, 0), &raw[kBegin], uInt(kEnd - kBegin));
+            lengths[strip] = kEnd - kBegin;
+        }
+        if (failed)
+            throw std::runtime_error("png deflate failed");
+
+        // zlib header, deflate data and the combined Adler-32 of the whole filtered image.
+        std::vector<uint8_t> idat = {0x78, 0x01};
+        uLong adler               = adler32(0, nullptr, 0);
+        for (int strip = 0; strip < kStrips; ++strip)
+        {
+            idat.insert(idat.end(), deflated[strip].begin(), deflated[strip].end());
+            adler = adler32_combine(adler, adlers[strip], z_off_t(lengths[strip]));
+        }
+        PutBigEndian32(idat, uint32_t(adler));
+
+        std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        std::vector<uint8_t> header;
+        PutBigEndian32(header, uint32_t(image.width));
+        PutBigEndian32(header, uint32_t(image.height));
+        // 8 bits per channel, truecolour, deflate, adaptive filtering, no interlace.
+        header.insert(header.end(), {8, 2, 0, 0, 0});
+
+        PutPngChunk(png, "IHDR", header.data(), header.size());
+        PutPngChunk(png, "IDAT", idat.data(), idat.size());
+        PutPngChunk(png, "IEND", nullptr, 0);
+        return png;
+    }
+
+    std::vector<uint8_t> EncodeQoi(const ImageView& image)
+    {
+        std::vector<uint8_t> out = {'q', 'o', 'i', 'f'};
+        PutBigEndian32(out, uint32_t(image.width));
+        PutBigEndian32(out, uint32_t(image.height));
+        out.push_back(3);  // RGB
+        out.push_back(0);  // sRGB with linear alpha
+        out.reserve(out.size() + size_t(image.width) * image.height * 4 / 3);
+
+        QoiPixel index[64] = {};
+        QoiPixel previous  = {0, 0, 0, 255};
+        int run            = 0;
+
+        std::vector<uint8_t> scratch;
+        for (int y = 0; y < image.height; ++y)
+        {
+            const uint8_t* row = BytesRow(image, y, scratch);
+            for (int x = 0; x < image.width; ++x)
+            {
+                const QoiPixel kPixel = {row[3 * x], row[3 * x + 1], row[3 * x + 2], 255};
+                const bool kLast      = y == image.height - 1 && x == image.width - 1;
+
+                if (kPixel == previous)
+                {
+                    if (++run == 62 || kLast)
+                    {
+                        out.push_back(uint8_t(0xc0 | (run - 1)));
+                        run = 0;
+                    }
+                    continue;
+                }
+                if (run > 0)
+                {
+                    out.push_back(uint8_t(0xc0 | (run - 1)));
+                    run = 0;
+                }
+
+                const int kHash = (kPixel.r * 3 + kPixel.g * 5 + kPixel.b * 7 + kPixel.a * 11) % 64;
+                if (index[kHash] == kPixel)
+                {
+                    out.push_back(uint8_t(kHash));
+                }
+                else
+                {
+                    index[kHash] = kPixel;
+
+                    const int kDr   = int8_t(kPixel.r - previous.r);
+                    const int kDg   = int8_t(kPixel.g - previous.g);
+                    const int kDb   = int8_t(kPixel.b - previous.b);
+                    const int kDrDg = kDr - kDg;
+                    const int kDbDg = kDb - kDg;
+
+                    if (kDr >= -2 && kDr <= 1 && kDg >= -2 && kDg <= 1 && kDb >= -2 && kDb <= 1)
+                    {
+                        out.push_back(uint8_t(0x40 | (kDr + 2) << 4 | (kDg + 2) << 2 | (kDb + 2)));
+                    }
+                    else if (kDg >= -32 && kDg <= 31 && kDrDg >= -8 && kDrDg <= 7 && kDbDg >= -8 && kDbDg <= 7)
+                    {
+                        out.push_back(uint8_t(0x80 | (kDg + 32)));
+                        out.push_back(uint8_t((kDrDg + 8) << 4 | (kDbDg + 8)));
+                    }
+                    else
+                    {
+                        out.insert(out.end(), {0xfe, kPixel.r, kPixel.g, kPixel.b});
+                    }
+                }
+                previous = kPixel;
+            }
+        }
+
+        out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+        return out;
+    }
+
+    std::vector<uint8_t> EncodePpm(const ImageView& image)
+    {
+        char header[64];
+        const int kHeaderSize = std::snprintf(header, sizeof(header), "P6\n%d %d\n255\n", image.width, image.height);
+        const size_t kRowSize = size_t(image.width) * 3;
+
+        std::vector<uint8_t> out(kHeaderSize + kRowSize * image.height);
+        std::memcpy(out.data(), header, kHeaderSize);
+#pragma omp parallel
+        {
+            std::vector<uint8_t> scratch;
+#pragma omp for schedule(static)
+            for (int y = 0; y < image.height; ++y)
+            {
+                std::memcpy(&out[kHeaderSize + y * kRowSize], BytesRow(image, y, scratch), kRowSize);
+            }
+        }
+        return out;
+    }
+
+    std::vector<uint8_t> EncodePfm(const ImageView& image)
+    {
+        // A negative scale marks little-endian data. Rows are stored bottom to top.
+        char header[64];
+        const int kHeaderSize = std::snprintf(header, sizeof(header), "PF\n%d %d\n-1.0\n", image.width, image.height);
+        const size_t kRowSize = size_t(image.width) * 3 * sizeof(float);
+
+        std::vector<uint8_t> out(kHeaderSize + kRowSize * image.height);
+        std::memcpy(out.data(), header, kHeaderSize);
+#pragma omp parallel
+        {
+            std::vector<float> scratch;
+#pragma omp for schedule(static)
+            for (int y = 0; y < image.height; ++y)
+            {
+                std::memcpy(
+                    &out[kHeaderSize + (image.height - 1 - y) * kRowSize], FloatRow(image, y, scratch), kRowSize);
+            }
+        }
+        return out;
+    }
+
+    std::vector<uint8_t> EncodeExr(const ImageView& image, bool half)
+    {
+        std::vector<uint8_t> out = ExrHeader(image.width, image.height, half, 0);
+
+        // Offset table, then one chunk per scanline: y, byte count and the planar B, G, R samples.
+        const size_t kLineBytes = size_t(image.width) * 3 * (half ? 2 : 4);
+        const size_t kChunk     = 8 + kLineBytes;
+        const size_t kFirst     = out.size() + size_t(image.height) * 8;
+        for (int y = 0; y < image.height; ++y)
+        {
+            PutLittleEndian<uint64_t>(out, kFirst + y * kChunk);
+        }
+        out.resize(kFirst + image.height * kChunk);
+
+#pragma omp parallel
+        {
+            std::vector<float> scratch;
+#pragma omp for schedule(static)
+            for (int y = 0; y < image.height; ++y)
+            {
+                uint8_t* chunk      = &out[kFirst + y * kChunk];
+                const int32_t kLine = y;
+                const int32_t kSize = int32_t(kLineBytes);
+                std::memcpy(chunk, &kLine, 4);
+                std::memcpy(chunk + 4, &kSize, 4);
+                PutExrRow(chunk + 8, FloatRow(image, y, scratch), image.width, half);
+            }
+        }
+        return out;
+    }
+
+    std::vector<uint8_t> Encode(const ImageView& image, Format format, const WriteOptions& options)
+    {
+        switch (format)
+        {
+        case kPng:
+            return EncodePng(image, options.png_level);
+        case kQoi:
+            return EncodeQoi(image);
+        case kPpm:
+            return EncodePpm(image);
+        case kPfm:
+            return EncodePfm(image);
+        case kExr:
+            return EncodeExr(image, options.exr_half);
+        default:
+            throw std::runtime_error("unknown image format");
+        }
+    }
+
+    void WriteFile(const std::string& path, const void* data, size_t size)
+    {
+        const std::string kPartial = path + ".part";
+
+        FILE* file = std::fopen(kPartial.c_str(), "wb");
+        if (!file)
+            throw std::runtime_error("cannot open " + kPartial);
+        const bool kWritten = std::fwrite(data, 1, size, file) == size && Sync(file);
+        if (std::fclose(file) != 0 || !kWritten)
+            throw std::runtime_error("cannot write " + kPartial);
+
+        if (!Replace(kPartial, path))
+            throw std::runtime_error("cannot rename " + kPartial + " to " + path);
+    }
+
+    void WriteImage(const std::string& path, const ImageView& image, const WriteOptions& options)
+    {
+        const std::vector<uint8_t> kData = Encode(image, FormatFromPath(path), options);
+        WriteFile(path, kData.data(), kData.size());
+    }
+
+    std::vector<float> ReadExr(const std::string& path, int& width, int& height)
+    {
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file)
+            throw std::runtime_error("cannot open " + path);
+        std::vector<uint8_t> data;
+        uint8_t buffer[1 << 16];
+        for (size_t read; (read = std::fread(buffer, 1, sizeof(buffer), file)) > 0;)
+        {
+            data.insert(data.end(), buffer, buffer + read);
+        }
+        std::fclose(file);
+
+        const uint8_t kMagic[] = {0x76, 0x2f, 0x31, 0x01};
+        if (data.size() < 8 || std::memcmp(data.data(), kMagic, 4) != 0 || (data[5] & 0x02))
+            throw std::runtime_error(path + " is not a scanline EXR");
+
+        size_t pos = 8;
+        auto need  = [&](size_t size) {
+            if (pos + size > data.size())
+                throw std::runtime_error(path + " is truncated");
+        };
+        auto text = [&]() {
+            const size_t kStart = pos;
+            for (need(1); data[pos] != 0; need(1))
+            {
+                ++pos;
+            }
+            return std::string(reinterpret_cast<const char*>(&data[kStart]), pos++ - kStart);
+        };
+
+        int32_t window[4] = {0, 0, -1, -1};
+        std::vector<std::string> channels;
+        int32_t pixel_type = -1;
+        for (std::string name = text(); !name.empty(); name = text())
+        {
+            const std::string kType = text();
+            int32_t size;
+            need(4);
+            std::memcpy(&size, &data[pos], 4);
+            pos += 4;
+            need(size);
+            const uint8_t* value = &data[pos];
+
+            if (name == "channels")
+            {
+                for (size_t at = 0; value[at] != 0;)
+                {
+                    const char* kName = reinterpret_cast<const char*>(value + at);
+                    at += std::strlen(kName) + 1;
+                    int32_t type;
+                    std::memcpy(&type, value + at, 4);
+                    if (pixel_type >= 0 && type != pixel_type)
+                        throw std::runtime_error(path + " mixes channel types");
+                    pixel_type = type;
+                    channels.push_back(kName);
+                    at += 16;
+                }
+            }
+            else if (name == "compression" && value[0] != 0)
+            {
+                throw std::runtime_error(path + " is compressed");
+            }
+            else if (name == "dataWindow")
+            {
+                std::memcpy(window, value, sizeof(window));
+            }
+            pos += size;
+        }
+
+        const std::vector<std::string> kExpected = {"B", "G", "R"};
+        if (channels != kExpected || (pixel_type != 1 && pixel_type != 2))
+            throw std::runtime_error(path + " is not a half or float RGB image");
+
+        width                  = window[2] - window[0] + 1;
+        height                 = window[3] - window[1] + 1;
+        const size_t kTypeSize = pixel_type == 1 ? 2 : 4;
+        std::vector<float> rgb(size_t(width) * height * 3);
+
+        need(size_t(height) * 8);
+        for (int y = 0; y < height; ++y)
+        {
+            uint64_t offset;
+            std::memcpy(&offset, &data[pos + y * 8], 8);
+            if (offset + 8 + size_t(width) * 3 * kTypeSize > data.size())
+                throw std::runtime_error(path + " is truncated");
+
+            int32_t line;
+            std::memcpy(&line, &data[offset], 4);
+            if (line < window[1] || line > window[3])
+                throw std::runtime_error(path + " has a scanline out of range");
+            const uint8_t* samples = &data[offset + 8];
+            float* row             = &rgb[size_t(line - window[1]) * width * 3];
+
+            for (int plane = 0; plane < 3; ++plane)
+            {
+                const int kComponent = 2 - plane;  // B, G, R
+                for (int x = 0; x < width; ++x)
+                {
+                    if (kTypeSize == 2)
+                    {
+                        uint16_t half;
+                        std::memcpy(&half, samples, 2);
+                        row[3 * x + kComponent] = HalfToFloat(half);
+                    }
+                    else
+                    {
+                        std::memcpy(&row[3 * x + kComponent], samples, 4);
+                    }
+                    samples += kTypeSize;
+                }
+            }
+        }
+        return rgb;
+    }
+
+    AsyncImageWriter::AsyncImageWriter(size_t depth, const WriteOptions& options)
+        : options_(options), queue_(std::max<size_t>(depth, 1))
+    {
+        thread_ = std::thread(&AsyncImageWriter::Run, this);
+    }
+
+    void AsyncImageWriter::Write(const std::string& path, const ImageView& image)
+    {
+        Job* job = queue_.AcquireWrite();
+        if (!job)
+        {
+            RethrowError();
+            throw std::runtime_error("image writer is closed");
+        }
+
+        // Reuses the slot's buffer once it has grown to the image size.
+        const size_t kRowBytes = image.RowBytes();
+        job->pixels.resize(kRowBytes * image.height);
+        for (int y = 0; y < image.height; ++y)
+        {
+            std::memcpy(&job->pixels[y * kRowBytes], image.Row(y), kRowBytes);
+        }
+        job->path = path;
+        job->view = {job->pixels.data(), image.width, image.height, kRowBytes, image.is_float};
+        queue_.CommitWrite();
+    }
+
+    void AsyncImageWriter::Run()
+    {
+        try
+        {
+            while (Job* job = queue_.AcquireRead())
+            {
+                WriteImage(job->path, job->view, options_);
+                queue_.ReleaseRead();
+            }
+        }
+        catch (...)
+        {
+            // Stored before the queue is closed, so Write() and Wait() see it once they see the queue closed.
+            error_ = std::current_exception();
+            queue_.Close();
+        }
+    }
+
+    void AsyncImageWriter::RethrowError()
+    {
+        if (queue_.Closed() && error_)
+            std::rethrow_exception(error_);
+    }
+
+    void AsyncImageWriter::Wait()
+    {
+        queue_.WaitEmpty();
+        RethrowError();
+    }
+
+    AsyncImageWriter::~AsyncImageWriter()
+    {
+        // Pending images are still written before the thread exits.
+        queue_.Close();
+        if (thread_.joinable())
+            thread_.join();
+        if (error_)
+        {
+            try
+            {
+                std::rethrow_exception(error_);
+            }
+            catch (std::exception& e)
+            {
+                std::cerr << "image writer: " << e.what() << std::endl;
+            }
+        }
+    }
+
+    TiledExrWriter::TiledExrWriter(const std::string& path, int width, int height, int tile_size, bool half)
+        : path_(path), journal_path_(path + ".tiles"), width_(width), height_(height), tile_size_(tile_size),
+          half_(half), tiles_x_((width + tile_size - 1) / tile_size), tiles_y_((height + tile_size - 1) / tile_size),
+          file_(nullptr), journal_(nullptr)
+    {
+        const int kTiles = tiles_x_ * tiles_y_;
+
+        // Header and offset table. Uncompressed tiles have a known size, so the whole layout is fixed up front.
+        std::vector<uint8_t> head = ExrHeader(width, height, half, tile_size);
+        offsets_.resize(kTiles);
+        uint64_t offset = head.size() + uint64_t(kTiles) * 8;
+        for (int tile = 0; tile < kTiles; ++tile)
+        {
+            const int kTileWidth  = std::min(tile_size, width - (tile % tiles_x_) * tile_size);
+            const int kTileHeight = std::min(tile_size, height - (tile / tiles_x_) * tile_size);
+            offsets_[tile]        = offset;
+            offset += 20 + uint64_t(kTileWidth) * kTileHeight * 3 * (half ? 2 : 4);
+            PutLittleEndian<uint64_t>(head, offsets_[tile]);
+        }
+        done_.assign(kTiles, false);
+
+        // Resume when a journal exists and the file was started with the same geometry.
+        journal_ = std::fopen(journal_path_.c_str(), "rb");
+        if (journal_)
+        {
+            file_ = std::fopen(path.c_str(), "r+b");
+            std::vector<uint8_t> existing(head.size());
+            if (file_ && std::fread(existing.data(), 1, existing.size(), file_) == existing.size() && existing == head)
+            {
+                int32_t tile;
+                while (std::fread(&tile, sizeof(tile), 1, journal_) == 1)
+                {
+                    if (tile >= 0 && tile < kTiles)
+                        done_[tile] = true;
+                }
+            }
+            else if (file_)
+            {
+                std::fclose(file_);
+                file_ = nullptr;
+            }
+            std::fclose(journal_);
+            journal_ = nullptr;
+        }
+
+        if (file_)
+        {
+            journal_ = std::fopen(journal_path_.c_str(), "ab");
+        }
+        else
+        {
+            file_    = std::fopen(path.c_str(), "w+b");
+            journal_ = std::fopen(journal_path_.c_str(), "wb");
+            if (file_ && std::fwrite(head.data(), 1, head.size(), file_) != head.size())
+                throw std::runtime_error("cannot write " + path);
+        }
+        if (!file_ || !journal_)
+            throw std::runtime_error("cannot open " + path);
+    }
+
+    std::vector<int> TiledExrWriter::PendingTiles() const
+    {
+        std::vector<int> pending;
+        for (int tile = 0; tile < int(done_.size()); ++tile)
+        {
+            if (!done_[tile])
+                pending.push_back(tile);
+        }
+        return pending;
+    }
+
+    void TiledExrWriter::WriteTile(int tile_x, int tile_y, const float* pixels, size_t stride)
+    {
+        const int kTile       = tile_y * tiles_x_ + tile_x;
+        const int kTileWidth  = std::min(tile_size_, width_ - tile_x * tile_size_);
+        const int kTileHeight = std::min(tile_size_, height_ - tile_y * tile_size_);
+        const size_t kRowSize = size_t(kTileWidth) * 3 * (half_ ? 2 : 4);
+
+        // Tile coordinates, level (0, 0), byte count, then each scanline as planar B, G, R.
+        std::vector<uint8_t> chunk;
+        chunk.reserve(20 + kRowSize * kTileHeight);
+        for (int32_t value : {tile_x, tile_y, 0, 0, int32_t(kRowSize * kTileHeight)})
+        {
+            PutLittleEndian(chunk, value);
+        }
+        chunk.resize(20 + kRowSize * kTileHeight);
+        for (int y = 0; y < kTileHeight; ++y)
+        {
+            const float* row = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(pixels) + y * stride);
+            PutExrRow(&chunk[20 + y * kRowSize], row, kTileWidth, half_);
+        }
+
+        // The journal entry follows the tile data, so a recorded tile is always complete.
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!Seek(file_, offsets_[kTile]) || std::fwrite(chunk.data(), 1, chunk.size(), file_) != chunk.size()
+            || !Sync(file_))
+        {
+            throw std::runtime_error("cannot write tile to " + path_);
+        }
+        const int32_t kEntry = kTile;
+        if (std::fwrite(&kEntry, sizeof(kEntry), 1, journal_) != 1 || !Sync(journal_))
+            throw std::runtime_error("cannot write journal of " + path_);
+        done_[kTile] = true;
+    }
+
+    void TiledExrWriter::Finish()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (bool done : done_)
+        {
+            if (!done)
+                throw std::runtime_error("tiles missing in " + path_);
+        }
+
+        const bool kClosed = std::fclose(file_) == 0;
+        file_              = nullptr;
+        std::fclose(journal_);
+        journal_ = nullptr;
+        if (!kClosed)
+            throw std::runtime_error("cannot write " + path_);
+        std::remove(journal_path_.c_str());
+    }
+
+    TiledExrWriter::~TiledExrWriter()
+    {
+        // An unfinished file keeps its journal, so the next run resumes it.
+        if (file_)
+            std::fclose(file_);
+        if (journal_)
+            std::fclose(journal_);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "frame_queue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dhh::image
+{
+    enum Format
+    {
+        kPng,
+        kQoi,
+        kPpm,
+        kPfm,
+        kExr
+    };
+
+    // An RGB image owned by the caller, either 8 bits or one float per channel. stride is the distance between rows
+    // in bytes, 0 for tightly packed rows.
+    struct ImageView
+    {
+        const void* pixels;
+        int width;
+        int height;
+        size_t stride;
+        bool is_float;
+
+        size_t RowBytes() const { return size_t(width) * 3 * (is_float ? sizeof(float) : 1); }
+        size_t Stride() const { return stride ? stride : RowBytes(); }
+        const uint8_t* Row(int y) const { return static_cast<const uint8_t*>(pixels) + y * Stride(); }
+    };
+
+    struct WriteOptions
+    {
+        // zlib level of the PNG encoder, 0 (stored) to 9. Low levels are several times faster at a modest size cost.
+        int png_level = 3;
+
+        // EXR channels as half floats instead of full floats.
+        bool exr_half = true;
+    };
+
+    // Picks the format from the extension: .png, .qoi, .ppm, .pfm or .exr.
+    Format FormatFromPath(const std::string& path);
+
+    uint16_t FloatToHalf(float value);
+    float HalfToFloat(uint16_t value);
+
+    // PNG whose image data is deflated in independent strips on all OpenMP threads and stitched into one zlib stream.
+    std::vector<uint8_t> EncodePng(const ImageView& image, int level);
+    std::vector<uint8_t> EncodeQoi(const ImageView& image);
+    std::vector<uint8_t> EncodePpm(const ImageView& image);
+    std::vector<uint8_t> EncodePfm(const ImageView& image);
+
+    // Uncompressed scanline OpenEXR with R, G and B channels.
+    std::vector<uint8_t> EncodeExr(const ImageView& image, bool half);
+
+    std::vector<uint8_t> Encode(const ImageView& image, Format format, const WriteOptions& options);
+
+    // Writes size bytes of data to a temporary file and renames it over path once they are on the disk, so path holds
+    // either what it held before or all of data, whenever the process stops.
+    void WriteFile(const std::string& path, const void* data, size_t size);
+
+    // Writes to a temporary file that is renamed over path once complete, so path never holds a partial image.
+    void WriteImage(const std::string& path, const ImageView& image, const WriteOptions& options = WriteOptions());
+
+    // Reads back an uncompressed scanline EXR as written by EncodeExr, into tightly packed RGB floats.
+    std::vector<float> ReadExr(const std::string& path, int& width, int& height);
+
+    // Writes images on a background thread. Write() copies the pixels into one of depth reusable buffers and returns
+    // at once, so encoding and disk I/O overlap with rendering the next frame or tile; it only blocks when depth
+    // images are still pending.
+    class AsyncImageWriter
+    {
+    public:
+        explicit AsyncImageWriter(size_t depth = 2, const WriteOptions& options = WriteOptions());
+
+        AsyncImageWriter(const AsyncImageWriter&) = delete;
+        AsyncImageWriter& operator=(const AsyncImageWriter&) = delete;
+
+        void Write(const std::string& path, const ImageView& image);
+
+        // Blocks until every pending image is on disk. Rethrows the first write error.
+        void Wait();
+
+        ~AsyncImageWriter();
+
+    private:
+        struct Job
+        {
+            std::string path;
+            std::vector<uint8_t> pixels;
+            ImageView view;
+        };
+
+        void Run();
+        void RethrowError();
+
+        const WriteOptions options_;
+        movie::FrameQueue<Job> queue_;
+        std::thread thread_;
+        std::exception_ptr error_;
+    };
+
+    // Writes a tiled, uncompressed OpenEXR image one tile at a time, so a render never has to hold more than its
+    // active tiles. Every tile has a fixed place in the file, which allows tiles to be written in any order from
+    // any thread. Finished tiles are recorded in a journal next to the file; opening the same path with the same
+    // geometry again continues where an interrupted run stopped.
+    class TiledExrWriter
+    {
+    public:
+        TiledExrWriter(const std::string& path, int width, int height, int tile_size, bool half = true);
+
+        TiledExrWriter(const TiledExrWriter&) = delete;
+        TiledExrWriter& operator=(const TiledExrWriter&) = delete;
+
+        int TilesX() const { return tiles_x_; }
+        int TilesY() const { return tiles_y_; }
+        int TileSize() const { return tile_size_; }
+
+        // Indices (tile_y * TilesX() + tile_x) of the tiles not on disk yet.
+        std::vector<int> PendingTiles() const;
+
+        // Stores a tile of RGB floats, rows stride bytes apart. Tiles on the right and bottom edge are clipped to the
+        // image. Safe to call from several threads.
+        void WriteTile(int tile_x, int tile_y, const float* pixels, size_t stride);
+
+        // Closes the file once every tile is written and removes the journal.
+        void Finish();
+
+        ~TiledExrWriter();
+
+    private:
+        const std::string path_;
+        const std::string journal_path_;
+        const int width_, height_, tile_size_;
+        const bool half_;
+        const int tiles_x_, tiles_y_;
+
+        std::vector<uint64_t> offsets_;
+        std::vector<bool> done_;
+        FILE* file_;
+        FILE* journal_;
+        std::mutex mutex_;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include "jpeg_reader.h"
+
+#include <csetjmp>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+#include <jpeglib.h>
+
+namespace dhh::image
+{
+    namespace
+    {
+        // libjpeg reports errors through error_exit, which must not return: it jumps back to the setjmp of the call
+        // that failed, which then throws. No object with a destructor lives between the two.
+        struct ErrorManager
+        {
+            jpeg_error_mgr pub;
+            std::jmp_buf jump;
+            char message[JMSG_LENGTH_MAX];
+        };
+
+        void ErrorExit(j_common_ptr info)
+        {
+            ErrorManager* error = reinterpret_cast<ErrorManager*>(info->err);
+            (*info->err->format_message)(info, error->message);
+            std::longjmp(error->jump, 1);
+        }
+    }
+
+    struct JpegStripReader::State
+    {
+        std::string path;
+        FILE* file = nullptr;
+        jpeg_decompress_struct info;
+        ErrorManager error;
+        bool created = false;
+
+        // One RGB scanline, swapped into BGR on the way out.
+        std::vector<uint8_t> row;
+
+        ~State()
+        {
+            if (created)
+                jpeg_destroy_decompress(&info);
+            if (file)
+                std::fclose(file);
+        }
+    };
+
+    JpegStripReader::JpegStripReader(const std::string& path) : state_(new State)
+    {
+        state_->path = path;
+        state_->file = std::fopen(path.c_str(), "rb");
+        if (!state_->file)
+            throw std::runtime_error("cannot open " + path);
+
+        jpeg_decompress_struct& info = state_->info;
+        info.err                     = jpeg_std_error(&state_->error.pub);
+        state_->error.pub.error_exit = ErrorExit;
+        state_->error.message[0]     = '\0';
+        if (setjmp(state_->error.jump))
+            Fail();
+
+        jpeg_create_decompress(&info);
+        state_->created = true;
+        jpeg_stdio_src(&info, state_->file);
+        jpeg_read_header(&info, TRUE);
+        info.out_color_space = JCS_RGB;
+        jpeg_start_decompress(&info);
+
+        state_->row.resize(size_t(info.output_width) * 3);
+    }
+
+    JpegStripReader::~JpegStripReader() = default;
+
+    int JpegStripReader::Width() const
+    {
+        return int(state_->info.output_width);
+    }
+
+    int JpegStripReader::Height() const
+    {
+        return int(state_->info.output_height);
+    }
+
+    int JpegStripReader::ReadRows(uint8_t* bgr, int rows, size_t stride)
+    {
+        jpeg_decompress_struct& info = state_->info;
+        if (setjmp(state_->error.jump))
+            Fail();
+
+        int read = 0;
+        while (read < rows && info.output_scanline < info.output_height)
+        {
+            JSAMPROW row = state_->row.data();
+            jpeg_read_scanlines(&info, &row, 1);
+
+            uint8_t* out = bgr + read * stride;
+            for (JDIMENSION x = 0; x < info.output_width; ++x)
+            {
+                out[x * 3 + 0] = row[x * 3 + 2];
+                out[x * 3 + 1] = row[x * 3 + 1];
+                out[x * 3 + 2] = row[x * 3 + 0];
+            }
+            ++read;
+        }
+        return read;
+    }
+
+    void JpegStripReader::Fail() const
+    {
+        throw std::runtime_error("cannot decode " + state_->path + ": " + state_->error.message);
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace dhh::image
+{
+    // Decodes a JPEG a few rows at a time, as BGR8 rows like cv::imread, so an image larger than memory can be
+    // converted strip by strip. Baseline files decode in a few rows of memory; progressive ones keep their
+    // coefficients, which libjpeg needs for every pass.
+    class JpegStripReader
+    {
+    public:
+        explicit JpegStripReader(const std::string& path);
+        ~JpegStripReader();
+
+        JpegStripReader(const JpegStripReader&) = delete;
+        JpegStripReader& operator=(const JpegStripReader&) = delete;
+
+        int Width() const;
+        int Height() const;
+
+        // Decodes up to rows further rows into bgr, stride bytes apart. Returns how many were decoded, 0 once the
+        // image is done.
+        int ReadRows(uint8_t* bgr, int rows, size_t stride);
+
+    private:
+        struct State;
+
+        [[noreturn]] void Fail() const;
+
+        std::unique_ptr<State> state_;
+    };
+}
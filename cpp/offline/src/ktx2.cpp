@@ -0,0 +1,193 @@
+#include "ktx2.h"
+
+#include <zlib.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+
+namespace dhh::texture
+{
+    namespace
+    {
+        constexpr uint8_t kIdentifier[12] = {0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n'};
+
+        // Identifier, nine 32-bit header fields and the index of the data format descriptor, key/value and
+        // supercompression data.
+        constexpr size_t kLevelIndexOffset = 12 + 9 * 4 + 4 * 4 + 2 * 8;
+
+        // VkFormat values understood by LoadKtx2Cubemap.
+        constexpr uint32_t kVkBc1RgbUnorm    = 131;
+        constexpr uint32_t kVkBc1RgbSrgb     = 132;
+        constexpr uint32_t kVkBc1RgbaUnorm   = 133;
+        constexpr uint32_t kVkBc1RgbaSrgb    = 134;
+        constexpr uint32_t kVkBc3Unorm       = 137;
+        constexpr uint32_t kVkBc3Srgb        = 138;
+        constexpr uint32_t kVkEtc2Rgb8Unorm  = 147;
+        constexpr uint32_t kVkEtc2Rgb8Srgb   = 148;
+        constexpr uint32_t kVkEtc2Rgba8Unorm = 151;
+        constexpr uint32_t kVkEtc2Rgba8Srgb  = 152;
+
+        // KTX stores cube faces as +X, -X, +Y, -Y, +Z, -Z.
+        constexpr int kKtxToFace[6] = {5, 4, 2, 3, 1, 0};
+
+        template <typename T>
+        T Read(const uint8_t* data, size_t offset)
+        {
+            T value;
+            std::memcpy(&value, data + offset, sizeof(T));
+            return value;
+        }
+    }
+
+    Ktx2Texture::Ktx2Texture(const std::string& path) : file_(path)
+    {
+        const uint8_t* data = file_.Data();
+        if (file_.Size() < kLevelIndexOffset || std::memcmp(data, kIdentifier, sizeof(kIdentifier)) != 0)
+            throw std::runtime_error(path + " is not a KTX 2 file");
+
+        format_ = Read<uint32_t>(data, 12);
+        width_  = Read<uint32_t>(data, 20);
+        height_ = std::max(Read<uint32_t>(data, 24), 1u);
+        layers_ = std::max(Read<uint32_t>(data, 32), 1u);
+        faces_  = Read<uint32_t>(data, 36);
+        scheme_ = Supercompression(Read<uint32_t>(data, 44));
+        if (scheme_ != kNoSupercompression && scheme_ != kZstd && scheme_ != kZlib)
+            throw std::runtime_error(path + " uses an unsupported supercompression scheme");
+        if (Read<uint32_t>(data, 28) > 1)
+            throw std::runtime_error(path + " is a 3D texture");
+
+        // Sizes from the file are checked in 64 bits, so a hostile count or offset cannot wrap past the end.
+        const uint64_t kFileSize = file_.Size();
+        const uint32_t kLevels   = std::max(Read<uint32_t>(data, 40), 1u);
+        if (kFileSize < kLevelIndexOffset + uint64_t(kLevels) * 24)
+            throw std::runtime_error(path + " is truncated");
+
+        decoded_size_ = 0;
+        for (uint32_t level = 0; level < kLevels; ++level)
+        {
+            Level entry;
+            const size_t kEntry       = kLevelIndexOffset + size_t(level) * 24;
+            entry.offset              = Read<uint64_t>(data, kEntry);
+            entry.length              = Read<uint64_t>(data, kEntry + 8);
+            entry.uncompressed_length = Read<uint64_t>(data, kEntry + 16);
+            entry.decoded_offset      = decoded_size_;
+            if (entry.offset > kFileSize || entry.length > kFileSize - entry.offset)
+                throw std::runtime_error(path + " is truncated");
+            if (entry.uncompressed_length > SIZE_MAX - 15 - decoded_size_)
+                throw std::runtime_error(path + " has an inconsistent level index");
+            if (scheme_ == kNoSupercompression && entry.length != entry.uncompressed_length)
+                throw std::runtime_error(path + " has an inconsistent level index");
+
+            decoded_size_ += (entry.uncompressed_length + 15) / 16 * 16;
+            levels_.push_back(entry);
+        }
+    }
+
+    size_t Ktx2Texture::ImageOffset(uint32_t level, uint32_t layer, uint32_t face) const
+    {
+        const size_t kImageSize = LevelSize(level) / (size_t(layers_) * faces_);
+        return LevelOffset(level) + (size_t(layer) * faces_ + face) * kImageSize;
+    }
+
+    void Ktx2Texture::DecodeLevel(uint32_t level, uint8_t* destination) const
+    {
+        const Level& entry = levels_[level];
+        const uint8_t* src = file_.Data() + entry.offset;
+        switch (scheme_)
+        {
+        case kNoSupercompression:
+            std::memcpy(destination, src, entry.length);
+            break;
+        case kZstd:
+        {
+            const size_t kSize = ZSTD_decompress(destination, entry.uncompressed_length, src, entry.length);
+            if (ZSTD_isError(kSize) || kSize != entry.uncompressed_length)
+                throw std::runtime_error("corrupt Zstandard level in KTX 2 file");
+            break;
+        }
+        case kZlib:
+        {
+            uLongf size = uLongf(entry.uncompressed_length);
+            if (uncompress(destination, &size, src, uLong(entry.length)) != Z_OK || size != entry.uncompressed_length)
+                throw std::runtime_error("corrupt zlib level in KTX 2 file");
+            break;
+        }
+        default:
+            throw std::runtime_error("unsupported supercompression scheme");
+        }
+    }
+
+    void Ktx2Texture::Decode(uint8_t* destination) const
+    {
+        std::exception_ptr error;
+        std::mutex error_mutex;
+
+        // Largest levels first, so the long decodes start before the short ones.
+#pragma omp parallel for schedule(dynamic)
+        for (int level = 0; level < int(levels_.size()); ++level)
+        {
+            try
+            {
+                DecodeLevel(uint32_t(level), destination + levels_[level].decoded_offset);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    std::vector<BlockTexture> LoadKtx2Cubemap(const std::string& path)
+    {
+        const Ktx2Texture kTexture(path);
+        if (kTexture.Faces() != 6 || kTexture.Layers() != 1)
+            throw std::runtime_error(path + " is not a cubemap");
+
+        BlockFormat format;
+        switch (kTexture.Format())
+        {
+        case kVkBc1RgbUnorm:
+        case kVkBc1RgbSrgb:
+        case kVkBc1RgbaUnorm:
+        case kVkBc1RgbaSrgb:
+            format = kBc1;
+            break;
+        case kVkBc3Unorm:
+        case kVkBc3Srgb:
+            format = kBc3;
+            break;
+        case kVkEtc2Rgb8Unorm:
+        case kVkEtc2Rgb8Srgb:
+            format = kEtc2Rgb;
+            break;
+        case kVkEtc2Rgba8Unorm:
+        case kVkEtc2Rgba8Srgb:
+            format = kEtc2Rgba;
+            break;
+        default:
+            throw std::runtime_error(path + " is not BC1, BC3 or ETC2 compressed");
+        }
+
+        // Only level 0 is sampled.
+        std::vector<uint8_t> decoded(kTexture.LevelSize(0));
+        kTexture.DecodeLevel(0, decoded.data());
+
+        const size_t kFaceSize = kTexture.LevelSize(0) / 6;
+        std::vector<BlockTexture> faces(6, BlockTexture(format, 0, 0, {}));
+        for (uint32_t i = 0; i < 6; ++i)
+        {
+            const uint8_t* begin = &decoded[i * kFaceSize];
+            faces[kKtxToFace[i]] = BlockTexture(format, int(kTexture.Width()), int(kTexture.Height()),
+                std::vector<uint8_t>(begin, begin + kFaceSize));
+        }
+        return faces;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "block_texture.h"
+#include "mapped_file.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dhh::texture
+{
+    enum Supercompression
+    {
+        kNoSupercompression = 0,
+        kBasisLz            = 1,
+        kZstd               = 2,
+        kZlib               = 3
+    };
+
+    // A KTX 2 texture, mapped from disk. Levels are decompressed only by Decode(), in parallel and straight into the
+    // caller's memory, which may be a mapped staging buffer; the file itself is never copied.
+    class Ktx2Texture
+    {
+    public:
+        explicit Ktx2Texture(const std::string& path);
+
+        // The VkFormat of the texels.
+        uint32_t Format() const { return format_; }
+        uint32_t Width() const { return width_; }
+        uint32_t Height() const { return height_; }
+        uint32_t Levels() const { return uint32_t(levels_.size()); }
+        uint32_t Faces() const { return faces_; }
+        uint32_t Layers() const { return layers_; }
+        Supercompression Scheme() const { return scheme_; }
+
+        // Layout of the decoded data: levels from the largest, each 16-byte aligned, with the faces of every layer
+        // packed inside a level as in the file.
+        size_t DecodedSize() const { return decoded_size_; }
+        size_t LevelOffset(uint32_t level) const { return levels_[level].decoded_offset; }
+        size_t LevelSize(uint32_t level) const { return levels_[level].uncompressed_length; }
+        size_t ImageOffset(uint32_t level, uint32_t layer, uint32_t face) const;
+
+        // Decompresses every level into destination, which must hold DecodedSize() bytes. Levels are decoded in
+        // parallel; the supercompression schemes compress a level as a whole, so a level is the unit of work.
+        void Decode(uint8_t* destination) const;
+
+        // Decompresses one level into destination, which must hold LevelSize(level) bytes.
+        void DecodeLevel(uint32_t level, uint8_t* destination) const;
+
+    private:
+        struct Level
+        {
+            uint64_t offset;
+            uint64_t length;
+            uint64_t uncompressed_length;
+            size_t decoded_offset;
+        };
+
+        io::MappedFile file_;
+        uint32_t format_, width_, height_, faces_, layers_;
+        Supercompression scheme_;
+        std::vector<Level> levels_;
+        size_t decoded_size_;
+    };
+
+    // Level 0 of a BC1, BC3 or ETC2 KTX 2 cubemap, as six faces in the order of dhh::skybox::kFaceNames.
+    std::vector<BlockTexture> LoadKtx2Cubemap(const std::string& path);
+}
@@ -1,15 +1,19 @@
 #include "pch.h"
+#include "block_texture.h"
+#include "disk_texture.h"
+#include "ktx2.h"
+#include "ray_class.h"
+#include "redshift.h"
+#include "sky_map.h"
+#include "skybox_cache.h"
 
 using namespace boost::math::constants;
 
+// The sky around the black hole. Every source, face images, a skybox cache, paged tiles, block-compressed faces or a
+// sky survey, is loaded into a map that owns its texels, so the tracer samples them all the same way.
 struct Skybox
 {
-    cv::Mat front;
-    cv::Mat back;
-    cv::Mat top;
-    cv::Mat bottom;
-    cv::Mat left;
-    cv::Mat right;
+    std::shared_ptr<const dhh::skybox::SkyMap> map;
 };
 
 struct Blackhole
@@ -18,6 +22,14 @@ struct Blackhole
     double disk_inner;
     double disk_outer;
     std::vector<glm::dvec3> disk_texture;
+
+    // When set, replaces disk_texture: the disk color over (radius, azimuth), baked once and filtered.
+    std::shared_ptr<dhh::disk::DiskLut> disk_lut;
+
+    // When set, the disk glows as a black body at dhh::disk::DiskTemperature, shifted by gravitational redshift and
+    // Doppler beaming. disk_lut, if also set, then only modulates the brightness.
+    std::shared_ptr<const dhh::disk::ShadingLut> shading;
+    double disk_peak_kelvin = 0;
 };
 
 struct Camera
@@ -39,6 +51,41 @@ inline void GenerateDiskTexture(Blackhole& bh)
     }
 }
 
+// The disk color from an 8-bit BGR image laid out as for LoadDiskTexture below, e.g. a movie frame. The pixels are
+// converted into the table, so the image may be reused as soon as this returns. A table of the same size, such as the
+// previous frame's, is updated in place, so nothing may sample it meanwhile.
+inline void SetDiskImage(Blackhole& bh, const uint8_t* bgr, int width, int height, size_t stride)
+{
+    if (bh.disk_lut && bh.disk_lut->Radial() == width && bh.disk_lut->Azimuthal() == height)
+        bh.disk_lut->Update(bgr, width, height, stride);
+    else
+        bh.disk_lut = std::make_shared<dhh::disk::DiskLut>(dhh::disk::DiskLut::FromImage(bgr, width, height, stride));
+}
+
+// An image with the radius along the columns, from disk_inner to disk_outer, and the azimuth along the rows.
+inline void LoadDiskTexture(const std::string& path, Blackhole& bh)
+{
+    const cv::Mat kImage = cv::imread(path, cv::IMREAD_COLOR);
+    if (kImage.empty())
+        throw std::runtime_error("cannot read " + path);
+    SetDiskImage(bh, kImage.data, kImage.cols, kImage.rows, kImage.step);
+}
+
+// Thin disk temperature profile peaking at peak_kelvin, rendered as black body colors.
+inline void GenerateDiskTemperature(Blackhole& bh, double peak_kelvin)
+{
+    bh.disk_lut = std::make_shared<dhh::disk::DiskLut>(
+        dhh::disk::TemperatureProfile(bh.disk_inner, bh.disk_outer, peak_kelvin));
+}
+
+// Same temperature profile, seen through the redshift of every ray that reaches the disk. The peak of an unshifted
+// disk has unit luminance.
+inline void GenerateDiskShading(Blackhole& bh, double peak_kelvin)
+{
+    bh.shading          = std::make_shared<dhh::disk::ShadingLut>(peak_kelvin);
+    bh.disk_peak_kelvin = peak_kelvin;
+}
+
 inline double CalculateImpactParameter(double theta, double r, double rs)
 {
     return r * std::sin(theta) / std::sqrt(1 - rs / r);
@@ -238,75 +285,132 @@ double rkf45(double x0, double x1, double h, double b)
     return negative ? -y : y;
 }
 
-inline void LoadSkybox(std::filesystem::path dir, Skybox& skybox)
+inline dhh::skybox::TexelView ToTexelView(const cv::Mat& image)
 {
-    skybox.front  = cv::imread((dir / "front.jpg").string());
-    skybox.back   = cv::imread((dir / "back.jpg").string());
-    skybox.top    = cv::imread((dir / "top.jpg").string());
-    skybox.bottom = cv::imread((dir / "bottom.jpg").string());
-    skybox.left   = cv::imread((dir / "left.jpg").string());
-    skybox.right  = cv::imread((dir / "right.jpg").string());
+    if (image.type() != CV_8UC3)
+        throw std::runtime_error("sky maps must be 8-bit BGR");
+    return {image.data, image.cols, image.rows, image.step};
 }
 
-static inline bool AbsCompare(int a, int b)
+// Six faces in the order of dhh::skybox::kFaceNames behind the sky map interface. owner keeps whatever the faces
+// point into alive.
+inline std::shared_ptr<const dhh::skybox::CubeSkyMap> MakeCubeSkyMap(
+    const std::array<cv::Mat, 6>& faces, std::shared_ptr<const void> owner = nullptr)
 {
-    return (std::abs(a) < std::abs(b));
+    struct Storage
+    {
+        std::array<cv::Mat, 6> faces;
+        std::shared_ptr<const void> owner;
+    };
+    auto storage = std::make_shared<Storage>(Storage{faces, std::move(owner)});
+
+    std::array<dhh::skybox::TexelView, 6> views;
+    for (int face = 0; face < 6; ++face)
+    {
+        views[face] = ToTexelView(storage->faces[face]);
+    }
+    return std::make_shared<dhh::skybox::CubeSkyMap>(views, storage);
 }
 
-inline glm::dvec3 SkyboxSampler(const glm::dvec3& tex_coord, const Skybox& skybox)
+// Maps the preprocessed cubemap next to the images, converting them on first use. The faces are views of the
+// mapping, so nothing is decoded on later runs. Falls back to decoding the images when no cache can be written.
+inline void LoadSkybox(std::filesystem::path dir, Skybox& skybox)
 {
-    std::vector<double> temp_vector = {tex_coord.x, tex_coord.y, tex_coord.z};
-    int max_abs_index =
-        std::distance(temp_vector.begin(), std::max_element(temp_vector.begin(), temp_vector.end(), AbsCompare));
-
-    const cv::Mat* image;
+    std::array<cv::Mat, 6> faces;
+    try
+    {
+        std::shared_ptr<const dhh::skybox::SkyboxCache> cache = dhh::skybox::SkyboxCache::OpenOrBuild(dir);
+        for (int face = 0; face < 6; ++face)
+        {
+            faces[face] = cache->Face(face);
+        }
+        skybox.map = MakeCubeSkyMap(faces, cache);
+        return;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "skybox cache unavailable: " << e.what() << "\n";
+    }
 
-    switch (max_abs_index)
+    for (int face = 0; face < 6; ++face)
     {
-    case 2:
-        if (tex_coord[max_abs_index] > 0)
-            image = &skybox.back;
-        else
-            image = &skybox.front;
-        break;
-    case 1:
-        if (tex_coord[max_abs_index] > 0)
-            image = &skybox.top;
-        else
-            image = &skybox.bottom;
-        break;
-    case 0:
-        if (tex_coord[max_abs_index] > 0)
-            image = &skybox.right;
-        else
-            image = &skybox.left;
-        break;
-    default:
-        throw std::runtime_error("error");
+        faces[face] = cv::imread(dhh::skybox::FacePath(dir, face).string());
     }
+    skybox.map = MakeCubeSkyMap(faces);
+}
 
-    double scale = 1 / tex_coord[max_abs_index];
+// For skies too large to keep in memory: only the tiles the tracer touches are loaded, up to budget bytes.
+inline void LoadTiledSkybox(std::filesystem::path dir, Skybox& skybox, size_t budget)
+{
+    skybox.map = std::make_shared<dhh::skybox::TiledSkyMap>(dhh::skybox::OpenOrBuildTiledSkybox(dir, budget));
+}
 
-    // delete index that I don't need
-    temp_vector.erase(temp_vector.begin() + max_abs_index);
+// Keeps the sky block-compressed in memory and decodes texels on lookup, for many renderers sharing a host.
+inline void LoadCompressedSkybox(const std::string& ktx_path, Skybox& skybox)
+{
+    if (std::filesystem::path(ktx_path).extension() == ".ktx2")
+        skybox.map = std::make_shared<dhh::texture::BlockSkyMap>(dhh::texture::LoadKtx2Cubemap(ktx_path));
+    else
+        skybox.map = std::make_shared<dhh::texture::BlockSkyMap>(dhh::texture::LoadKtxCubemap(ktx_path));
+}
 
-    glm::dvec2 coord_2d(std::min(1.0, std::max(0.0, (temp_vector[0] * scale + 1) / 2)),
-        std::min(1.0, std::max(0.0, (temp_vector[1] * scale + 1) / 2)));
+// An equirectangular sky survey image, sampled directly instead of being resampled into cube faces.
+inline void LoadEquirectSkyMap(const std::string& path, Skybox& skybox)
+{
+    auto image = std::make_shared<cv::Mat>(cv::imread(path, cv::IMREAD_COLOR));
+    if (image->empty())
+        throw std::runtime_error("cannot read " + path);
+    skybox.map = std::make_shared<dhh::skybox::EquirectSkyMap>(ToTexelView(*image), image);
+}
 
-    if (coord_2d.x > 1 || coord_2d.y > 1 || coord_2d.x < 0 || coord_2d.y < 0)
-        throw std::runtime_error("2d coord out of range 0 to 1");
+// A HEALPix map in RING ordering, stored as an image whose pixels in row-major order are the map's pixels.
+inline void LoadHealpixSkyMap(const std::string& path, int nside, Skybox& skybox)
+{
+    auto image = std::make_shared<cv::Mat>(cv::imread(path, cv::IMREAD_COLOR));
+    if (image->empty())
+        throw std::runtime_error("cannot read " + path);
+    skybox.map = std::make_shared<dhh::skybox::HealpixSkyMap>(nside, ToTexelView(*image), image);
+}
 
+// The size of the image a movie played on sky replaces: the back face of a cube, or the whole image of a sky survey.
+inline cv::Size SkyImageSize(const dhh::skybox::SkyMap& sky)
+{
+    if (auto faces = dynamic_cast<const dhh::skybox::FaceSkyMap*>(&sky))
+        return cv::Size(faces->FaceWidth(1), faces->FaceHeight(1));
+    if (auto equirect = dynamic_cast<const dhh::skybox::EquirectSkyMap*>(&sky))
+        return cv::Size(equirect->Image().width, equirect->Image().height);
+    if (auto healpix = dynamic_cast<const dhh::skybox::HealpixSkyMap*>(&sky))
+        return cv::Size(healpix->Pixels().width, healpix->Pixels().height);
+    throw std::runtime_error("this kind of sky cannot play a movie");
+}
 
-    int max_row_col = 4095;
+// sky with that image replaced by frame, 8-bit BGR texels of SkyImageSize(*sky). The frame is borrowed, not copied:
+// the map must not be sampled once the frame's memory is reused, e.g. by the next MovieReader::getFrame().
+inline std::shared_ptr<const dhh::skybox::SkyMap> ReplaceSkyImage(
+    const std::shared_ptr<const dhh::skybox::SkyMap>& sky, const dhh::skybox::TexelView& frame)
+{
+    if (auto faces = std::dynamic_pointer_cast<const dhh::skybox::FaceSkyMap>(sky))
+        return std::make_shared<dhh::skybox::ReplacedFaceSkyMap>(faces, 1, frame, nullptr);
+    if (dynamic_cast<const dhh::skybox::EquirectSkyMap*>(sky.get()))
+        return std::make_shared<dhh::skybox::EquirectSkyMap>(frame, nullptr);
+    if (auto healpix = dynamic_cast<const dhh::skybox::HealpixSkyMap*>(sky.get()))
+        return std::make_shared<dhh::skybox::HealpixSkyMap>(healpix->Nside(), frame, nullptr);
+    throw std::runtime_error("this kind of sky cannot play a movie");
+}
 
-    int row         = std::lround(coord_2d[1] * max_row_col);
-    int col         = std::lround(coord_2d[0] * max_row_col);
-    cv::Vec3b color = image->at<cv::Vec3b>(row, col);
-    return glm::dvec3((double) color[2] / 255, (double) color[1] / 255, (double) color[0] / 255);
+// footprint is the angle of sky the sample covers, see SkyFootprint; 0 samples the sky at full resolution.
+inline glm::dvec3 SkyboxSampler(const glm::dvec3& tex_coord, const Skybox& skybox, double footprint = 0)
+{
+    const std::array<uint8_t, 3> kColor =
+        footprint > 0 ? skybox.map->FilteredTexel(tex_coord.x, tex_coord.y, tex_coord.z, footprint)
+                      : skybox.map->Texel(tex_coord.x, tex_coord.y, tex_coord.z);
+    return glm::dvec3(kColor[2] / 255.0, kColor[1] / 255.0, kColor[0] / 255.0);
 }
 
+// spread is the angle a pixel subtends at the camera in origin. The disk table is sampled at the level that matches the
+// pixel's footprint where its ray meets the disk, estimated from the straight distance to there; 0 samples level 0.
 inline glm::dvec3 DiskSampler(glm::dvec3 start_pos, double b, double r0, double r1, glm::dvec3 rotation_axis,
-    const Blackhole& bh, gsl_integration_workspace* w)
+    const Blackhole& bh, gsl_integration_workspace* w, glm::dvec3 origin = glm::dvec3(0), double spread = 0)
 {
     int direction = 0;
     if (r0 < r1)
@@ -343,7 +447,42 @@ inline glm::dvec3 DiskSampler(glm::dvec3 start_pos, double b, double r0, double
     }
     double dr = glm::length(pos_near_disk) - bh.disk_inner;
 
-    int sample_index = dr / (bh.disk_outer - bh.disk_inner) * (bh.disk_texture.size() - 1);
+    int level = 0;
+    if (bh.disk_lut)
+    {
+        const double kFootprint = spread * glm::length(pos_near_disk - origin);
+        level                   = bh.disk_lut->LevelFor(kFootprint / (bh.disk_outer - bh.disk_inner),
+            kFootprint / (dhh::skybox::kTwoPi * glm::length(pos_near_disk)));
+    }
+
+    if (bh.shading)
+    {
+        // The light travels against the traced ray, so its angular momentum is the opposite of the ray's.
+        const double kRadius        = glm::length(pos_near_disk);
+        const double kG             = dhh::disk::RedshiftFactor(kRadius, -b * rotation_axis.y);
+        const double kKelvin        = dhh::disk::DiskTemperature(kRadius, bh.disk_inner, bh.disk_peak_kelvin);
+        const dhh::disk::Rgb kColor = bh.shading->Sample(kG, kKelvin);
+        double brightness           = 1;
+        if (bh.disk_lut)
+        {
+            const double kAzimuth     = std::atan2(pos_near_disk.z, pos_near_disk.x) / dhh::skybox::kTwoPi;
+            const dhh::disk::Rgb kTex = bh.disk_lut->Sample(dr / (bh.disk_outer - bh.disk_inner), kAzimuth, level);
+            brightness                = (kTex.r + kTex.g + kTex.b) / 3;
+        }
+        return glm::dvec3(kColor.r, kColor.g, kColor.b) * brightness;
+    }
+
+    if (bh.disk_lut)
+    {
+        const double kAzimuth       = std::atan2(pos_near_disk.z, pos_near_disk.x) / dhh::skybox::kTwoPi;
+        const dhh::disk::Rgb kColor = bh.disk_lut->Sample(dr / (bh.disk_outer - bh.disk_inner), kAzimuth, level);
+        return {kColor.r, kColor.g, kColor.b};
+    }
+
+    // The step past the disk plane may land just outside the disk.
+    const int kLast  = int(bh.disk_texture.size()) - 1;
+    int sample_index = int(dr / (bh.disk_outer - bh.disk_inner) * kLast);
+    sample_index     = std::clamp(sample_index, 0, kLast);
 
     return bh.disk_texture[sample_index];
 }
@@ -371,16 +510,63 @@ glm::vec3 rotate(glm::vec3 position, float angle, glm::vec3 axis)
     return glm::vec3(RotationMatrix(axis, angle) * glm::vec4(position, 0.f));
 }
 
-inline glm::dvec3 Trace(glm::dvec3 tex_coord, const Blackhole& bh, glm::dvec3 cam_position, const Skybox& skybox,
-    gsl_integration_workspace* w, bool* bloom)
+// What a ray through tex_coord is found to be before anything is integrated: its impact parameter, its closest
+// approach (0 if it falls in) and so the branch of Trace it takes.
+struct RayPath
+{
+    double b;
+    double closest_approach;
+    dhh::rays::RayClass ray_class;
+};
+
+inline RayPath ClassifyRay(glm::dvec3 tex_coord, const Blackhole& bh, glm::dvec3 cam_position)
+{
+    double theta = std::acos(GetCosAngle(tex_coord, bh.position - cam_position));
+    double r0    = glm::length(cam_position);
+    double b     = CalculateImpactParameter(theta, r0);
+    double r3    = b < std::sqrt(27) ? 0 : FindClosestApproach1(r0, b);
+    return {b, r3, dhh::rays::Classify(b, r3, bh.disk_inner, bh.disk_outer)};
+}
+
+// The angle of sky seen by a pixel of angle spread whose ray, through tex_coord with impact parameter b, escapes
+// towards sky_dir after sweeping dphi. Lensing stretches the pixel along the plane of the ray by how much the sweep
+// changes over it, found by sweeping the impact parameter of its neighbour, and across the plane by how far from the
+// axis through the black hole the ray leaves compared to where it started.
+inline double SkyFootprint(glm::dvec3 tex_coord, glm::dvec3 bh_dir, glm::dvec3 cam_position, glm::dvec3 sky_dir,
+    double b, double dphi, double spread, gsl_integration_workspace* w)
+{
+    const double kR0       = glm::length(cam_position);
+    const double kCosTheta = GetCosAngle(tex_coord, bh_dir);
+    const double kCosSky   = GetCosAngle(sky_dir, cam_position);
+    const double kNextB    = b + std::abs(kR0 * kCosTheta / std::sqrt(1 - 2 / kR0)) * spread;
+    const double kR3       = FindClosestApproach1(kR0, kNextB);
+    const double kNextDphi = Integrate(kR0, kR3, kNextB, w) - Integrate(kR3, 2000, kNextB, w);
+
+    const double kAlong  = std::abs(std::remainder(kNextDphi - dphi, 2 * pi<double>()));
+    const double kAcross = spread * std::sqrt(std::max(1 - kCosSky * kCosSky, 0.0))
+                         / std::sqrt(std::max(1 - kCosTheta * kCosTheta, 1e-12));
+    return std::max(kAlong, kAcross);
+}
+
+// Traces the ray through tex_coord, classified as path by ClassifyRay. spread is the angle a pixel subtends, see
+// DiskSampler.
+inline glm::dvec3 Trace(glm::dvec3 tex_coord, const RayPath& path, const Blackhole& bh, glm::dvec3 cam_position,
+    const Skybox& skybox, gsl_integration_workspace* w, bool* bloom, double spread = 0)
 {
     glm::dvec3 bh_dir        = bh.position - cam_position;
     glm::dvec3 rotation_axis = glm::normalize(glm::cross(tex_coord, bh_dir));
-    double cos_theta         = GetCosAngle(tex_coord, bh_dir);
-    double theta             = std::acos(cos_theta);
     double r0                = glm::length(cam_position);
-    double b                 = CalculateImpactParameter(theta, r0);
+    double b                 = path.b;
     double integrate_end     = 2000;
+
+    // The sky where the ray leaves after sweeping dphi, at the level of its footprint if the sky has levels.
+    auto sky = [&](double dphi) {
+        glm::dvec3 distort_coord = glm::rotate(cam_position, -dphi, rotation_axis);
+        double footprint         = spread > 0 && skybox.map->Filtered()
+                                     ? SkyFootprint(tex_coord, bh_dir, cam_position, distort_coord, b, dphi, spread, w)
+                                     : 0;
+        return SkyboxSampler(distort_coord, skybox, footprint);
+    };
     if (b < std::sqrt(27))
     {
         // Debug
@@ -395,13 +581,14 @@ inline glm::dvec3 Trace(glm::dvec3 tex_coord, const Blackhole& bh, glm::dvec3 ca
         if (std::abs(dphi_in_disk) > pi<double>() || photon_pos_start[1] * photon_pos_end[1] < 0)
         {
             *bloom = true;
-            return DiskSampler(photon_pos_start, b, bh.disk_outer, bh.disk_inner, rotation_axis, bh, w);
+            return DiskSampler(photon_pos_start, b, bh.disk_outer, bh.disk_inner, rotation_axis, bh, w, cam_position,
+                spread);
         }
         return glm::dvec3(0, 0, 0);
     }
     else
     {
-        double r3 = FindClosestApproach1(r0, b);
+        double r3 = path.closest_approach;
         if (r3 > bh.disk_outer)
         {
             // Debug
@@ -409,8 +596,7 @@ inline glm::dvec3 Trace(glm::dvec3 tex_coord, const Blackhole& bh, glm::dvec3 ca
 
             double dphi = std::fmod(Integrate(r0, r3, b, w) - Integrate(r3, integrate_end, b, w), pi<double>() * 2);
 
-            glm::dvec3 distort_coord = glm::rotate(cam_position, -dphi, rotation_axis);
-            return SkyboxSampler(distort_coord, skybox);
+            return sky(dphi);
         }
         else
         {
@@ -426,7 +612,8 @@ inline glm::dvec3 Trace(glm::dvec3 tex_coord, const Blackhole& bh, glm::dvec3 ca
                 if (std::abs(dphi_in_disk) > pi<double>() || photon_pos_start[1] * photon_pos_end[1] < 0)
                 {
                     *bloom = true;
-                    return DiskSampler(photon_pos_start, b, bh.disk_outer, bh.disk_inner, rotation_axis, bh, w);
+                    return DiskSampler(photon_pos_start, b, bh.disk_outer, bh.disk_inner, rotation_axis, bh, w,
+                        cam_position, spread);
                 }
 
                 dphi             = dphi + Integrate(bh.disk_inner, r3, b, w) - Integrate(r3, bh.disk_inner, b, w);
@@ -437,13 +624,13 @@ inline glm::dvec3 Trace(glm::dvec3 tex_coord, const Blackhole& bh, glm::dvec3 ca
                 if (std::abs(dphi_in_disk) > pi<double>() || photon_pos_start[1] * photon_pos_end[1] < 0)
                 {
                     *bloom = true;
-                    return DiskSampler(photon_pos_start, b, bh.disk_inner, bh.disk_outer, rotation_axis, bh, w);
+                    return DiskSampler(photon_pos_start, b, bh.disk_inner, bh.disk_outer, rotation_axis, bh, w,
+                        cam_position, spread);
                 }
 
-                dphi                     = dphi - Integrate(bh.disk_outer, integrate_end, b, w);
-                glm::dvec3 distort_coord = glm::rotate(cam_position, -dphi, rotation_axis);
+                dphi = dphi - Integrate(bh.disk_outer, integrate_end, b, w);
 
-                return SkyboxSampler(distort_coord, skybox);
+                return sky(dphi);
             }
             else
             {
@@ -454,7 +641,8 @@ inline glm::dvec3 Trace(glm::dvec3 tex_coord, const Blackhole& bh, glm::dvec3 ca
                 if (std::abs(dphi_in_disk) > pi<double>() || photon_pos_start[1] * photon_pos_end[1] < 0)
                 {
                     *bloom = true;
-                    return DiskSampler(photon_pos_start, b, bh.disk_outer, r3, rotation_axis, bh, w);
+                    return DiskSampler(photon_pos_start, b, bh.disk_outer, r3, rotation_axis, bh, w, cam_position,
+                        spread);
                 }
                 photon_pos_start = photon_pos_end;
                 dphi_in_disk     = Integrate(r3, bh.disk_outer, b, w);
@@ -463,20 +651,26 @@ inline glm::dvec3 Trace(glm::dvec3 tex_coord, const Blackhole& bh, glm::dvec3 ca
                 if (std::abs(dphi_in_disk) > pi<double>() || photon_pos_start[1] * photon_pos_end[1] < 0)
                 {
                     *bloom = true;
-                    return DiskSampler(photon_pos_start, b, r3, bh.disk_outer, rotation_axis, bh, w);
+                    return DiskSampler(photon_pos_start, b, r3, bh.disk_outer, rotation_axis, bh, w, cam_position,
+                        spread);
                 }
 
                 // not hit
                 dphi = std::fmod(dphi - Integrate(bh.disk_outer, integrate_end, b, w), pi<double>() * 2);
-                glm::dvec3 distort_coord = glm::rotate(cam_position, -dphi, rotation_axis);
 
-                return SkyboxSampler(distort_coord, skybox);
+                return sky(dphi);
             }
         }
     }
     return glm::dvec3(1, 0, 0);
 }
 
+inline glm::dvec3 Trace(glm::dvec3 tex_coord, const Blackhole& bh, glm::dvec3 cam_position, const Skybox& skybox,
+    gsl_integration_workspace* w, bool* bloom, double spread = 0)
+{
+    return Trace(tex_coord, ClassifyRay(tex_coord, bh, cam_position), bh, cam_position, skybox, w, bloom, spread);
+}
+
 glm::dvec3 GetTexCoord(int row, int col, int width, int height)
 {
     double z = -1;
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace dhh::io
+{
+    // Read-only memory mapping of a whole file. Pages are faulted in by the OS on first access and shared between
+    // processes mapping the same file, so opening costs next to nothing regardless of the file size.
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const std::filesystem::path& path)
+        {
+#ifdef _WIN32
+            file_ = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+            if (file_ == INVALID_HANDLE_VALUE)
+                throw std::runtime_error("cannot open " + path.string());
+            LARGE_INTEGER size;
+            GetFileSizeEx(file_, &size);
+            size_ = size_t(size.QuadPart);
+            if (size_)
+            {
+                mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                data_    = mapping_ ? MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0) : nullptr;
+            }
+#else
+            fd_ = open(path.c_str(), O_RDONLY);
+            if (fd_ < 0)
+                throw std::runtime_error("cannot open " + path.string());
+            struct stat info;
+            fstat(fd_, &info);
+            size_ = size_t(info.st_size);
+            if (size_)
+            {
+                data_ = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+                if (data_ == MAP_FAILED)
+                    data_ = nullptr;
+            }
+#endif
+            if (size_ && !data_)
+            {
+                Close();
+                throw std::runtime_error("cannot map " + path.string());
+            }
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const uint8_t* Data() const { return static_cast<const uint8_t*>(data_); }
+        size_t Size() const { return size_; }
+
+        ~MappedFile() { Close(); }
+
+    private:
+        void Close()
+        {
+#ifdef _WIN32
+            if (data_)
+                UnmapViewOfFile(data_);
+            if (mapping_)
+                CloseHandle(mapping_);
+            if (file_ != INVALID_HANDLE_VALUE)
+                CloseHandle(file_);
+            mapping_ = nullptr;
+            file_    = INVALID_HANDLE_VALUE;
+#else
+            if (data_)
+                munmap(data_, size_);
+            if (fd_ >= 0)
+                close(fd_);
+            fd_ = -1;
+#endif
+            data_ = nullptr;
+        }
+
+        void* data_  = nullptr;
+        size_t size_ = 0;
+#ifdef _WIN32
+        HANDLE file_    = INVALID_HANDLE_VALUE;
+        HANDLE mapping_ = nullptr;
+#else
+        int fd_ = -1;
+#endif
+    };
+}
@@ -3,10 +3,19 @@
 
 #pragma once
 
-#include <cairo/cairo.h>
+#include "colorspace.h"
+#include "frame_queue.h"
+
 #include <stdint.h>
 
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 extern "C" {
@@ -18,53 +27,183 @@ extern "C" {
 #include <libavutil/opt.h>
 }
 
-class MovieWriter
+// Snapshot passed to EncoderSettings::progress.
+struct EncoderProgress
 {
-    const unsigned int width, height;
-    unsigned int iframe;
-
-    SwsContext* swsCtx;
-    AVOutputFormat* fmt;
-    AVStream* stream;
-    AVFormatContext* fc;
-    AVCodecContext* c;
-    AVPacket pkt;
+    int64_t frames_encoded;
+    int64_t bytes_written;
+    double seconds;
+};
 
-    AVFrame *rgbpic, *yuvpic;
+// Encoder configuration. Quality and speed are presets that writer.cpp maps onto the options of the selected codec.
+struct EncoderSettings
+{
+    enum Quality
+    {
+        kDraft,
+        kPreview,
+        kHigh,
+        kLossless
+    };
+
+    enum Speed
+    {
+        kRealtime,
+        kFast,
+        kBalanced,
+        kSlow
+    };
+
+    std::string codec     = "libvpx-vp9";
+    std::string container = "mp4";
+    int fps               = 25;
+    Quality quality       = kHigh;
+    Speed speed           = kSlow;
+
+    // Pictures buffered per encoder before addFrame() blocks.
+    unsigned int queue_depth = 4;
+
+    // Segmented mode. When segment_frames is non-zero the movie is cut into closed-GOP chunks of that many frames.
+    // Chunks are encoded in parallel by segment_workers independent codec contexts (0 picks one per four hardware
+    // threads) and concatenated without re-encoding on close(). A worker starts with the first chunk dealt to it and
+    // buffers up to one chunk, allocating its pictures as it first needs them, so at most
+    // min(segment_workers, chunks) * max(queue_depth, segment_frames) pictures of width * height * 3 / 2 bytes are
+    // held: about 3 MB each at 1080p and 12 MB at 4K.
+    unsigned int segment_frames  = 0;
+    unsigned int segment_workers = 0;
+
+    // Codec threads per context; 0 shares the hardware threads between the workers.
+    unsigned int codec_threads = 0;
+
+    // Called from the encoder threads at most once per progress_interval seconds, and once more by close().
+    std::function<void(const EncoderProgress&)> progress;
+    double progress_interval = 1;
+};
 
-    std::vector<uint8_t> pixels;
+class MovieWriter
+{
+    class Encoder;
+    struct Lane;
 
-    cairo_surface_t* cairo_surface;
+    const unsigned int width, height;
+    const EncoderSettings settings;
+    const std::string movie_name;
+
+    // Each lane owns a pool of YUV420P pictures and an encoder thread. addFrame() converts the caller's pixels
+    // straight into a free picture of the lane that encodes that frame and returns; when all its pictures are in use
+    // addFrame() blocks, which bounds memory. A plain movie has a single lane writing the output file directly; a
+    // segmented one starts lanes as segments are dealt to them, up to lane_limit, each holding lane_depth pictures.
+    std::vector<std::unique_ptr<Lane>> lanes;
+    unsigned int lane_limit;
+    size_t lane_depth;
+    unsigned int codec_threads;
+    int64_t frames;
+    bool closed;
+
+    std::atomic<int64_t> frames_encoded;
+    std::atomic<int64_t> bytes_written;
+    const std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point last_report;
+    std::mutex progress_mutex;
+
+    template <typename Layout>
+    void queueFrame(const typename Layout::Component* pixels, size_t stride);
+
+    // Fills the next free picture with fill(planes) and hands it to its encoder.
+    template <typename Fill>
+    void queuePicture(Fill fill);
+
+    void startLane();
+    void encodeLoop(Lane& lane);
+    void rethrowEncoderError();
+    void reportProgress(int64_t packet_size, bool force = false);
+    std::string segmentPath(int64_t segment) const;
+    void concatenateSegments();
 
 public:
-    MovieWriter(const std::string& filename, const unsigned int width, const unsigned int height);
+    MovieWriter(const std::string& filename, const unsigned int width, const unsigned int height,
+        const EncoderSettings& settings = EncoderSettings());
 
     void addFrame(const std::string& filename);
 
+    // Queues a tightly packed RGB24 frame.
     void addFrame(const uint8_t* pixels);
 
+    // Queues an RGB24 frame whose rows are stride bytes apart.
+    void addFrame(const uint8_t* pixels, size_t stride);
+
+    // Queues a frame of three floats per pixel in [0, 1]; stride is in bytes, 0 for tightly packed rows.
+    void addFrame(const float* pixels, size_t stride = 0);
+
+    // Queues an RGBX32 frame, e.g. a mapped GPU readback; stride is in bytes, 0 for tightly packed rows. The pixels
+    // are converted before the call returns, so the caller may overwrite them right away.
+    void addFrameRgbx(const uint8_t* pixels, size_t stride = 0);
+
+    // Queues a frame already in the encoder's format: BT.709 limited range YUV 4:2:0, e.g. converted on the GPU. The
+    // planes are copied row by row; nothing is converted.
+    void addFrame(const dhh::movie::Yuv420Planes& planes);
+
+    // Blocks until every queued frame has been handed to the codec.
+    void flush();
+
+    // Drains the queues, writes the delayed frames and the trailer. Called by the destructor if needed.
+    void close();
+
     ~MovieWriter();
 };
 
+// Borrowed view of a decoded frame. Pixels are BGR24 rows stride bytes apart, the layout of the skybox cv::Mat, so
+// they can be wrapped without a copy. The view stays valid until the next MovieReader::getFrame().
+struct MovieFrame
+{
+    const uint8_t* pixels;
+    unsigned int width, height;
+    size_t stride;
+
+    // Sequence number, counting on across loops.
+    int64_t index;
+};
+
 class MovieReader
 {
     const unsigned int width, height;
+    const bool loop;
 
     SwsContext* swsCtx;
-    AVOutputFormat* fmt;
-    AVStream* stream;
     AVFormatContext* fc;
     AVCodecContext* c;
     AVFrame* pFrame;
-    AVFrame* pFrameRGB;
+    AVPacket* pkt;
 
     // The index of video stream.
     int ivstream;
 
+    struct Picture
+    {
+        std::vector<uint8_t> pixels;
+        int64_t index;
+    };
+
+    // Decoded pictures, filled ahead by the decoder thread. The slot of the frame last returned by getFrame() is
+    // held until the next call.
+    const size_t stride;
+    dhh::movie::FrameQueue<Picture> queue;
+    Picture* current;
+    std::thread thread;
+    std::exception_ptr error;
+
+    void decodeLoop();
+    void convert(Picture& picture);
+
 public:
-    MovieReader(const std::string& filename, const unsigned int width, const unsigned int height);
+    // Frames are scaled to width x height. prefetch is the number of decoded frames kept ready; when loop is set the
+    // movie restarts from the beginning instead of ending.
+    MovieReader(const std::string& filename, const unsigned int width, const unsigned int height,
+        size_t prefetch = 4, bool loop = true);
 
-    bool getFrame(std::vector<uint8_t>& pixels);
+    // Moves to the next frame. With wait unset, the current frame is kept if the decoder has not caught up, so the
+    // call never blocks once a first frame is available. Returns false at the end of a movie that does not loop.
+    bool getFrame(MovieFrame& frame, bool wait = true);
 
     ~MovieReader();
-};
+};
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "Camera.h"
+#include "checkpoint.h"
+#include "image_writer.h"
 #include "library.h"
 #include "pch.h"
 
@@ -16,12 +18,13 @@ const int kHeight = 4 * 64;
 uint8_t* img;
 uint8_t* bloom_buffer;
 
+// The traced frame before quantisation, kept for the checkpoint.
+float* hdr;
+
 Skybox skybox;
 // dhh::camera::Camera camera(glm::vec3(18, 1, 16));
 dhh::camera::Camera camera(glm::vec3(0, 1, 12));
 Blackhole bh;
-std::mt19937 rng;
-std::uniform_real_distribution<double> uni(-0.001, 0.001);
 
 std::vector<glm::vec3> positions;
 std::vector<glm::vec3> fronts;
@@ -31,41 +34,151 @@ const int kSamples = 16;
 
 const bool kVideo = false;
 
+// Optional movie played on the sky, one movie frame per rendered frame: on the back face of a skybox, or as the
+// whole image of a sky survey, whichever sky is loaded.
+const char* kBackgroundMovie = nullptr;
+
+// Optional movie played on the accretion disk, decoded at kDiskMovieRadial x kDiskMovieAzimuthal and laid out as
+// kDiskTexture. Replaces kDiskTexture frame by frame.
+const char* kDiskMovie        = nullptr;
+const int kDiskMovieRadial    = 512;
+const int kDiskMovieAzimuthal = 128;
+
 int frames = 20 * 25;
 
-void Worker(int idx)
+// Poster mode: when set, a single kPosterWidth x kPosterHeight image is rendered tile by tile straight into a
+// resumable tiled EXR, instead of the frame loop. Only the tiles in flight are held in memory.
+const int kPosterWidth  = 0;
+const int kPosterHeight = 0;
+const int kPosterTile   = 256;
+
+// Trace the pixels of a frame, or of a poster tile, class by class (see dhh::rays::RayClass) instead of row by row,
+// so each thread runs long stretches of rays down the same branch of Trace.
+const bool kRayBatches = true;
+
+// Bytes of skybox tiles kept resident. When set, the sky is paged in tile by tile as the tracer samples it instead
+// of being loaded whole, for skies too large to hold in memory.
+const size_t kSkyboxBudget = 0;
+
+// Optional BC1, BC3 or ETC2 cubemap used as the sky, kept compressed in memory: .ktx, or .ktx2 with or without
+// Zstandard or zlib supercompression.
+const char* kCompressedSkybox = nullptr;
+
+// Optional sky survey used as the sky: an equirectangular image, or a HEALPix map in RING order when kSkyMapNside is
+// set.
+const char* kSkyMap    = nullptr;
+const int kSkyMapNside = 0;
+
+// Optional accretion disk color: an image with the radius along the columns and the azimuth along the rows, or
+// else, with kDiskPeakKelvin set, black body colors of a thin disk temperature profile.
+const char* kDiskTexture     = nullptr;
+const double kDiskPeakKelvin = 0;
+
+// With kDiskPeakKelvin set, shade the disk with the gravitational redshift and Doppler beaming of each ray. An image
+// in kDiskTexture then only modulates the brightness.
+const bool kDiskRedshift = false;
+
+// The kSamples jittered rays through one pixel of a frame.
+//
+// The jitter comes from an engine seeded by the frame and the pixel, not from one shared by the threads: nothing is
+// raced on, and a pixel gets the same samples whichever thread traces it, in whatever order.
+std::array<glm::dvec3, kSamples> PixelSamples(int frame, int row, int col, int width, int height)
+{
+    std::seed_seq seed = {uint32_t(frame), uint32_t(row), uint32_t(col)};
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uni(-0.001, 0.001);
+
+    glm::dvec3 tex_coord = dhh::camera::GetTexCoord(row, col, width, height, camera);
+    std::array<glm::dvec3, kSamples> samples;
+    for (int sample = 0; sample < kSamples; sample++)
+    {
+        if (kSamples != 1)
+            samples[sample] = tex_coord + glm::dvec3(uni(rng), uni(rng), uni(rng));
+        else
+            samples[sample] = tex_coord;
+    }
+    return samples;
+}
+
+// Averages the PixelSamples of one pixel of a frame. hit is set if any of them reached the disk. first, when given,
+// is the ClassifyRay of the first sample, which is then not classified again.
+glm::dvec3 TracePixel(int frame, int row, int col, int width, int height, gsl_integration_workspace* workspace,
+    bool* hit, const RayPath* first = nullptr)
+{
+    const std::array<glm::dvec3, kSamples> kSampleCoords = PixelSamples(frame, row, col, width, height);
+    glm::dvec3 color(0, 0, 0);
+
+    // The field of view spans camera.zoom degrees across the shorter side.
+    const double kSpread = glm::radians(double(camera.zoom)) / std::min(width, height);
+
+    for (int sample = 0; sample < kSamples; sample++)
+    {
+        const glm::dvec3 kCoord = kSampleCoords[sample];
+        const RayPath kPath     = sample == 0 && first ? *first : ClassifyRay(kCoord, bh, camera.position);
+        color += Trace(kCoord, kPath, bh, camera.position, skybox, workspace, hit, kSpread) / double(kSamples);
+    }
+    return color;
+}
+
+// Classifies the first sample of each pixel, row * width + col or -1 for none, and returns the order to trace them
+// in: class by class with kRayBatches, else as given.
+std::vector<int> ClassifyPixels(
+    int frame, const std::vector<int>& pixels, int width, int height, std::vector<RayPath>* paths)
+{
+    const int kCount = int(pixels.size());
+    std::vector<dhh::rays::RayClass> classes(kCount, dhh::rays::kSky);
+    std::vector<int> order(kCount);
+    for (int i = 0; i < kCount; ++i)
+    {
+        if (kRayBatches && pixels[i] >= 0)
+        {
+            const int kRow = pixels[i] / width;
+            const int kCol = pixels[i] % width;
+            (*paths)[i]    = ClassifyRay(PixelSamples(frame, kRow, kCol, width, height)[0], bh, camera.position);
+            classes[i]     = (*paths)[i].ray_class;
+        }
+    }
+    dhh::rays::GroupByClass(classes.data(), kCount, order.data());
+    return order;
+}
+
+void Worker(int idx, int frame)
 {
     gsl_integration_workspace* workspace = gsl_integration_workspace_alloc(1000);
+
+    std::vector<int> pixels;
     for (int row = idx; row < kHeight; row += kTotalThreads)
     {
-        if (idx == 0)
-            std::cout << double(row) / kHeight << std::endl;
         for (int col = 0; col < kWidth; ++col)
+            pixels.push_back(row * kWidth + col);
+    }
+    std::vector<RayPath> paths(pixels.size());
+    const std::vector<int> kOrder = ClassifyPixels(frame, pixels, kWidth, kHeight, &paths);
+
+    for (size_t done = 0; done < kOrder.size(); ++done)
+    {
+        if (idx == 0 && done % kWidth == 0)
+            std::cout << double(done) / kOrder.size() << std::endl;
+        const int i          = kOrder[done];
+        const int row        = pixels[i] / kWidth;
+        const int col        = pixels[i] % kWidth;
+        bool hit             = false;
+        const RayPath* kPath = kRayBatches ? &paths[i] : nullptr;
+        glm::dvec3 color     = TracePixel(frame, row, col, kWidth, kHeight, workspace, &hit, kPath) * 255.0;
+        if (hit)
         {
-            glm::dvec3 tex_coord = dhh::camera::GetTexCoord(row, col, kWidth, kHeight, camera);
-            glm::dvec3 color(0, 0, 0);
-            bool hit = false;
+            bloom_buffer[row * kWidth * 3 + col * 3 + 0] = color[0];
+            bloom_buffer[row * kWidth * 3 + col * 3 + 1] = color[1];
+            bloom_buffer[row * kWidth * 3 + col * 3 + 2] = color[2];
+        }
 
-            for (int sample = 0; sample < kSamples; sample++)
-            {
-                glm::dvec3 sample_coord;
-                if (kSamples != 1)
-                    sample_coord = tex_coord + glm::dvec3(uni(rng), uni(rng), uni(rng));
-                else
-                    sample_coord = tex_coord;
-                color += Trace(sample_coord, bh, camera.position, skybox, workspace, &hit) * 255.0 / double(kSamples);
-            }
-            if (hit)
-            {
-                bloom_buffer[row * kWidth * 3 + col * 3 + 0] = color[0];
-                bloom_buffer[row * kWidth * 3 + col * 3 + 1] = color[1];
-                bloom_buffer[row * kWidth * 3 + col * 3 + 2] = color[2];
-            }
+        img[row * kWidth * 3 + col * 3 + 0] = color[0];
+        img[row * kWidth * 3 + col * 3 + 1] = color[1];
+        img[row * kWidth * 3 + col * 3 + 2] = color[2];
 
-            img[row * kWidth * 3 + col * 3 + 0] = color[0];
-            img[row * kWidth * 3 + col * 3 + 1] = color[1];
-            img[row * kWidth * 3 + col * 3 + 2] = color[2];
-        }
+        hdr[row * kWidth * 3 + col * 3 + 0] = color[0] / 255.0;
+        hdr[row * kWidth * 3 + col * 3 + 1] = color[1] / 255.0;
+        hdr[row * kWidth * 3 + col * 3 + 2] = color[2] / 255.0;
     }
 }
 
@@ -107,6 +220,135 @@ void bloom(uint8_t* img, uint8_t* bloom_buffer)
     }
 }
 
+// The sky main() loads, in the same order of precedence. The tile budget only changes what stays resident, but
+// paged tiles and the skybox cache are still told apart.
+std::string SkySource()
+{
+    if (kSkyMap && kSkyMapNside)
+        return std::string("healpix ") + kSkyMap + " " + std::to_string(kSkyMapNside);
+    if (kSkyMap)
+        return std::string("equirect ") + kSkyMap;
+    if (kCompressedSkybox)
+        return std::string("compressed ") + kCompressedSkybox;
+    if (kSkyboxBudget)
+        return "tiled resource/starfield";
+    return "cache resource/starfield";
+}
+
+// Everything a finished frame or tile depends on. A checkpoint is only resumed when this matches.
+dhh::checkpoint::Manifest JobManifest(int width, int height)
+{
+    uint64_t path = dhh::checkpoint::Fingerprint(&camera.position, sizeof(camera.position));
+    path          = dhh::checkpoint::Fingerprint(&camera.front, sizeof(camera.front), path);
+    path          = dhh::checkpoint::Fingerprint(positions.data(), positions.size() * sizeof(glm::vec3), path);
+    path          = dhh::checkpoint::Fingerprint(fronts.data(), fronts.size() * sizeof(glm::vec3), path);
+    path          = dhh::checkpoint::Fingerprint(ups.data(), ups.size() * sizeof(glm::vec3), path);
+
+    return {
+        {"width", std::to_string(width)},
+        {"height", std::to_string(height)},
+        {"samples", std::to_string(kSamples)},
+        {"frames", std::to_string(frames)},
+        {"disk", std::to_string(bh.disk_inner) + " " + std::to_string(bh.disk_outer)},
+        {"camera_path", std::to_string(path)},
+        {"sky", SkySource()},
+        {"background", kBackgroundMovie ? kBackgroundMovie : ""},
+        {"disk_movie", kDiskMovie ? kDiskMovie : ""},
+        {"disk_texture", kDiskTexture ? kDiskTexture : std::to_string(kDiskPeakKelvin)},
+        {"disk_redshift", kDiskRedshift && kDiskPeakKelvin > 0 ? std::to_string(kDiskPeakKelvin) : ""},
+    };
+}
+
+void RenderPoster(const std::string& path, int width, int height, int tile_size)
+{
+    dhh::image::TiledExrWriter writer(path, width, height, tile_size);
+    const std::vector<int> kPending = writer.PendingTiles();
+    std::cout << kPending.size() << " of " << writer.TilesX() * writer.TilesY() << " tiles to render" << std::endl;
+
+    // Each tile is traced with a one pixel border, so the bloom filter sees the same neighbourhood as in a full
+    // frame without keeping the neighbouring tiles around.
+    const int kBorder = 1;
+    const int kSpan   = tile_size + 2 * kBorder;
+
+#pragma omp parallel
+    {
+        gsl_integration_workspace* workspace = gsl_integration_workspace_alloc(1000);
+        std::vector<glm::dvec3> color(kSpan * kSpan), glow(kSpan * kSpan);
+        std::vector<float> tile(tile_size * tile_size * 3);
+        std::vector<int> pixels(kSpan * kSpan);
+        std::vector<RayPath> paths(kSpan * kSpan);
+
+#pragma omp for schedule(dynamic)
+        for (int index = 0; index < int(kPending.size()); ++index)
+        {
+            const int kTileX = kPending[index] % writer.TilesX();
+            const int kTileY = kPending[index] / writer.TilesX();
+            const int kRow0  = kTileY * tile_size - kBorder;
+            const int kCol0  = kTileX * tile_size - kBorder;
+
+            // Pixels are classified by their first sample; the other samples may still take another branch.
+            for (int i = 0; i < kSpan * kSpan; ++i)
+            {
+                const int kRow = kRow0 + i / kSpan;
+                const int kCol = kCol0 + i % kSpan;
+                pixels[i]      = kRow >= 0 && kRow < height && kCol >= 0 && kCol < width ? kRow * width + kCol : -1;
+            }
+
+            for (int i : ClassifyPixels(0, pixels, width, height, &paths))
+            {
+                const int kRow       = kRow0 + i / kSpan;
+                const int kCol       = kCol0 + i % kSpan;
+                bool hit             = false;
+                const RayPath* kPath = kRayBatches ? &paths[i] : nullptr;
+                if (pixels[i] >= 0)
+                    color[i] = TracePixel(0, kRow, kCol, width, height, workspace, &hit, kPath);
+                else
+                    color[i] = glm::dvec3(0);
+                glow[i] = hit ? color[i] : glm::dvec3(0);
+            }
+
+            // Same filter as bloom(): the 3x3 average of the disk pixels replaces the color wherever it is non-zero.
+            for (int y = 0; y < tile_size; ++y)
+            {
+                for (int x = 0; x < tile_size; ++x)
+                {
+                    glm::dvec3 sum(0);
+                    int samples = 0;
+                    for (int i = -1; i <= 1; ++i)
+                    {
+                        for (int j = -1; j <= 1; ++j)
+                        {
+                            const int kRow = kRow0 + kBorder + y + i;
+                            const int kCol = kCol0 + kBorder + x + j;
+                            if (kRow < 0 || kRow >= height || kCol < 0 || kCol >= width)
+                                continue;
+                            sum += glow[(y + kBorder + i) * kSpan + x + kBorder + j];
+                            samples++;
+                        }
+                    }
+
+                    glm::dvec3 pixel = color[(y + kBorder) * kSpan + x + kBorder];
+                    if (samples && glm::length(sum / double(samples)) > 1e-5)
+                        pixel = sum / double(samples);
+
+                    tile[(y * tile_size + x) * 3 + 0] = float(pixel[0]);
+                    tile[(y * tile_size + x) * 3 + 1] = float(pixel[1]);
+                    tile[(y * tile_size + x) * 3 + 2] = float(pixel[2]);
+                }
+            }
+
+            // A tile with sky texels that failed to load stays pending, so a restart traces it again.
+            if (skybox.map->Error().empty())
+                writer.WriteTile(kTileX, kTileY, tile.data(), tile_size * 3 * sizeof(float));
+        }
+        gsl_integration_workspace_free(workspace);
+    }
+
+    if (!skybox.map->Error().empty())
+        throw std::runtime_error(skybox.map->Error());
+    writer.Finish();
+}
+
 void GenerateMovement()
 {
     glm::vec3 pos    = camera.position;
@@ -170,26 +412,113 @@ int main(int argc, char** argv)
     {
         camera.front = glm::vec3(0.1, 0.2, 0.3) - camera.position;
         camera.right = glm::normalize(glm::cross(camera.up, camera.front));
-        LoadSkybox("resource/starfield", skybox);
+        if (kSkyMap && kSkyMapNside)
+            LoadHealpixSkyMap(kSkyMap, kSkyMapNside, skybox);
+        else if (kSkyMap)
+            LoadEquirectSkyMap(kSkyMap, skybox);
+        else if (kCompressedSkybox)
+            LoadCompressedSkybox(kCompressedSkybox, skybox);
+        else if (kSkyboxBudget)
+            LoadTiledSkybox("resource/starfield", skybox, kSkyboxBudget);
+        else
+            LoadSkybox("resource/starfield", skybox);
         bh.disk_inner = 8;
         bh.disk_outer = 18;
         bh.position   = glm::dvec3(0, 0, 0);
         GenerateDiskTexture(bh);
+        if (kDiskTexture)
+            LoadDiskTexture(kDiskTexture, bh);
+        if (kDiskRedshift && kDiskPeakKelvin > 0)
+            GenerateDiskShading(bh, kDiskPeakKelvin);
+        else if (!kDiskTexture && kDiskPeakKelvin > 0)
+            GenerateDiskTemperature(bh, kDiskPeakKelvin);
+
+        if (kPosterWidth && kPosterHeight)
+        {
+            // The tiled file keeps its own journal; the checkpoint makes sure it belongs to the same job.
+            dhh::checkpoint::Checkpoint checkpoint("checkpoint_poster", JobManifest(kPosterWidth, kPosterHeight));
+            RenderPoster((checkpoint.Dir() / "poster.exr").string(), kPosterWidth, kPosterHeight, kPosterTile);
+            return 0;
+        }
 
-        MovieWriter movie("movie", kWidth, kHeight);
+        // Every finished frame is saved as HDR in the checkpoint as soon as it is traced. A restarted job only
+        // traces the frames that are missing and reads the others back from the checkpoint for the movie.
+        dhh::checkpoint::Checkpoint checkpoint("checkpoint", JobManifest(kWidth, kHeight));
+        std::cout << checkpoint.MissingFrames(frames).size() << " of " << frames << " frames to render" << std::endl;
+
+        // Decoded ahead of the tracer, the sky movie at the size of the image it replaces.
+        const std::shared_ptr<const dhh::skybox::SkyMap> kSky = skybox.map;
+        std::unique_ptr<MovieReader> background, disk_movie;
+        if (kBackgroundMovie)
+        {
+            const cv::Size kSize = SkyImageSize(*kSky);
+            background           = std::make_unique<MovieReader>(kBackgroundMovie, kSize.width, kSize.height);
+        }
+        if (kDiskMovie)
+            disk_movie = std::make_unique<MovieReader>(kDiskMovie, kDiskMovieRadial, kDiskMovieAzimuthal);
+
+        // Frames and stills are encoded on a background thread while the next frame is traced.
+        dhh::image::AsyncImageWriter image_writer;
+
+        // The movie is encoded on its own thread while the next frame is traced. Long animations are cut into
+        // five-second segments that are encoded in parallel.
+        EncoderSettings encoder_settings;
+        encoder_settings.segment_frames = frames > 10 * encoder_settings.fps ? 5 * encoder_settings.fps : 0;
+        encoder_settings.progress = [](const EncoderProgress& progress) {
+            std::cout << "Encoded " << progress.frames_encoded << " frames, " << progress.bytes_written / 1024
+                      << " KiB in " << progress.seconds << " s\n";
+        };
+        MovieWriter movie("movie", kWidth, kHeight, encoder_settings);
 
         img          = new uint8_t[kHeight * kWidth * 3]();
         bloom_buffer = new uint8_t[kHeight * kWidth * 3]();
+        hdr          = new float[kHeight * kWidth * 3]();
 
         auto start = std::chrono::high_resolution_clock::now();
 
+        const dhh::camera::Camera kInitialCamera = camera;
         for (int frame = 0; frame < frames; frame++)
         {
+            // The movies keep pace with the frame number, also over frames that are skipped. The sky of the last
+            // frame borrowed the decoder's memory, which the next getFrame() reuses: it is dropped first.
+            skybox.map = kSky;
+            MovieFrame sky_frame, disk_frame;
+            const bool kSkyFrame  = background && background->getFrame(sky_frame);
+            const bool kDiskFrame = disk_movie && disk_movie->getFrame(disk_frame);
+
+            // Frame n is seen from the n-th point of the path, the first one from the initial camera.
+            camera = kInitialCamera;
+            if (frame > 0)
+            {
+                camera.position = positions[frame - 1];
+                camera.front    = fronts[frame - 1];
+                camera.up       = ups[frame - 1];
+                camera.right    = glm::normalize(glm::cross(camera.up, camera.front));
+            }
+
+            if (checkpoint.HasFrame(frame))
+            {
+                int width, height;
+                const std::vector<float> kFrame =
+                    dhh::image::ReadExr(checkpoint.FramePath(frame).string(), width, height);
+                movie.addFrame(kFrame.data());
+                continue;
+            }
+
+            // The sky is traced straight from the decoded frame, which stays put until the threads are joined; the disk
+            // table takes a converted copy.
+            if (kSkyFrame)
+            {
+                skybox.map = ReplaceSkyImage(
+                    kSky, {sky_frame.pixels, int(sky_frame.width), int(sky_frame.height), sky_frame.stride});
+            }
+            if (kDiskFrame)
+                SetDiskImage(bh, disk_frame.pixels, int(disk_frame.width), int(disk_frame.height), disk_frame.stride);
 
             std::vector<std::thread> threads;
             for (int i = 0; i < kTotalThreads; ++i)
             {
-                threads.emplace_back(std::thread(Worker, i));
+                threads.emplace_back(std::thread(Worker, i, frame));
                 // std::cout << "Thread " << i << " has started.\n";
             }
 
@@ -201,19 +530,22 @@ int main(int argc, char** argv)
 
             // bloom(img, bloom_buffer);
 
+            // Sky texels that failed to load read as a placeholder color; such a frame is not kept.
+            if (!skybox.map->Error().empty())
+                throw std::runtime_error(skybox.map->Error());
+
 
             if (!kVideo)
             {
-                stbi_write_png("raytraced.png", kWidth, kHeight, STBI_rgb, img, kWidth * 3);
+                image_writer.Write("raytraced.png", {img, kWidth, kHeight, 0, false});
             }
 
-            movie.addFrame(img);
-
-            camera.position = positions[frame];
-            camera.front    = fronts[frame];
-            camera.up       = ups[frame];
-            camera.right    = glm::normalize(glm::cross(camera.up, camera.front));
+            image_writer.Write(checkpoint.FramePath(frame).string(), {hdr, kWidth, kHeight, 0, true});
+            movie.addFrame(hdr);
         }
+        image_writer.Wait();
+
+        movie.close();
 
         auto end = std::chrono::high_resolution_clock::now();
         std::cout << std::chrono::duration_cast<std::chrono::seconds>(end - start).count() << std::endl;
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+
+namespace dhh::rays
+{
+    // The branches of Trace. Rays of one class run the same integrations and samplers, so tracing them together keeps
+    // a SIMD group or a GPU wave on one path. The values are shared with RAY_CLASS_* in trace.comp.
+    enum RayClass : int
+    {
+        kCaptured  = 0,  // b below the critical impact parameter: falls in, possibly through the disk
+        kSky       = 1,  // turns around outside the disk and only samples the sky
+        kDiskBand  = 2,  // turns around within the disk's radii, crossing its plane on the way in and out
+        kInnerDisk = 3,  // turns around inside the disk's inner edge
+    };
+
+    constexpr int kRayClasses = 4;
+
+    // Same tests as Trace, in the same order. closest_approach is only read for rays that are not captured.
+    inline RayClass Classify(double b, double closest_approach, double disk_inner, double disk_outer)
+    {
+        if (b < std::sqrt(27))
+            return kCaptured;
+        if (closest_approach > disk_outer)
+            return kSky;
+        if (closest_approach < disk_inner)
+            return kInnerDisk;
+        return kDiskBand;
+    }
+
+    // Writes the indices 0 .. count - 1 to order grouped by class, each group in index order, and returns where each
+    // group starts; the last element is count.
+    inline std::array<int, kRayClasses + 1> GroupByClass(const RayClass* classes, int count, int* order)
+    {
+        std::array<int, kRayClasses + 1> starts = {};
+        for (int i = 0; i < count; ++i)
+            ++starts[classes[i] + 1];
+        for (int c = 0; c < kRayClasses; ++c)
+            starts[c + 1] += starts[c];
+
+        std::array<int, kRayClasses> next;
+        for (int c = 0; c < kRayClasses; ++c)
+            next[c] = starts[c];
+        for (int i = 0; i < count; ++i)
+            order[next[classes[i]]++] = i;
+        return starts;
+    }
+}
@@ -0,0 +1,146 @@
+#include "movie.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+MovieReader::MovieReader(const string& filename, const unsigned int width_, const unsigned int height_,
+    size_t prefetch, bool loop_)
+    : width(width_), height(height_), loop(loop_), swsCtx(NULL), fc(NULL), c(NULL), pFrame(NULL), pkt(NULL),
+      ivstream(-1), stride((3 * width_ + 31) & ~size_t(31)), queue(prefetch + 1), current(NULL)
+{
+    // One slot more than prefetch, since the caller holds one while it renders.
+    // Rows are padded to 32 bytes so sws_scale can use its aligned paths.
+    for (size_t i = 0; i < queue.Capacity(); ++i)
+    {
+        queue.Slot(i).pixels.resize(stride * height);
+    }
+
+    if (avformat_open_input(&fc, filename.c_str(), NULL, NULL) < 0)
+        throw runtime_error("MovieReader: cannot open " + filename);
+    if (avformat_find_stream_info(fc, NULL) < 0)
+        throw runtime_error("MovieReader: cannot read stream info of " + filename);
+
+    ivstream = av_find_best_stream(fc, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (ivstream < 0)
+        throw runtime_error("MovieReader: no video stream in " + filename);
+    const AVCodec* codec = avcodec_find_decoder(fc->streams[ivstream]->codecpar->codec_id);
+    if (!codec)
+        throw runtime_error("MovieReader: no decoder for the video of " + filename);
+
+    c = avcodec_alloc_context3(codec);
+    avcodec_parameters_to_context(c, fc->streams[ivstream]->codecpar);
+    c->thread_count = 0;
+    c->thread_type  = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    if (avcodec_open2(c, codec, NULL) < 0)
+        throw runtime_error("MovieReader: cannot open decoder for " + filename);
+
+    pFrame = av_frame_alloc();
+    pkt    = av_packet_alloc();
+
+    thread = std::thread(&MovieReader::decodeLoop, this);
+}
+
+// Scales the decoded picture straight into the slot, in the renderer's BGR24 layout.
+void MovieReader::convert(Picture& picture)
+{
+    swsCtx = sws_getCachedContext(swsCtx, pFrame->width, pFrame->height, (AVPixelFormat) pFrame->format, width,
+        height, AV_PIX_FMT_BGR24, SWS_BILINEAR, NULL, NULL, NULL);
+    if (!swsCtx)
+        throw runtime_error("MovieReader: unsupported pixel format");
+
+    uint8_t* dst[4]     = {picture.pixels.data(), NULL, NULL, NULL};
+    int dst_linesize[4] = {int(stride), 0, 0, 0};
+    sws_scale(swsCtx, pFrame->data, pFrame->linesize, 0, pFrame->height, dst, dst_linesize);
+}
+
+void MovieReader::decodeLoop()
+{
+    try
+    {
+        int64_t index = 0;
+        for (;;)
+        {
+            int ret = avcodec_receive_frame(c, pFrame);
+            if (ret == 0)
+            {
+                // Blocks while the ring is full; stops once the reader is destroyed.
+                Picture* picture = queue.AcquireWrite();
+                if (!picture)
+                    break;
+                convert(*picture);
+                picture->index = index++;
+                queue.CommitWrite();
+                av_frame_unref(pFrame);
+                continue;
+            }
+            if (ret == AVERROR_EOF)
+            {
+                if (!loop || index == 0)
+                    break;
+                // Rewind and decode the movie again.
+                if (av_seek_frame(fc, ivstream, 0, AVSEEK_FLAG_BACKWARD) < 0)
+                    throw runtime_error("MovieReader: cannot rewind");
+                avcodec_flush_buffers(c);
+                continue;
+            }
+            if (ret != AVERROR(EAGAIN))
+                throw runtime_error("MovieReader: decoding failed");
+
+            // The decoder needs more input.
+            if (av_read_frame(fc, pkt) < 0)
+            {
+                // End of file: let the decoder return the frames it still holds.
+                avcodec_send_packet(c, NULL);
+                continue;
+            }
+            if (pkt->stream_index == ivstream)
+                avcodec_send_packet(c, pkt);
+            av_packet_unref(pkt);
+        }
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+    queue.Close();
+}
+
+bool MovieReader::getFrame(MovieFrame& frame, bool wait)
+{
+    // Size() still counts the held slot.
+    const size_t kHeld = current ? 1 : 0;
+    if (!wait && current && queue.Size() == kHeld && !queue.Closed())
+    {
+        frame = {current->pixels.data(), width, height, stride, current->index};
+        return true;
+    }
+
+    if (current)
+        queue.ReleaseRead();
+    current = queue.AcquireRead();
+    if (!current)
+    {
+        // The decoder thread stores its exception before closing the queue.
+        if (error)
+            std::rethrow_exception(error);
+        return false;
+    }
+
+    frame = {current->pixels.data(), width, height, stride, current->index};
+    return true;
+}
+
+MovieReader::~MovieReader()
+{
+    queue.Close();
+    if (thread.joinable())
+        thread.join();
+
+    // Freeing all the allocated memory:
+    sws_freeContext(swsCtx);
+    av_packet_free(&pkt);
+    av_frame_free(&pFrame);
+    avcodec_free_context(&c);
+    avformat_close_input(&fc);
+}
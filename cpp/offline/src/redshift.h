@@ -0,0 +1,144 @@
+#pragma once
+
+#include "disk_texture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace dhh::disk
+{
+    // Axes of the shading table: g linear over [kMinG, kMaxG], the emitted temperature logarithmic over
+    // [kMinKelvin, kMaxKelvin]. The compute shader maps its lookups with the same constants.
+    constexpr double kMinG         = 0;
+    constexpr double kMaxG         = 3;
+    constexpr double kMinKelvin    = 1000;
+    constexpr double kMaxKelvin    = 100000;
+    constexpr int kShadingSize     = 128;
+    constexpr double kVisibleBegin = 380;
+    constexpr double kVisibleEnd   = 780;
+    constexpr double kVisibleStep  = 5;
+
+    // Innermost stable circular orbit of a Schwarzschild black hole, in units of M. A thin disk ends here; between
+    // it and the photon orbit at 3 circular orbits exist but are unstable.
+    constexpr double kIsco = 6;
+
+    // CIE 1931 color matching functions, as the piecewise Gaussian fit of Wyman, Sloan and Shirley (2013).
+    inline void ColorMatching(double nm, double& x, double& y, double& z)
+    {
+        auto lobe = [nm](double mean, double below, double above) {
+            const double kT = (nm - mean) / (nm < mean ? below : above);
+            return std::exp(-0.5 * kT * kT);
+        };
+        x = 1.056 * lobe(599.8, 37.9, 31.0) + 0.362 * lobe(442.0, 16.0, 26.7) - 0.065 * lobe(501.1, 20.4, 26.2);
+        y = 0.821 * lobe(568.8, 46.9, 40.5) + 0.286 * lobe(530.9, 16.3, 31.1);
+        z = 1.217 * lobe(437.0, 11.8, 36.0) + 0.681 * lobe(459.0, 26.0, 13.8);
+    }
+
+    // Spectral radiance of a black body at wavelength nm, without the constant 2hc^2 factor.
+    inline double Planck(double nm, double kelvin)
+    {
+        const double kMeters = nm * 1e-9;
+        return 1 / (std::pow(kMeters, 5) * std::expm1(1.438777e-2 / (kMeters * kelvin)));
+    }
+
+    // Linear sRGB seen from a black body disk element at temperature kelvin whose light reaches the camera with
+    // frequency ratio g = observed / emitted. Gravitational redshift and Doppler beaming both enter through g: the
+    // observed spectrum is g^5 I(g lambda). Baked once; a lookup is one bilinear interpolation, clamped to the table.
+    //
+    // Texels() holds one row per temperature step, to be uploaded as a 2D texture sampled at
+    // ((g - kMinG) / (kMaxG - kMinG), log(kelvin / kMinKelvin) / log(kMaxKelvin / kMinKelvin)) with clamp-to-edge.
+    class ShadingLut
+    {
+    public:
+        // Colors are scaled so that a black body at reference_kelvin, seen with g = 1, has unit luminance.
+        explicit ShadingLut(double reference_kelvin) : texels_(size_t(kShadingSize) * kShadingSize)
+        {
+            double reference[3];
+            Integrate(1, reference_kelvin, reference);
+            const double kScale = reference[1] > 0 ? 1 / reference[1] : 0;
+
+#pragma omp parallel for
+            for (int row = 0; row < kShadingSize; ++row)
+            {
+                const double kKelvin = kMinKelvin * std::pow(kMaxKelvin / kMinKelvin, (row + 0.5) / kShadingSize);
+                for (int col = 0; col < kShadingSize; ++col)
+                {
+                    const double kG = kMinG + (kMaxG - kMinG) * (col + 0.5) / kShadingSize;
+                    double xyz[3];
+                    Integrate(kG, kKelvin, xyz);
+
+                    // XYZ to linear sRGB; colors outside the gamut are clipped.
+                    const double kRed   = 3.2406 * xyz[0] - 1.5372 * xyz[1] - 0.4986 * xyz[2];
+                    const double kGreen = -0.9689 * xyz[0] + 1.8758 * xyz[1] + 0.0415 * xyz[2];
+                    const double kBlue  = 0.0557 * xyz[0] - 0.2040 * xyz[1] + 1.0570 * xyz[2];
+
+                    texels_[size_t(row) * kShadingSize + col] = {float(std::max(kRed, 0.0) * kScale),
+                        float(std::max(kGreen, 0.0) * kScale), float(std::max(kBlue, 0.0) * kScale)};
+                }
+            }
+        }
+
+        const std::vector<Rgb>& Texels() const { return texels_; }
+
+        Rgb Sample(double g, double kelvin) const
+        {
+            // Texel centers sit at (i + 0.5) / kShadingSize on both axes.
+            // Out of range and NaN arguments are moved onto the table first.
+            g               = std::min(kMaxG, std::max(kMinG, g));
+            kelvin          = std::min(kMaxKelvin, std::max(kMinKelvin, kelvin));
+            const double kU = (g - kMinG) / (kMaxG - kMinG);
+            const double kV = std::log(kelvin / kMinKelvin) / std::log(kMaxKelvin / kMinKelvin);
+            const double kX = std::clamp(kU * kShadingSize - 0.5, 0.0, kShadingSize - 1.0);
+            const double kY = std::clamp(kV * kShadingSize - 0.5, 0.0, kShadingSize - 1.0);
+            const int kX0   = std::min(int(kX), kShadingSize - 2);
+            const int kY0   = std::min(int(kY), kShadingSize - 2);
+            const float kFx = float(kX - kX0);
+            const float kFy = float(kY - kY0);
+
+            const Rgb& a = texels_[size_t(kY0) * kShadingSize + kX0];
+            const Rgb& b = texels_[size_t(kY0) * kShadingSize + kX0 + 1];
+            const Rgb& c = texels_[size_t(kY0 + 1) * kShadingSize + kX0];
+            const Rgb& d = texels_[size_t(kY0 + 1) * kShadingSize + kX0 + 1];
+            auto mix     = [&](float Rgb::*channel) {
+                const float kTop    = a.*channel + (b.*channel - a.*channel) * kFx;
+                const float kBottom = c.*channel + (d.*channel - c.*channel) * kFx;
+                return kTop + (kBottom - kTop) * kFy;
+            };
+            return {mix(&Rgb::r), mix(&Rgb::g), mix(&Rgb::b)};
+        }
+
+    private:
+        static void Integrate(double g, double kelvin, double* xyz)
+        {
+            xyz[0] = xyz[1] = xyz[2] = 0;
+            if (g <= 0)
+                return;
+            const double kG5 = std::pow(g, 5);
+            for (double nm = kVisibleBegin; nm <= kVisibleEnd; nm += kVisibleStep)
+            {
+                double x, y, z;
+                ColorMatching(nm, x, y, z);
+                const double kRadiance = kG5 * Planck(g * nm, kelvin) * kVisibleStep;
+                xyz[0] += x * kRadiance;
+                xyz[1] += y * kRadiance;
+                xyz[2] += z * kRadiance;
+            }
+        }
+
+        std::vector<Rgb> texels_;
+    };
+
+    // Frequency ratio g = observed / emitted for light leaving a disk element on a circular Keplerian orbit at radius
+    // r (units of M, Schwarzschild, orbiting counter-clockwise about +y). angular_momentum_y is the y component of
+    // the photon's angular momentum per unit energy, the impact parameter times the y component of the unit normal of
+    // its orbital plane. Inside the photon orbit, where no circular orbit exists, g is 0.
+    inline double RedshiftFactor(double r, double angular_momentum_y)
+    {
+        if (r <= 3)
+            return 0;
+        const double kOmega = 1 / std::sqrt(r * r * r);
+        return std::sqrt(1 - 3 / r) / std::max(1 - kOmega * angular_momentum_y, 1e-6);
+    }
+}
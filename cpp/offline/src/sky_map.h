@@ -0,0 +1,286 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace dhh::skybox
+{
+    constexpr double kPi     = 3.14159265358979323846;
+    constexpr double kHalfPi = kPi / 2;
+    constexpr double kTwoPi  = kPi * 2;
+
+    // Entries of the arctangent table, enough for well under a tenth of a texel of error on a 32k wide map.
+    constexpr size_t kAngleTableSize = 1 << 16;
+
+    // BGR8 pixels owned elsewhere, rows stride bytes apart.
+    struct TexelView
+    {
+        const uint8_t* pixels;
+        int width;
+        int height;
+        size_t stride;
+
+        const uint8_t* Texel(int x, int y) const { return pixels + y * stride + size_t(x) * 3; }
+    };
+
+    // A sky around the scene. Directions are in the tracer's frame, +y up, and need not be normalised.
+    class SkyMap
+    {
+    public:
+        virtual ~SkyMap() = default;
+
+        // BGR texel seen in direction (x, y, z). Lookups run on the tracer's worker threads and never throw.
+        virtual std::array<uint8_t, 3> Texel(double x, double y, double z) const = 0;
+
+        // Texel seen in direction (x, y, z) by a sample that covers footprint radians of the sky. Maps that keep
+        // coarser levels pick one to match; the others sample at full resolution, as does a footprint of 0.
+        virtual std::array<uint8_t, 3> FilteredTexel(double x, double y, double z, double /*footprint*/) const
+        {
+            return Texel(x, y, z);
+        }
+
+        // Whether FilteredTexel() makes use of the footprint, so the tracer only estimates it when it does.
+        virtual bool Filtered() const { return false; }
+
+        // Why some texels could not be loaded, e.g. a tile read from disk on demand, or an empty string. Such texels
+        // read as a placeholder color, so the main thread checks this before keeping a traced image.
+        virtual std::string Error() const { return {}; }
+
+    protected:
+        static std::array<uint8_t, 3> Load(const uint8_t* texel) { return {texel[0], texel[1], texel[2]}; }
+    };
+
+    // atan2 from a table of atan over [0, 1]; the octant is restored with selects rather than branches.
+    class AngleTable
+    {
+    public:
+        AngleTable() : atan_(kAngleTableSize + 1)
+        {
+            for (size_t i = 0; i <= kAngleTableSize; ++i)
+            {
+                atan_[i] = float(std::atan(double(i) / kAngleTableSize));
+            }
+        }
+
+        // In [-pi, pi], as std::atan2.
+        double Atan2(double y, double x) const
+        {
+            const double kAx  = std::abs(x);
+            const double kAy  = std::abs(y);
+            const double kMax = std::max(kAx, kAy);
+            const double kT   = kMax > 0 ? std::min(kAx, kAy) / kMax : 0;
+
+            double angle = atan_[size_t(kT * kAngleTableSize + 0.5)];
+            angle        = kAy > kAx ? kHalfPi - angle : angle;
+            angle        = x < 0 ? kPi - angle : angle;
+            return y < 0 ? -angle : angle;
+        }
+
+    private:
+        std::vector<float> atan_;
+    };
+
+    // One table serves every map.
+    inline const AngleTable& Angles()
+    {
+        static const AngleTable kTable;
+        return kTable;
+    }
+
+    // A sky of six faces in the order of kFaceNames, oriented like the face images read by LoadSkybox: the face is
+    // picked by the dominant axis, and the other two coordinates, in x, y, z order, give the column and the row.
+    // Subclasses only say where the texels of a face are kept.
+    class FaceSkyMap : public SkyMap
+    {
+    public:
+        std::array<uint8_t, 3> Texel(double x, double y, double z) const final
+        {
+            int face;
+            double u, v;
+            Locate(x, y, z, face, u, v);
+            return FaceTexel(face, int(u * (FaceWidth(face) - 1) + 0.5), int(v * (FaceHeight(face) - 1) + 0.5));
+        }
+
+        virtual int FaceWidth(int face) const  = 0;
+        virtual int FaceHeight(int face) const = 0;
+
+        // BGR texel (x, y) of face, both within the face.
+        virtual std::array<uint8_t, 3> FaceTexel(int face, int x, int y) const = 0;
+
+    protected:
+        // The face seen in direction (x, y, z), and where on it as u, v in [0, 1].
+        static void Locate(double x, double y, double z, int& face, double& u, double& v)
+        {
+            // Face for the positive and negative direction of each axis, and the coordinates left on that face.
+            static constexpr int kFace[3][2] = {{5, 4}, {2, 3}, {1, 0}};
+            static constexpr int kColumn[3]  = {1, 0, 0};
+            static constexpr int kRow[3]     = {2, 2, 1};
+
+            const double kDirection[3] = {x, y, z};
+            const double kAx           = std::abs(x);
+            const double kAy           = std::abs(y);
+            const double kAz           = std::abs(z);
+            const int kAxis            = kAx >= kAy && kAx >= kAz ? 0 : kAy >= kAz ? 1 : 2;
+
+            const double kScale = 1 / kDirection[kAxis];
+            face                = kFace[kAxis][kDirection[kAxis] < 0];
+            u                   = std::clamp((kDirection[kColumn[kAxis]] * kScale + 1) / 2, 0.0, 1.0);
+            v                   = std::clamp((kDirection[kRow[kAxis]] * kScale + 1) / 2, 0.0, 1.0);
+        }
+    };
+
+    // Six faces held in memory as BGR8 images.
+    class CubeSkyMap : public FaceSkyMap
+    {
+    public:
+        CubeSkyMap(const std::array<TexelView, 6>& faces, std::shared_ptr<const void> storage)
+            : faces_(faces), storage_(std::move(storage))
+        {
+        }
+
+        int FaceWidth(int face) const override { return faces_[face].width; }
+        int FaceHeight(int face) const override { return faces_[face].height; }
+        std::array<uint8_t, 3> FaceTexel(int face, int x, int y) const override
+        {
+            return Load(faces_[face].Texel(x, y));
+        }
+
+    private:
+        std::array<TexelView, 6> faces_;
+        std::shared_ptr<const void> storage_;
+    };
+
+    // Another face sky with one face swapped for an image, e.g. a movie frame. The image need not match the size of
+    // the face it replaces.
+    class ReplacedFaceSkyMap : public FaceSkyMap
+    {
+    public:
+        ReplacedFaceSkyMap(std::shared_ptr<const FaceSkyMap> base, int face, const TexelView& image,
+            std::shared_ptr<const void> storage)
+            : base_(std::move(base)), face_(face), image_(image), storage_(std::move(storage))
+        {
+        }
+
+        int FaceWidth(int face) const override { return face == face_ ? image_.width : base_->FaceWidth(face); }
+        int FaceHeight(int face) const override { return face == face_ ? image_.height : base_->FaceHeight(face); }
+        std::array<uint8_t, 3> FaceTexel(int face, int x, int y) const override
+        {
+            return face == face_ ? Load(image_.Texel(x, y)) : base_->FaceTexel(face, x, y);
+        }
+        std::string Error() const override { return base_->Error(); }
+
+    private:
+        std::shared_ptr<const FaceSkyMap> base_;
+        int face_;
+        TexelView image_;
+        std::shared_ptr<const void> storage_;
+    };
+
+    // Latitude-longitude map: columns span the longitude atan2(x, z) from -pi to pi, rows the latitude from +y
+    // (north) to -y.
+    class EquirectSkyMap : public SkyMap
+    {
+    public:
+        EquirectSkyMap(const TexelView& image, std::shared_ptr<const void> storage)
+            : image_(image),
+              storage_(std::move(storage)),
+              column_scale_(image.width / kTwoPi),
+              row_scale_(image.height / kPi)
+        {
+        }
+
+        const TexelView& Image() const { return image_; }
+
+        std::array<uint8_t, 3> Texel(double x, double y, double z) const override
+        {
+            const double kLongitude = angles_.Atan2(x, z);
+            const double kLatitude  = angles_.Atan2(y, std::sqrt(x * x + z * z));
+            const int kColumn       = std::min(int((kLongitude + kPi) * column_scale_), image_.width - 1);
+            const int kRow          = std::min(int((kHalfPi - kLatitude) * row_scale_), image_.height - 1);
+            return Load(image_.Texel(kColumn, kRow));
+        }
+
+    private:
+        TexelView image_;
+        std::shared_ptr<const void> storage_;
+        const AngleTable& angles_ = Angles();
+        double column_scale_;
+        double row_scale_;
+    };
+
+    // HEALPix map in RING ordering, with +y as the pole and the azimuth atan2(z, x). The 12 * nside^2 pixels are read
+    // in row-major order from the image, so any image holding the ring-ordered pixel array will do.
+    class HealpixSkyMap : public SkyMap
+    {
+    public:
+        HealpixSkyMap(int nside, const TexelView& pixels, std::shared_ptr<const void> storage)
+            : nside_(nside), pixels_(pixels), storage_(std::move(storage)), ring_start_(4 * size_t(nside) + 1)
+        {
+            if (nside <= 0 || size_t(pixels.width) * pixels.height < 12 * size_t(nside) * nside)
+                throw std::runtime_error("HEALPix map has fewer than 12 * nside^2 pixels");
+
+            // First pixel of each ring, rings numbered from 1 at the north pole to 4 * nside - 1 at the south pole.
+            size_t start = 0;
+            for (int ring = 1; ring < 4 * nside; ++ring)
+            {
+                ring_start_[ring] = start;
+                start += 4 * size_t(std::min({ring, nside, 4 * nside - ring}));
+            }
+        }
+
+        int Nside() const { return nside_; }
+        const TexelView& Pixels() const { return pixels_; }
+
+        std::array<uint8_t, 3> Texel(double x, double y, double z) const override
+        {
+            const double kLength = std::sqrt(x * x + y * y + z * z);
+            const double kZ      = y / kLength;
+            const double kZa     = std::abs(kZ);
+            double phi           = angles_.Atan2(z, x);
+            phi                  = phi < 0 ? phi + kTwoPi : phi;
+            const double kTt     = std::min(phi / kHalfPi, 4 - 1e-9);
+
+            int ring, index;
+            if (kZa <= 2.0 / 3)
+            {
+                // Equatorial belt.
+                const double kTemp1 = nside_ * (0.5 + kTt);
+                const double kTemp2 = nside_ * kZ * 0.75;
+                const int kJp       = int(kTemp1 - kTemp2);
+                const int kJm       = int(kTemp1 + kTemp2);
+                const int kBelt     = nside_ + 1 + kJp - kJm;
+                const int kShift    = 1 - (kBelt & 1);
+                ring                = nside_ - 1 + kBelt;
+                index               = ((kJp + kJm - nside_ + kShift + 1) / 2) % (4 * nside_);
+            }
+            else
+            {
+                // Polar caps.
+                const double kTp  = kTt - int(kTt);
+                const double kTmp = nside_ * std::sqrt(3 * (kLength - std::abs(y)) / kLength);
+                const int kJp     = std::min(int(kTp * kTmp), nside_ - 1);
+                const int kJm     = std::min(int((1 - kTp) * kTmp), nside_ - 1);
+                const int kRing   = kJp + kJm + 1;
+                ring              = kZ > 0 ? kRing : 4 * nside_ - kRing;
+                index             = int(kTt * kRing) % (4 * kRing);
+            }
+
+            const size_t kPixel = ring_start_[ring] + index;
+            return Load(pixels_.Texel(int(kPixel % pixels_.width), int(kPixel / pixels_.width)));
+        }
+
+    private:
+        int nside_;
+        TexelView pixels_;
+        std::shared_ptr<const void> storage_;
+        const AngleTable& angles_ = Angles();
+        std::vector<size_t> ring_start_;
+    };
+}
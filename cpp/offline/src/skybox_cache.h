@@ -0,0 +1,227 @@
+#pragma once
+
+#include "jpeg_reader.h"
+#include "mapped_file.h"
+#include "tiled_skybox.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace dhh::skybox
+{
+    // Cube faces in the order of the cache file, named after their source images.
+    constexpr std::array<const char*, 6> kFaceNames = {"front", "back", "top", "bottom", "left", "right"};
+
+    constexpr char kCacheMagic[8]   = {'D', 'H', 'H', 'S', 'K', 'Y', '\0', '\0'};
+    constexpr uint32_t kCacheVersion = 2;
+
+    // Fixed-size header at the start of a cache file. Texels follow as tightly packed BGR8 rows, the layout of a
+    // cv::imread image, one block per face at the source resolution.
+    struct CacheHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+
+        // Size and modification time of each source image, to detect a stale cache.
+        uint64_t source_size[6];
+        int64_t source_time[6];
+
+        uint32_t width[6];
+        uint32_t height[6];
+        uint64_t offset[6];
+    };
+
+    inline std::filesystem::path FacePath(const std::filesystem::path& dir, int face)
+    {
+        return dir / (std::string(kFaceNames[face]) + ".jpg");
+    }
+
+    inline int64_t SourceTime(const std::filesystem::path& path)
+    {
+        return int64_t(std::filesystem::last_write_time(path).time_since_epoch().count());
+    }
+
+    // Whether the images in dir are the ones a preprocessed file was built from. Missing images are accepted, so a
+    // preprocessed file can be shipped without its sources.
+    inline bool SourcesMatch(const std::filesystem::path& dir, const uint64_t (&size)[6], const int64_t (&time)[6])
+    {
+        std::error_code error;
+        for (int face = 0; face < 6; ++face)
+        {
+            const std::filesystem::path kSource = FacePath(dir, face);
+            if (!std::filesystem::exists(kSource, error))
+                continue;
+            if (std::filesystem::file_size(kSource, error) != size[face] || SourceTime(kSource) != time[face])
+                return false;
+        }
+        return true;
+    }
+
+    // A preprocessed cubemap, mapped straight from disk. Faces are cv::Mat headers over the mapping, so opening
+    // decodes and copies nothing.
+    class SkyboxCache
+    {
+    public:
+        // Decodes the six faces of dir in parallel and writes them to cache.
+        static void Build(const std::filesystem::path& dir, const std::filesystem::path& cache)
+        {
+            std::array<cv::Mat, 6> faces;
+            std::atomic<bool> missing(false);
+
+#pragma omp parallel for schedule(dynamic)
+            for (int face = 0; face < 6; ++face)
+            {
+                faces[face] = cv::imread(FacePath(dir, face).string(), cv::IMREAD_COLOR);
+                if (faces[face].empty())
+                    missing = true;
+            }
+            if (missing)
+                throw std::runtime_error("cannot decode the skybox in " + dir.string());
+
+            CacheHeader header = {};
+            std::memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+            header.version = kCacheVersion;
+
+            uint64_t offset = sizeof(CacheHeader);
+            for (int face = 0; face < 6; ++face)
+            {
+                header.source_size[face] = std::filesystem::file_size(FacePath(dir, face));
+                header.source_time[face] = SourceTime(FacePath(dir, face));
+                header.width[face]       = uint32_t(faces[face].cols);
+                header.height[face]      = uint32_t(faces[face].rows);
+                header.offset[face]      = offset;
+                offset += uint64_t(faces[face].cols) * faces[face].rows * 3;
+            }
+
+            // Written under a temporary name, so an interrupted build never leaves a cache that looks valid.
+            const std::filesystem::path kPartial = cache.string() + ".part";
+            {
+                std::ofstream out(kPartial, std::ios::binary | std::ios::trunc);
+                out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                for (const cv::Mat& image : faces)
+                {
+                    for (int row = 0; row < image.rows; ++row)
+                    {
+                        out.write(reinterpret_cast<const char*>(image.ptr(row)), std::streamsize(image.cols) * 3);
+                    }
+                }
+                if (!out)
+                    throw std::runtime_error("cannot write " + kPartial.string());
+            }
+            std::filesystem::rename(kPartial, cache);
+        }
+
+        // Maps cache if it is complete and was built from the current images in dir. Returns nullptr otherwise.
+        static std::unique_ptr<SkyboxCache> Open(const std::filesystem::path& cache, const std::filesystem::path& dir)
+        {
+            std::error_code error;
+            if (!std::filesystem::exists(cache, error)
+                || std::filesystem::file_size(cache, error) < sizeof(CacheHeader))
+            {
+                return nullptr;
+            }
+
+            std::unique_ptr<SkyboxCache> result(new SkyboxCache(cache));
+            const CacheHeader& header = *result->header_;
+            if (std::memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) != 0 || header.version != kCacheVersion)
+                return nullptr;
+
+            if (!SourcesMatch(dir, header.source_size, header.source_time))
+                return nullptr;
+            for (int face = 0; face < 6; ++face)
+            {
+                const uint64_t kEnd = header.offset[face] + uint64_t(header.width[face]) * header.height[face] * 3;
+                if (kEnd > result->file_.Size())
+                    return nullptr;
+            }
+            return result;
+        }
+
+        // Opens the cache next to the images in dir, building it first if it is missing or stale.
+        static std::unique_ptr<SkyboxCache> OpenOrBuild(const std::filesystem::path& dir)
+        {
+            const std::filesystem::path kCache = dir / "skybox.cache";
+            std::unique_ptr<SkyboxCache> cache = Open(kCache, dir);
+            if (!cache)
+            {
+                Build(dir, kCache);
+                cache = Open(kCache, dir);
+            }
+            if (!cache)
+                throw std::runtime_error("cannot open " + kCache.string());
+            return cache;
+        }
+
+        // Read-only view of one face; valid as long as the cache is alive.
+        cv::Mat Face(int face) const
+        {
+            return cv::Mat(int(header_->height[face]), int(header_->width[face]), CV_8UC3,
+                const_cast<uint8_t*>(file_.Data() + header_->offset[face]));
+        }
+
+    private:
+        explicit SkyboxCache(const std::filesystem::path& cache)
+            : file_(cache), header_(reinterpret_cast<const CacheHeader*>(file_.Data()))
+        {
+        }
+
+        io::MappedFile file_;
+        const CacheHeader* header_;
+    };
+
+    // Converts the faces of dir into a tiled skybox at path. Faces are decoded a strip of tile_size rows at a time
+    // and cut into tiles as they come, each coarser level box filtered from the rows as they stream, so building
+    // holds about two rows of tiles whatever the size of the sky.
+    inline void BuildTiledSkybox(const std::filesystem::path& dir, const std::filesystem::path& path, int tile_size)
+    {
+        TiledSkyboxWriter writer(path, tile_size);
+        for (int face = 0; face < 6; ++face)
+        {
+            const std::filesystem::path kSource = FacePath(dir, face);
+            image::JpegStripReader reader(kSource.string());
+            writer.SetSource(face, std::filesystem::file_size(kSource), SourceTime(kSource));
+            writer.BeginFace(face, reader.Width(), reader.Height());
+
+            const size_t kStride = size_t(reader.Width()) * 3;
+            std::vector<uint8_t> strip(kStride * tile_size);
+            while (const int kRows = reader.ReadRows(strip.data(), tile_size, kStride))
+            {
+                writer.AddRows(strip.data(), kRows, kStride);
+            }
+        }
+        writer.Finish();
+    }
+
+    // Opens dir/skybox.tiles with budget bytes of resident tiles, building it first if it is missing or stale.
+    inline std::unique_ptr<TiledSkybox> OpenOrBuildTiledSkybox(
+        const std::filesystem::path& dir, size_t budget, int tile_size = 256)
+    {
+        const std::filesystem::path kPath = dir / "skybox.tiles";
+        if (std::filesystem::exists(kPath))
+        {
+            // Files from before the coarser levels were stored hold level 0 only, and are rebuilt.
+            auto tiled = std::make_unique<TiledSkybox>(kPath, budget);
+            if (SourcesMatch(dir, tiled->Header().source_size, tiled->Header().source_time)
+                && tiled->TileSize() == tile_size
+                && tiled->Levels() == MipLevels(tiled->Width(0), tiled->Height(0)))
+            {
+                return tiled;
+            }
+        }
+        BuildTiledSkybox(dir, kPath, tile_size);
+        return std::make_unique<TiledSkybox>(kPath, budget);
+    }
+}
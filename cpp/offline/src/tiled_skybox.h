@@ -0,0 +1,494 @@
+#pragma once
+
+#include "sky_map.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dhh::skybox
+{
+    constexpr char kTiledMagic[8]      = {'D', 'H', 'H', 'T', 'I', 'L', 'E', '\0'};
+    constexpr uint32_t kTiledVersion   = 1;
+    constexpr int kMaxTiledLevels      = 16;
+    constexpr size_t kDefaultTileShards= 64;
+
+    // What a texel reads as when its tile cannot be loaded; see TiledSkybox::Error().
+    constexpr std::array<uint8_t, 3> kMissingTexel = {255, 0, 255};
+
+    // Fixed-size header at the start of a tiled skybox file. Each face level is cut into tile_size x tile_size tiles
+    // of BGR8 texels, stored row by row starting at offset. Tiles on the right and bottom edge are padded by
+    // repeating the last texel, so every tile has the same size and position in the file.
+    struct TiledHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t tile_size;
+        uint32_t levels;
+        uint32_t reserved;
+
+        // Size and modification time of each source image, to detect a stale file.
+        uint64_t source_size[6];
+        int64_t source_time[6];
+
+        uint32_t width[6][kMaxTiledLevels];
+        uint32_t height[6][kMaxTiledLevels];
+        uint64_t offset[6][kMaxTiledLevels];
+    };
+
+    inline int Seek(FILE* file, uint64_t offset)
+    {
+#ifdef _WIN32
+        return _fseeki64(file, int64_t(offset), SEEK_SET);
+#else
+        return fseeko(file, off_t(offset), SEEK_SET);
+#endif
+    }
+
+    // Number of levels in the chain of a width x height face, halving down to 1 x 1 or kMaxTiledLevels.
+    inline int MipLevels(int width, int height)
+    {
+        int levels = 1;
+        for (; (width > 1 || height > 1) && levels < kMaxTiledLevels; ++levels)
+        {
+            width  = std::max(width / 2, 1);
+            height = std::max(height / 2, 1);
+        }
+        return levels;
+    }
+
+    // Writes a tiled skybox one face at a time, and each level one row of tiles at a time, so building it never
+    // needs more than a strip of tile_size rows per level in memory. The file only appears under its name once
+    // Finish() succeeds.
+    class TiledSkyboxWriter
+    {
+    public:
+        TiledSkyboxWriter(const std::filesystem::path& path, int tile_size)
+            : path_(path), partial_(path.string() + ".part"), tile_size_(tile_size), header_()
+        {
+            if (tile_size_ <= 0)
+                throw std::runtime_error("invalid tile size");
+            file_ = std::fopen(partial_.string().c_str(), "wb");
+            if (!file_)
+                throw std::runtime_error("cannot open " + partial_.string());
+
+            std::memcpy(header_.magic, kTiledMagic, sizeof(kTiledMagic));
+            header_.version   = kTiledVersion;
+            header_.tile_size = uint32_t(tile_size_);
+            std::fwrite(&header_, sizeof(header_), 1, file_);
+            offset_ = sizeof(header_);
+        }
+
+        TiledSkyboxWriter(const TiledSkyboxWriter&) = delete;
+        TiledSkyboxWriter& operator=(const TiledSkyboxWriter&) = delete;
+
+        void SetSource(int face, uint64_t size, int64_t time)
+        {
+            header_.source_size[face] = size;
+            header_.source_time[face] = time;
+        }
+
+        // Appends the next level of face, BGR8 rows stride bytes apart. Levels of a face are added in order.
+        void AddLevel(int face, const uint8_t* pixels, int width, int height, size_t stride)
+        {
+            BeginLevel(face, width, height);
+            AddRows(pixels, height, stride);
+        }
+
+        // Starts the next level of face; its rows follow through AddRows().
+        void BeginLevel(int face, int width, int height) { Begin(face, width, height, 1); }
+
+        // Starts face at full resolution, width x height; its rows follow through AddRows(). Every coarser level
+        // down to MipLevels() is box filtered from them as they come.
+        void BeginFace(int face, int width, int height) { Begin(face, width, height, MipLevels(width, height)); }
+
+        // Appends the next rows of what was begun last. A row of tiles is written out as soon as its rows are in.
+        void AddRows(const uint8_t* pixels, int rows, size_t stride)
+        {
+            if (streams_.empty() || rows > streams_[0].rows_left)
+                throw std::runtime_error("more skybox rows than the level holds");
+            for (int y = 0; y < rows; ++y)
+            {
+                AddRow(0, pixels + y * stride);
+            }
+        }
+
+        void Finish()
+        {
+            CheckComplete();
+            header_.levels = uint32_t(levels_[0]);
+            if (levels_[0] == 0 || std::count(levels_.begin(), levels_.end(), levels_[0]) != 6)
+                throw std::runtime_error("skybox faces differ in their number of levels");
+
+            const bool kWritten =
+                Seek(file_, 0) == 0 && std::fwrite(&header_, sizeof(header_), 1, file_) == 1 && std::fclose(file_) == 0;
+            file_ = nullptr;
+            if (!kWritten)
+                throw std::runtime_error("cannot write " + partial_.string());
+            std::filesystem::rename(partial_, path_);
+        }
+
+        ~TiledSkyboxWriter()
+        {
+            if (file_)
+            {
+                std::fclose(file_);
+                std::remove(partial_.string().c_str());
+            }
+        }
+
+    private:
+        // A level being written: its size, the rows still to come, the rows buffered towards its next row of tiles,
+        // and the sums of the rows that make up the pending row of the level below it.
+        struct Stream
+        {
+            int width;
+            int height;
+            int rows_left;
+            int strip_rows;
+            int tile_rows;
+            uint64_t offset;
+            std::vector<uint8_t> strip;
+            std::vector<uint32_t> sums;
+            int summed_rows;
+        };
+
+        void CheckComplete() const
+        {
+            for (const Stream& stream : streams_)
+            {
+                if (stream.rows_left != 0)
+                    throw std::runtime_error("skybox level is missing rows");
+            }
+        }
+
+        // Reserves levels of face starting at width x height, each half the size of the one before.
+        void Begin(int face, int width, int height, int levels)
+        {
+            CheckComplete();
+            if (width <= 0 || height <= 0)
+                throw std::runtime_error("invalid skybox level size");
+            if (levels_[face] + levels > kMaxTiledLevels)
+                throw std::runtime_error("too many skybox levels");
+
+            streams_.clear();
+            for (int i = 0; i < levels; ++i)
+            {
+                const int kLevel             = levels_[face]++;
+                const int kTilesX            = (width + tile_size_ - 1) / tile_size_;
+                const int kTilesY            = (height + tile_size_ - 1) / tile_size_;
+                header_.width[face][kLevel]  = uint32_t(width);
+                header_.height[face][kLevel] = uint32_t(height);
+                header_.offset[face][kLevel] = offset_;
+                streams_.push_back({width, height, height, 0, 0, offset_, {}, {}, 0});
+                streams_.back().strip.resize(size_t(width) * tile_size_ * 3);
+                offset_ += uint64_t(kTilesX) * kTilesY * tile_size_ * tile_size_ * 3;
+
+                width  = std::max(width / 2, 1);
+                height = std::max(height / 2, 1);
+                if (i + 1 < levels)
+                    streams_.back().sums.resize(size_t(width) * 3);
+            }
+        }
+
+        // Buffers row of level i and folds it into the row of level i + 1 it belongs to. Texels of an odd last row
+        // or column go into the last texel below them, so every texel of the level is counted.
+        void AddRow(size_t i, const uint8_t* row)
+        {
+            Stream& stream = streams_[i];
+            const int kY   = stream.height - stream.rows_left;
+            std::memcpy(&stream.strip[size_t(stream.strip_rows++) * stream.width * 3], row, size_t(stream.width) * 3);
+            if (--stream.rows_left == 0 || stream.strip_rows == tile_size_)
+                WriteStrip(stream);
+            if (i + 1 == streams_.size())
+                return;
+
+            const Stream& next = streams_[i + 1];
+            for (int x = 0; x < stream.width; ++x)
+            {
+                uint32_t* sum = &stream.sums[size_t(std::min(x / 2, next.width - 1)) * 3];
+                for (int c = 0; c < 3; ++c)
+                {
+                    sum[c] += row[x * 3 + c];
+                }
+            }
+            ++stream.summed_rows;
+            if ((kY % 2 == 0 || kY / 2 >= next.height - 1) && stream.rows_left != 0)
+                return;
+
+            std::vector<uint8_t> filtered(size_t(next.width) * 3);
+            for (int x = 0; x < next.width; ++x)
+            {
+                const int kColumns    = x == next.width - 1 ? stream.width - 2 * x : 2;
+                const uint32_t kCount = uint32_t(kColumns * stream.summed_rows);
+                for (int c = 0; c < 3; ++c)
+                {
+                    filtered[size_t(x) * 3 + c] = uint8_t((stream.sums[size_t(x) * 3 + c] + kCount / 2) / kCount);
+                }
+            }
+            std::fill(stream.sums.begin(), stream.sums.end(), 0);
+            stream.summed_rows = 0;
+            AddRow(i + 1, filtered.data());
+        }
+
+        // Cuts the buffered rows into tiles. The last strip of a level may be short; it and the last column of tiles
+        // are padded by repeating the last texel.
+        void WriteStrip(Stream& stream)
+        {
+            const int kTilesX = (stream.width + tile_size_ - 1) / tile_size_;
+            std::vector<uint8_t> tile(size_t(tile_size_) * tile_size_ * 3);
+            if (Seek(file_, stream.offset + uint64_t(stream.tile_rows) * kTilesX * tile.size()) != 0)
+                throw std::runtime_error("cannot write " + partial_.string());
+            for (int tile_x = 0; tile_x < kTilesX; ++tile_x)
+            {
+                for (int y = 0; y < tile_size_; ++y)
+                {
+                    const uint8_t* src = &stream.strip[size_t(std::min(y, stream.strip_rows - 1)) * stream.width * 3];
+                    uint8_t* dst       = &tile[size_t(y) * tile_size_ * 3];
+                    for (int x = 0; x < tile_size_; ++x)
+                    {
+                        std::memcpy(dst + x * 3, src + std::min(tile_x * tile_size_ + x, stream.width - 1) * 3, 3);
+                    }
+                }
+                if (std::fwrite(tile.data(), tile.size(), 1, file_) != 1)
+                    throw std::runtime_error("cannot write " + partial_.string());
+            }
+            ++stream.tile_rows;
+            stream.strip_rows = 0;
+        }
+
+        const std::filesystem::path path_;
+        const std::filesystem::path partial_;
+        const int tile_size_;
+        TiledHeader header_;
+        std::array<int, 6> levels_ = {};
+        uint64_t offset_           = 0;
+        FILE* file_;
+
+        // The levels being written, finest first; all but the last feed the one after them.
+        std::vector<Stream> streams_;
+    };
+
+    // A tiled skybox paged in on demand. Tiles are read from disk the first time they are sampled and kept in a
+    // bounded cache, so memory follows the part of the sky a frame actually sees rather than the source size.
+    //
+    // The cache is split into shards by tile, each with its own lock, LRU list and file handle; threads only
+    // contend when they touch tiles of the same shard, and a miss only stalls its own shard while it reads.
+    class TiledSkybox
+    {
+    public:
+        using Tile = std::shared_ptr<const std::vector<uint8_t>>;
+
+        // Keeps about budget bytes of tiles resident, at least one tile per shard.
+        TiledSkybox(const std::filesystem::path& path, size_t budget, size_t shards = kDefaultTileShards)
+            : id_(NextId()), header_()
+        {
+            FILE* file = std::fopen(path.string().c_str(), "rb");
+            if (!file)
+                throw std::runtime_error("cannot open " + path.string());
+            const bool kRead = std::fread(&header_, sizeof(header_), 1, file) == 1;
+            std::fclose(file);
+            if (!kRead || std::memcmp(header_.magic, kTiledMagic, sizeof(kTiledMagic)) != 0
+                || header_.version != kTiledVersion || header_.tile_size == 0 || header_.levels == 0
+                || header_.levels > kMaxTiledLevels)
+            {
+                throw std::runtime_error(path.string() + " is not a tiled skybox");
+            }
+
+            tile_bytes_     = size_t(header_.tile_size) * header_.tile_size * 3;
+            shard_capacity_ = std::max<size_t>(1, budget / tile_bytes_ / shards);
+            for (size_t i = 0; i < shards; ++i)
+            {
+                shards_.emplace_back(new Shard);
+                shards_.back()->file = std::fopen(path.string().c_str(), "rb");
+                if (!shards_.back()->file)
+                    throw std::runtime_error("cannot open " + path.string());
+            }
+        }
+
+        TiledSkybox(const TiledSkybox&) = delete;
+        TiledSkybox& operator=(const TiledSkybox&) = delete;
+
+        const TiledHeader& Header() const { return header_; }
+        int TileSize() const { return int(header_.tile_size); }
+        int Levels() const { return int(header_.levels); }
+        int Width(int face, int level = 0) const { return int(header_.width[face][level]); }
+        int Height(int face, int level = 0) const { return int(header_.height[face][level]); }
+
+        // Returns the tile, reading it if it is not resident. The tile stays valid while it is held, even if the
+        // cache evicts it meanwhile. Called from the tracer's worker threads, so a tile that cannot be read is not
+        // thrown: it is recorded for Error() and nullptr is returned.
+        Tile GetTile(int face, int level, int tile_x, int tile_y)
+        {
+            const uint64_t kKey = Key(face, level, tile_x, tile_y);
+            Shard& shard        = *shards_[Mix(kKey) % shards_.size()];
+
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto found = shard.tiles.find(kKey);
+            if (found != shard.tiles.end())
+            {
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                shard.lru.splice(shard.lru.begin(), shard.lru, found->second.second);
+                return found->second.first;
+            }
+
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            try
+            {
+                auto texels                = std::make_shared<std::vector<uint8_t>>(tile_bytes_);
+                const int kTilesX          = (Width(face, level) + TileSize() - 1) / TileSize();
+                const uint64_t kTileOffset =
+                    header_.offset[face][level] + (uint64_t(tile_y) * kTilesX + tile_x) * tile_bytes_;
+                if (Seek(shard.file, kTileOffset) != 0 || std::fread(texels->data(), tile_bytes_, 1, shard.file) != 1)
+                    throw std::runtime_error("cannot read skybox tile " + std::to_string(tile_x) + ", "
+                                             + std::to_string(tile_y) + " of face " + std::to_string(face));
+
+                if (shard.tiles.size() >= shard_capacity_)
+                {
+                    shard.tiles.erase(shard.lru.back());
+                    shard.lru.pop_back();
+                    resident_.fetch_sub(1, std::memory_order_relaxed);
+                }
+                shard.lru.push_front(kKey);
+                shard.tiles.emplace(kKey, std::make_pair(Tile(texels), shard.lru.begin()));
+                resident_.fetch_add(1, std::memory_order_relaxed);
+                return texels;
+            }
+            catch (const std::exception& e)
+            {
+                std::lock_guard<std::mutex> error_lock(error_mutex_);
+                if (error_.empty())
+                    error_ = e.what();
+                return nullptr;
+            }
+        }
+
+        // The first tile that could not be read, or an empty string. The main thread checks this after tracing;
+        // until then the texels of such a tile read as kMissingTexel.
+        std::string Error() const
+        {
+            std::lock_guard<std::mutex> lock(error_mutex_);
+            return error_;
+        }
+
+        // BGR texel of a face level. Each thread remembers the last tile it sampled, so runs of lookups in the same
+        // tile take no lock; that tile may outlive its eviction until the thread moves on.
+        std::array<uint8_t, 3> Texel(int face, int level, int x, int y)
+        {
+            struct LastTile
+            {
+                uint64_t owner = 0;
+                uint64_t key   = ~uint64_t(0);
+                Tile tile;
+            };
+            thread_local LastTile last;
+
+            const int kTile     = TileSize();
+            const uint64_t kKey = Key(face, level, x / kTile, y / kTile);
+            if (last.owner != id_ || last.key != kKey)
+            {
+                Tile tile = GetTile(face, level, x / kTile, y / kTile);
+                if (!tile)
+                    return kMissingTexel;
+                last.tile  = std::move(tile);
+                last.owner = id_;
+                last.key   = kKey;
+            }
+            const uint8_t* texel = last.tile->data() + (size_t(y % kTile) * kTile + x % kTile) * 3;
+            return {texel[0], texel[1], texel[2]};
+        }
+
+        size_t ResidentBytes() const { return resident_.load(std::memory_order_relaxed) * tile_bytes_; }
+        uint64_t Hits() const { return hits_.load(std::memory_order_relaxed); }
+        uint64_t Misses() const { return misses_.load(std::memory_order_relaxed); }
+
+    private:
+        struct Shard
+        {
+            std::mutex mutex;
+            std::list<uint64_t> lru;
+            std::unordered_map<uint64_t, std::pair<Tile, std::list<uint64_t>::iterator>> tiles;
+            FILE* file = nullptr;
+
+            ~Shard()
+            {
+                if (file)
+                    std::fclose(file);
+            }
+        };
+
+        static uint64_t NextId()
+        {
+            static std::atomic<uint64_t> next(1);
+            return next.fetch_add(1);
+        }
+
+        static uint64_t Key(int face, int level, int tile_x, int tile_y)
+        {
+            return uint64_t(face) << 56 | uint64_t(level) << 48 | uint64_t(tile_y) << 24 | uint64_t(tile_x);
+        }
+
+        // Spreads neighbouring tiles over different shards.
+        static uint64_t Mix(uint64_t key)
+        {
+            key ^= key >> 33;
+            key *= 0xff51afd7ed558ccdull;
+            key ^= key >> 33;
+            return key;
+        }
+
+        const uint64_t id_;
+        TiledHeader header_;
+        size_t tile_bytes_;
+        size_t shard_capacity_;
+        std::vector<std::unique_ptr<Shard>> shards_;
+        std::atomic<size_t> resident_{0};
+        std::atomic<uint64_t> hits_{0};
+        std::atomic<uint64_t> misses_{0};
+        mutable std::mutex error_mutex_;
+        std::string error_;
+    };
+
+    // The sky behind a tiled skybox. Texel() samples the full resolution; FilteredTexel() the level whose texels
+    // are about as wide as the footprint, so rays that each cover much of the sky neither alias nor page in tiles
+    // of level 0 for one texel each.
+    class TiledSkyMap : public FaceSkyMap
+    {
+    public:
+        explicit TiledSkyMap(std::shared_ptr<TiledSkybox> tiled) : tiled_(std::move(tiled)) {}
+
+        int FaceWidth(int face) const override { return tiled_->Width(face); }
+        int FaceHeight(int face) const override { return tiled_->Height(face); }
+        std::array<uint8_t, 3> FaceTexel(int face, int x, int y) const override { return tiled_->Texel(face, 0, x, y); }
+
+        std::array<uint8_t, 3> FilteredTexel(double x, double y, double z, double footprint) const override
+        {
+            int face;
+            double u, v;
+            Locate(x, y, z, face, u, v);
+
+            // A face spans a quarter turn, so footprint covers this many texels of level 0.
+            const double kTexels = footprint * tiled_->Width(face) / kHalfPi;
+            const int kLevel     = kTexels > 1 ? std::min(int(std::log2(kTexels) + 0.5), tiled_->Levels() - 1) : 0;
+            return tiled_->Texel(face, kLevel, int(u * (tiled_->Width(face, kLevel) - 1) + 0.5),
+                int(v * (tiled_->Height(face, kLevel) - 1) + 0.5));
+        }
+
+        bool Filtered() const override { return tiled_->Levels() > 1; }
+        std::string Error() const override { return tiled_->Error(); }
+
+    private:
+        std::shared_ptr<TiledSkybox> tiled_;
+    };
+}
@@ -3,11 +3,19 @@
 
 #include "movie.h"
 
+#include <cairo/cairo.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
 #include <vector>
 
 using namespace std;
 
-// One-time initialization.
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+// One-time initialization. Newer FFmpeg registers everything on its own.
 class FFmpegInitialize
 {
 public:
@@ -19,76 +27,214 @@ public:
 };
 
 static FFmpegInitialize ffmpegInitialize;
+#endif
 
-MovieWriter::MovieWriter(const string& filename_, const unsigned int width_, const unsigned int height_)
-    :
+// Translates the quality / speed presets into options of the selected codec.
+static void SetPresetOptions(const EncoderSettings& settings, AVDictionary** opt)
+{
+    if (settings.codec.compare(0, 6, "libvpx") == 0)
+    {
+        static const char* kCrf[]      = {"45", "36", "20", "0"};
+        static const char* kDeadline[] = {"realtime", "good", "good", "good"};
+        static const char* kCpuUsed[]  = {"8", "4", "2", "1"};
+
+        av_dict_set(opt, "crf", kCrf[settings.quality], 0);
+        av_dict_set(opt, "b", "0", 0);
+        av_dict_set(opt, "deadline", kDeadline[settings.speed], 0);
+        av_dict_set(opt, "cpu-used", kCpuUsed[settings.speed], 0);
+        av_dict_set(opt, "row-mt", "1", 0);
+        if (settings.quality == EncoderSettings::kLossless)
+            av_dict_set(opt, "lossless", "1", 0);
+    }
+    else
+    {
+        // x264 / x265 style options.
+        static const char* kCrf[]    = {"32", "26", "18", "0"};
+        static const char* kPreset[] = {"ultrafast", "veryfast", "medium", "slow"};
 
-      width(width_), height(height_), iframe(0), pixels(4 * width * height)
+        av_dict_set(opt, "crf", kCrf[settings.quality], 0);
+        av_dict_set(opt, "preset", kPreset[settings.speed], 0);
+    }
+}
 
+// One output file with its own codec context. A plain movie uses a single Encoder for its whole length, a segmented
+// movie opens one per segment, so every segment starts with a key frame and references nothing outside itself.
+class MovieWriter::Encoder
 {
-    cairo_surface = cairo_image_surface_create_for_data((unsigned char*) &pixels[0], CAIRO_FORMAT_RGB24, width, height,
-        cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, width));
+    MovieWriter& writer;
+    const string path;
+    AVFormatContext* fc;
+    AVStream* stream;
+    AVCodecContext* c;
+
+    // Reused for every packet the codec hands back.
+    AVPacket* pkt;
+    bool finished;
+
+    // Writes every packet the codec has ready. Returns once it asks for more input (or is fully drained).
+    void receivePackets()
+    {
+        for (;;)
+        {
+            int ret = avcodec_receive_packet(c, pkt);
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+                return;
+            if (ret < 0)
+                throw runtime_error("MovieWriter: encoding failed in " + path);
+
+            // The packet timestamps are in the codec time base (one tick per frame);
+            // convert them to the time base that our selected format uses.
+            av_packet_rescale_ts(pkt, c->time_base, stream->time_base);
+            pkt->stream_index = stream->index;
+            const int kSize   = pkt->size;
+
+            // Write the encoded frame to the file. The muxer takes over the packet's data and resets it.
+            if (av_interleaved_write_frame(fc, pkt) < 0)
+                throw runtime_error("MovieWriter: cannot write to " + path);
+            writer.reportProgress(kSize);
+        }
+    }
+
+public:
+    Encoder(MovieWriter& writer_, const string& path_, unsigned int threads)
+        : writer(writer_), path(path_), fc(NULL), stream(NULL), c(NULL), pkt(NULL), finished(false)
+    {
+        const EncoderSettings& settings = writer.settings;
+
+        // Preparing the data concerning the format and codec,
+        // in order to write properly the header, frame data and end of file.
+        avformat_alloc_output_context2(&fc, NULL, settings.container.c_str(), path.c_str());
+        if (!fc)
+            throw runtime_error("MovieWriter: cannot create " + path);
+
+        // Setting up the codec.
+        const AVCodec* codec = avcodec_find_encoder_by_name(settings.codec.c_str());
+        if (!codec)
+            throw runtime_error("MovieWriter: encoder " + settings.codec + " not found");
+        stream = avformat_new_stream(fc, NULL);
+        c      = avcodec_alloc_context3(codec);
+        pkt    = av_packet_alloc();
+        if (!stream || !c || !pkt)
+            throw runtime_error("MovieWriter: out of memory opening " + path);
+
+        c->width        = writer.width;
+        c->height       = writer.height;
+        c->pix_fmt      = AV_PIX_FMT_YUV420P;
+        c->time_base    = (AVRational){1, settings.fps};
+        c->framerate    = (AVRational){settings.fps, 1};
+        c->thread_count = threads;
+        // Frame threading keeps several pictures in flight; codecs without it fall back to slices.
+        c->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
 
-    // Preparing to convert my generated RGB images to YUV frames.
-    swsCtx = sws_getContext(
-        width, height, AV_PIX_FMT_RGB24, width, height, AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+        // Some formats require a global header.
+        if (fc->oformat->flags & AVFMT_GLOBALHEADER)
+            c->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+        AVDictionary* opt = NULL;
+        SetPresetOptions(settings, &opt);
+        int ret = avcodec_open2(c, codec, &opt);
+        av_dict_free(&opt);
+        if (ret < 0)
+            throw runtime_error("MovieWriter: cannot open encoder " + settings.codec);
+
+        // Once the codec is set up, we need to let the container know
+        // which codec are the streams using, in this case the only (video) stream.
+        avcodec_parameters_from_context(stream->codecpar, c);
+        stream->time_base = c->time_base;
+        if (!(fc->oformat->flags & AVFMT_NOFILE) && avio_open(&fc->pb, path.c_str(), AVIO_FLAG_WRITE) < 0)
+            throw runtime_error("MovieWriter: cannot open " + path);
+        if (avformat_write_header(fc, NULL) < 0)
+            throw runtime_error("MovieWriter: cannot write the header of " + path);
+    }
+
+    // The PTS of the frame are just in a reference unit, unrelated to the format we are using: the frame number
+    // within this file. The codec references the picture's buffers rather than copying them.
+    void encode(AVFrame* yuvpic)
+    {
+        if (avcodec_send_frame(c, yuvpic) < 0)
+            throw runtime_error("MovieWriter: cannot encode a frame of " + path);
+        receivePackets();
+    }
+
+    // Writes the delayed frames and the trailer.
+    void finish()
+    {
+        if (finished)
+            return;
+        finished = true;
+
+        avcodec_send_frame(c, NULL);
+        receivePackets();
 
-    // Preparing the data concerning the format and codec,
-    // in order to write properly the header, frame data and end of file.
-    const char* fmtext    = "mp4";
-    const string filename = filename_ + "." + fmtext;
-    fmt                   = av_guess_format(fmtext, NULL, NULL);
-    avformat_alloc_output_context2(&fc, NULL, NULL, filename.c_str());
+        // Writing the end of the file.
+        av_write_trailer(fc);
+    }
 
-    // Setting up the codec.
-    AVCodec* codec    = avcodec_find_encoder_by_name("libvpx-vp9");
-    AVDictionary* opt = NULL;
-    av_dict_set(&opt, "preset", "slow", 0);
-    av_dict_set(&opt, "crf", "20", 0);
-    stream          = avformat_new_stream(fc, codec);
-    c               = stream->codec;
-    c->width        = width;
-    c->height       = height;
-    c->pix_fmt      = AV_PIX_FMT_YUV420P;
-    c->time_base    = (AVRational){1, 25};
-    c->thread_count = 12;
+    ~Encoder()
+    {
+        // Closing the file.
+        if (fc && !(fc->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&fc->pb);
+        avcodec_free_context(&c);
+        av_packet_free(&pkt);
+        avformat_free_context(fc);
+    }
+};
 
-    // Setting up the format, its stream(s),
-    // linking with the codec(s) and write the header.
-    if (fc->oformat->flags & AVFMT_GLOBALHEADER)
+struct MovieWriter::Lane
+{
+    struct FrameDeleter
     {
-        // Some formats require a global header.
-        c->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
-    }
-    avcodec_open2(c, codec, &opt);
-    av_dict_free(&opt);
-
-    // Once the codec is set up, we need to let the container know
-    // which codec are the streams using, in this case the only (video) stream.
-    stream->time_base = (AVRational){1, 25};
-    av_dump_format(fc, 0, filename.c_str(), 1);
-    avio_open(&fc->pb, filename.c_str(), AVIO_FLAG_WRITE);
-    int ret = avformat_write_header(fc, &opt);
-    av_dict_free(&opt);
-
-    // Preparing the containers of the frame data:
-    // Allocating memory for each RGB frame, which will be lately converted to YUV.
-    rgbpic         = av_frame_alloc();
-    rgbpic->format = AV_PIX_FMT_RGB24;
-    rgbpic->width  = width;
-    rgbpic->height = height;
-    ret            = av_frame_get_buffer(rgbpic, 1);
-
-    // Allocating memory for each conversion output YUV frame.
-    yuvpic         = av_frame_alloc();
-    yuvpic->format = AV_PIX_FMT_YUV420P;
-    yuvpic->width  = width;
-    yuvpic->height = height;
-    ret            = av_frame_get_buffer(yuvpic, 1);
+        void operator()(AVFrame* frame) const { av_frame_free(&frame); }
+    };
+
+    // The pictures the queue's slots point to, allocated the first time their slot is written and freed with the
+    // lane.
+    std::vector<std::unique_ptr<AVFrame, FrameDeleter>> pool;
+    dhh::movie::FrameQueue<AVFrame*> queue;
+    std::thread thread;
+    std::exception_ptr error;
+
+    // Only used by a plain movie, whose single file is opened up front.
+    std::unique_ptr<Encoder> encoder;
+
+    explicit Lane(size_t depth) : queue(depth) {}
+};
+
+MovieWriter::MovieWriter(
+    const string& filename_, const unsigned int width_, const unsigned int height_, const EncoderSettings& settings_)
+    :
+
+      width(width_), height(height_), settings(settings_), movie_name(filename_), frames(0), closed(false),
+      frames_encoded(0), bytes_written(0), start(std::chrono::steady_clock::now()), last_report(start)
+
+{
+    const unsigned int kHardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    lane_limit = 1;
+    lane_depth = std::max(settings.queue_depth, 1u);
+    if (settings.segment_frames)
+    {
+        lane_limit = settings.segment_workers ? settings.segment_workers : std::max(kHardwareThreads / 4, 1u);
+        // A worker only starts on its chunk once the previous workers' chunks are queued, so each one must be able
+        // to hold a whole chunk for the workers to overlap.
+        lane_depth = std::max<size_t>(lane_depth, settings.segment_frames);
+    }
+    codec_threads = settings.codec_threads ? settings.codec_threads : std::max(kHardwareThreads / lane_limit, 1u);
+
+    startLane();
+}
+
+void MovieWriter::startLane()
+{
+    lanes.push_back(std::make_unique<Lane>(lane_depth));
+    Lane& lane = *lanes.back();
+    if (!settings.segment_frames)
+        lane.encoder = std::make_unique<Encoder>(*this, movie_name + "." + settings.container, codec_threads);
 
     // After the format, code and general frame data is set,
-    // we can write the video in the frame generation loop:
-    // std::vector<uint8_t> B(width*height*3);
+    // we can write the video in the frame generation loop.
+    lane.thread = std::thread(&MovieWriter::encodeLoop, this, std::ref(lane));
 }
 
 void MovieWriter::addFrame(const string& filename)
@@ -105,104 +251,354 @@ void MovieWriter::addFrame(const string& filename)
         int imgw = cairo_image_surface_get_width(img);
         int imgh = cairo_image_surface_get_height(img);
 
-        cairo_t* cr = cairo_create(cairo_surface);
+        // Scale into a movie-sized surface, then convert its xRGB pixels directly.
+        cairo_surface_t* scaled = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+        cairo_t* cr             = cairo_create(scaled);
         cairo_scale(cr, (float) width / imgw, (float) height / imgh);
         cairo_set_source_surface(cr, img, 0, 0);
         cairo_paint(cr);
         cairo_destroy(cr);
         cairo_surface_destroy(img);
+        cairo_surface_flush(scaled);
 
-        unsigned char* data = cairo_image_surface_get_data(cairo_surface);
-
-        memcpy(&pixels[0], data, pixels.size());
+        queueFrame<dhh::movie::Bgrx8>(
+            cairo_image_surface_get_data(scaled), cairo_image_surface_get_stride(scaled));
+        cairo_surface_destroy(scaled);
     }
     else
     {
         fprintf(stderr, "The \"%s\" format is not supported\n", ext.c_str());
         exit(-1);
     }
-
-    addFrame((uint8_t*) &pixels[0]);
 }
 
 void MovieWriter::addFrame(const uint8_t* pixels)
 {
-    int channels = 3;
-    // The AVFrame data will be stored as RGBRGBRGB... row-wise,
-    // from left to right and from top to bottom.
-    for (unsigned int y = 0; y < height; y++)
+    queueFrame<dhh::movie::Rgb8>(pixels, 3 * width);
+}
+
+void MovieWriter::addFrame(const uint8_t* pixels, size_t stride)
+{
+    queueFrame<dhh::movie::Rgb8>(pixels, stride);
+}
+
+void MovieWriter::addFrame(const float* pixels, size_t stride)
+{
+    queueFrame<dhh::movie::Rgb32f>(pixels, stride ? stride : 3 * width * sizeof(float));
+}
+
+void MovieWriter::addFrameRgbx(const uint8_t* pixels, size_t stride)
+{
+    queueFrame<dhh::movie::Rgbx8>(pixels, stride ? stride : 4 * width);
+}
+
+void MovieWriter::addFrame(const dhh::movie::Yuv420Planes& planes)
+{
+    queuePicture([&](const dhh::movie::Yuv420Planes& picture) {
+        dhh::movie::CopyYuv420(planes, width, height, picture);
+    });
+}
+
+template <typename Layout>
+void MovieWriter::queueFrame(const typename Layout::Component* pixels, size_t stride)
+{
+    queuePicture([&](const dhh::movie::Yuv420Planes& picture) {
+        dhh::movie::RgbToYuv420<Layout>(pixels, stride, width, height, picture);
+    });
+}
+
+template <typename Fill>
+void MovieWriter::queuePicture(Fill fill)
+{
+    // Segments are dealt round-robin to the lanes, which start with the first segment dealt to them.
+    const size_t kLane = settings.segment_frames ? (frames / settings.segment_frames) % lane_limit : 0;
+    if (kLane == lanes.size())
     {
-        for (unsigned int x = 0; x < width; x++)
-        {
-            // rgbpic->linesize[0] is equal to width.
-            rgbpic->data[0][y * rgbpic->linesize[0] + 3 * x + 0] = pixels[y * channels * width + channels * x + 0];
-            rgbpic->data[0][y * rgbpic->linesize[0] + 3 * x + 1] = pixels[y * channels * width + channels * x + 1];
-            rgbpic->data[0][y * rgbpic->linesize[0] + 3 * x + 2] = pixels[y * channels * width + channels * x + 2];
-        }
+        if (closed)
+            throw runtime_error("MovieWriter: frame added after close()");
+        startLane();
+    }
+    Lane& lane = *lanes[kLane];
+
+    // Blocks only while that lane is a full queue behind.
+    AVFrame** slot = lane.queue.AcquireWrite();
+    if (!slot)
+    {
+        rethrowEncoderError();
+        throw runtime_error("MovieWriter: frame added after close()");
+    }
+
+    // Every queue slot owns one YUV picture that is reused for the rest of the movie, allocated the first time the
+    // slot is written. Rows are aligned so the conversion and the encoder can use wide loads.
+    if (!*slot)
+    {
+        lane.pool.emplace_back(av_frame_alloc());
+        AVFrame* yuvpic = lane.pool.back().get();
+        if (!yuvpic)
+            throw runtime_error("MovieWriter: cannot allocate frame pool");
+        yuvpic->format = AV_PIX_FMT_YUV420P;
+        yuvpic->width  = width;
+        yuvpic->height = height;
+        if (av_frame_get_buffer(yuvpic, 32) < 0)
+            throw runtime_error("MovieWriter: cannot allocate frame pool");
+        *slot = yuvpic;
     }
 
-    // Not actually scaling anything, but just converting
-    // the RGB data to YUV and store it in yuvpic.
-    sws_scale(swsCtx, rgbpic->data, rgbpic->linesize, 0, height, yuvpic->data, yuvpic->linesize);
+    // The codec may still hold a reference to this picture's buffers from a previous frame.
+    AVFrame* yuvpic = *slot;
+    if (av_frame_make_writable(yuvpic) < 0)
+        throw runtime_error("MovieWriter: cannot reuse pooled frame");
+
+    dhh::movie::Yuv420Planes planes = {yuvpic->data[0], yuvpic->data[1], yuvpic->data[2], yuvpic->linesize[0],
+        yuvpic->linesize[1], yuvpic->linesize[2]};
+    fill(planes);
+    yuvpic->pts = frames++;
+
+    lane.queue.CommitWrite();
+}
 
-    av_init_packet(&pkt);
-    pkt.data = NULL;
-    pkt.size = 0;
+void MovieWriter::flush()
+{
+    for (auto& lane : lanes)
+    {
+        lane->queue.WaitEmpty();
+    }
+    rethrowEncoderError();
+}
 
-    // The PTS of the frame are just in a reference unit,
-    // unrelated to the format we are using. We set them,
-    // for instance, as the corresponding frame number.
-    yuvpic->pts = iframe;
+void MovieWriter::rethrowEncoderError()
+{
+    // An encoder thread closes its queue after storing its exception, so the store is visible once Closed() is.
+    for (auto& lane : lanes)
+    {
+        if (lane->queue.Closed() && lane->error)
+        {
+            std::rethrow_exception(lane->error);
+        }
+    }
+}
 
-    int got_output;
-    int ret = avcodec_encode_video2(c, &pkt, yuvpic, &got_output);
-    if (got_output)
+void MovieWriter::reportProgress(int64_t packet_size, bool force)
+{
+    if (packet_size)
     {
-        fflush(stdout);
+        frames_encoded.fetch_add(1);
+        bytes_written.fetch_add(packet_size);
+    }
+    if (!settings.progress)
+        return;
+
+    // Other lanes skip the report rather than wait for it.
+    std::unique_lock<std::mutex> lock(progress_mutex, std::defer_lock);
+    if (force)
+        lock.lock();
+    else if (!lock.try_lock())
+        return;
+
+    const auto kNow = std::chrono::steady_clock::now();
+    if (!force && std::chrono::duration<double>(kNow - last_report).count() < settings.progress_interval)
+        return;
+    last_report = kNow;
+
+    EncoderProgress progress = {
+        frames_encoded.load(), bytes_written.load(), std::chrono::duration<double>(kNow - start).count()};
+    settings.progress(progress);
+}
+
+string MovieWriter::segmentPath(int64_t segment) const
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".part%05lld.", (long long) segment);
+    return movie_name + suffix + settings.container;
+}
 
-        // We set the packet PTS and DTS taking in the account our FPS (second argument),
-        // and the time base that our selected format uses (third argument).
-        av_packet_rescale_ts(&pkt, (AVRational){1, 25}, stream->time_base);
+void MovieWriter::encodeLoop(Lane& lane)
+{
+    try
+    {
+        std::unique_ptr<Encoder> segment_encoder;
+        int64_t segment = -1;
 
-        pkt.stream_index = stream->index;
-        printf("Writing frame %d (size = %d)\n", iframe++, pkt.size);
+        while (AVFrame** slot = lane.queue.AcquireRead())
+        {
+            AVFrame* yuvpic = *slot;
+            Encoder* encoder = lane.encoder.get();
+            if (settings.segment_frames)
+            {
+                const int64_t kSegment = yuvpic->pts / settings.segment_frames;
+                if (kSegment != segment)
+                {
+                    // Finish and close the previous segment before opening the next one.
+                    if (segment_encoder)
+                        segment_encoder->finish();
+                    segment_encoder.reset();
+                    segment_encoder = std::make_unique<Encoder>(*this, segmentPath(kSegment), codec_threads);
+                    segment = kSegment;
+                }
+                yuvpic->pts -= kSegment * settings.segment_frames;
+                encoder = segment_encoder.get();
+            }
+
+            encoder->encode(yuvpic);
+            lane.queue.ReleaseRead();
+        }
 
-        // Write the encoded frame to the mp4 file.
-        av_interleaved_write_frame(fc, &pkt);
-        av_packet_unref(&pkt);
+        if (segment_encoder)
+            segment_encoder->finish();
+        if (lane.encoder)
+            lane.encoder->finish();
+    }
+    catch (...)
+    {
+        lane.error = std::current_exception();
+        lane.queue.Close();
     }
 }
 
-MovieWriter::~MovieWriter()
+// Remuxes the segment files, in order, into the final movie. Packets are copied as they are, so nothing is
+// re-encoded; only the timestamps are moved from each segment's time base and shifted by the segment's start.
+void MovieWriter::concatenateSegments()
 {
-    // Writing the delayed frames:
-    for (int got_output = 1; got_output;)
+    struct OutputCloser
+    {
+        void operator()(AVFormatContext* fc) const
+        {
+            if (!(fc->oformat->flags & AVFMT_NOFILE))
+                avio_closep(&fc->pb);
+            avformat_free_context(fc);
+        }
+    };
+    struct InputCloser
+    {
+        void operator()(AVFormatContext* fc) const { avformat_close_input(&fc); }
+    };
+    struct PacketDeleter
     {
-        int ret = avcodec_encode_video2(c, &pkt, NULL, &got_output);
-        if (got_output)
+        void operator()(AVPacket* pkt) const { av_packet_free(&pkt); }
+    };
+
+    const string kPath      = movie_name + "." + settings.container;
+    const int64_t kSegments = (frames + settings.segment_frames - 1) / settings.segment_frames;
+
+    AVFormatContext* out_context = NULL;
+    avformat_alloc_output_context2(&out_context, NULL, NULL, kPath.c_str());
+    if (!out_context)
+        throw runtime_error("MovieWriter: cannot create " + kPath);
+    std::unique_ptr<AVFormatContext, OutputCloser> out(out_context);
+    std::unique_ptr<AVPacket, PacketDeleter> pkt(av_packet_alloc());
+    if (!pkt)
+        throw runtime_error("MovieWriter: out of memory opening " + kPath);
+
+    AVStream* out_stream = NULL;
+    int64_t last_dts     = AV_NOPTS_VALUE;
+    for (int64_t segment = 0; segment < kSegments; ++segment)
+    {
+        const string kSegmentPath   = segmentPath(segment);
+        AVFormatContext* in_context = NULL;
+        if (avformat_open_input(&in_context, kSegmentPath.c_str(), NULL, NULL) < 0)
+            throw runtime_error("MovieWriter: cannot read " + kSegmentPath);
+        std::unique_ptr<AVFormatContext, InputCloser> in(in_context);
+        if (avformat_find_stream_info(in.get(), NULL) < 0 || in->nb_streams != 1)
+            throw runtime_error("MovieWriter: cannot read " + kSegmentPath);
+        const AVStream* in_stream    = in->streams[0];
+        const AVCodecParameters* kIn = in_stream->codecpar;
+
+        if (!out_stream)
+        {
+            out_stream = avformat_new_stream(out.get(), NULL);
+            if (!out_stream || avcodec_parameters_copy(out_stream->codecpar, kIn) < 0)
+                throw runtime_error("MovieWriter: out of memory opening " + kPath);
+            out_stream->codecpar->codec_tag = 0;
+            out_stream->time_base           = in_stream->time_base;
+            if (!(out->oformat->flags & AVFMT_NOFILE) && avio_open(&out->pb, kPath.c_str(), AVIO_FLAG_WRITE) < 0)
+                throw runtime_error("MovieWriter: cannot open " + kPath);
+            if (avformat_write_header(out.get(), NULL) < 0)
+                throw runtime_error("MovieWriter: cannot write the header of " + kPath);
+        }
+        else
+        {
+            // Packets are copied under the first segment's stream parameters, so every segment must have been
+            // encoded with the same ones, down to the global header.
+            const AVCodecParameters* kOut = out_stream->codecpar;
+            if (kIn->codec_id != kOut->codec_id || kIn->format != kOut->format || kIn->width != kOut->width ||
+                kIn->height != kOut->height || kIn->extradata_size != kOut->extradata_size ||
+                (kIn->extradata_size && memcmp(kIn->extradata, kOut->extradata, kIn->extradata_size) != 0))
+                throw runtime_error("MovieWriter: " + kSegmentPath + " does not match the first segment's stream");
+        }
+
+        // The muxer may have picked a different time base for each segment file.
+        const int64_t kOffset = av_rescale_q(
+            segment * settings.segment_frames, (AVRational){1, settings.fps}, out_stream->time_base);
+
+        int ret;
+        while ((ret = av_read_frame(in.get(), pkt.get())) >= 0)
         {
-            fflush(stdout);
-            av_packet_rescale_ts(&pkt, (AVRational){1, 25}, stream->time_base);
-            pkt.stream_index = stream->index;
-            printf("Writing frame %d (size = %d)\n", iframe++, pkt.size);
-            av_interleaved_write_frame(fc, &pkt);
-            av_packet_unref(&pkt);
+            if (pkt->pts != AV_NOPTS_VALUE)
+                pkt->pts = av_rescale_q(pkt->pts, in_stream->time_base, out_stream->time_base) + kOffset;
+            if (pkt->dts != AV_NOPTS_VALUE)
+                pkt->dts = av_rescale_q(pkt->dts, in_stream->time_base, out_stream->time_base) + kOffset;
+            pkt->duration = av_rescale_q(pkt->duration, in_stream->time_base, out_stream->time_base);
+
+            // A segment whose decode order reaches back before its start, e.g. through B-frame delay, would overlap
+            // the previous one.
+            if (pkt->dts != AV_NOPTS_VALUE)
+            {
+                if (last_dts != AV_NOPTS_VALUE && pkt->dts < last_dts)
+                    throw runtime_error("MovieWriter: timestamps of " + kSegmentPath + " go backwards");
+                last_dts = pkt->dts;
+            }
+
+            pkt->pos          = -1;
+            pkt->stream_index = out_stream->index;
+            if (av_interleaved_write_frame(out.get(), pkt.get()) < 0)
+                throw runtime_error("MovieWriter: cannot write to " + kPath);
         }
+        if (ret != AVERROR_EOF)
+            throw runtime_error("MovieWriter: cannot read " + kSegmentPath);
+
+        in.reset();
+        remove(kSegmentPath.c_str());
     }
 
-    // Writing the end of the file.
-    av_write_trailer(fc);
+    if (out_stream && av_write_trailer(out.get()) < 0)
+        throw runtime_error("MovieWriter: cannot write the trailer of " + kPath);
+}
+
+void MovieWriter::close()
+{
+    if (closed)
+        return;
+    closed = true;
 
-    // Closing the file.
-    if (!(fmt->flags & AVFMT_NOFILE))
-        avio_closep(&fc->pb);
-    avcodec_close(stream->codec);
+    // Let the encoder threads drain what is left in their queues and finish their files.
+    for (auto& lane : lanes)
+    {
+        lane->queue.Close();
+    }
+    for (auto& lane : lanes)
+    {
+        if (lane->thread.joinable())
+            lane->thread.join();
+    }
+    for (auto& lane : lanes)
+    {
+        if (lane->error)
+            std::rethrow_exception(lane->error);
+    }
 
-    // Freeing all the allocated memory:
-    sws_freeContext(swsCtx);
-    av_frame_free(&rgbpic);
-    av_frame_free(&yuvpic);
-    avformat_free_context(fc);
+    if (settings.segment_frames)
+        concatenateSegments();
+    reportProgress(0, true);
+}
 
-    cairo_surface_destroy(cairo_surface);
+MovieWriter::~MovieWriter()
+{
+    try
+    {
+        close();
+    }
+    catch (std::exception& e)
+    {
+        fprintf(stderr, "MovieWriter: %s\n", e.what());
+    }
 }
@@ -0,0 +1,61 @@
+#include "block_texture.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace
+{
+    std::array<uint8_t, 3> Bgr(int b, int g, int r) { return {uint8_t(b), uint8_t(g), uint8_t(r)}; }
+}
+
+TEST(BlockTextureTest, Bc1T)
+{
+    // Red and blue endpoints, first row indexing 0, 1, 2, 3, all other rows 0.
+    const uint8_t kBlock[8] = {0x00, 0xf8, 0x1f, 0x00, 0xe4, 0x00, 0x00, 0x00};
+    const dhh::texture::BlockTexture kTexture(dhh::texture::kBc1, 4, 4, {kBlock, kBlock + 8});
+    EXPECT_EQ(kTexture.Texel(0, 0), Bgr(0, 0, 255));
+    EXPECT_EQ(kTexture.Texel(1, 0), Bgr(255, 0, 0));
+    EXPECT_EQ(kTexture.Texel(2, 0), Bgr(85, 0, 170));
+    EXPECT_EQ(kTexture.Texel(3, 0), Bgr(170, 0, 85));
+    EXPECT_EQ(kTexture.Texel(3, 3), Bgr(0, 0, 255));
+
+    // Swapped endpoints select the three-color mode, with black for index 3.
+    const uint8_t kThreeColors[8] = {0x1f, 0x00, 0x00, 0xf8, 0xe4, 0x00, 0x00, 0x00};
+    uint8_t bgr[16 * 3];
+    dhh::texture::DecodeBlock(dhh::texture::kBc1, kThreeColors, bgr);
+    EXPECT_EQ(bgr[2 * 3 + 0], 127);
+    EXPECT_EQ(bgr[3 * 3 + 2], 0);
+}
+
+TEST(BlockTextureTest, Bc3AlwaysInterpolatesFourColorsT)
+{
+    const uint8_t kBlock[16] = {255, 255, 0, 0, 0, 0, 0, 0, 0x1f, 0x00, 0x00, 0xf8, 0xe4, 0x00, 0x00, 0x00};
+    uint8_t bgr[16 * 3];
+    dhh::texture::DecodeBlock(dhh::texture::kBc3, kBlock, bgr);
+    EXPECT_EQ(bgr[3 * 3 + 0], 85);
+    EXPECT_EQ(bgr[3 * 3 + 2], 170);
+}
+
+TEST(BlockTextureTest, Etc2SolidBlockT)
+{
+    // Differential mode, base color 16 of 31 in every channel, no difference, modifier table 0, all indices 0: every
+    // texel is the expanded base color 132 plus 2.
+    const uint8_t kBlock[8] = {0x80, 0x80, 0x80, 0x02, 0x00, 0x00, 0x00, 0x00};
+
+    // Two textures of 8x4, to check that their blocks do not collide in the per-thread cache.
+    std::vector<uint8_t> blocks(kBlock, kBlock + 8);
+    blocks.insert(blocks.end(), kBlock, kBlock + 8);
+    const dhh::texture::BlockTexture kEtc(dhh::texture::kEtc2Rgb, 8, 4, blocks);
+
+    std::vector<uint8_t> bc1 = {0x00, 0xf8, 0x00, 0xf8, 0, 0, 0, 0};
+    bc1.insert(bc1.end(), bc1.begin(), bc1.end());
+    const dhh::texture::BlockTexture kBc1(dhh::texture::kBc1, 8, 4, bc1);
+
+    for (int x = 0; x < 8; ++x)
+    {
+        EXPECT_EQ(kEtc.Texel(x, 2), Bgr(134, 134, 134));
+        EXPECT_EQ(kBc1.Texel(x, 2), Bgr(0, 0, 255));
+    }
+    EXPECT_EQ(kEtc.Bytes(), 16u);
+}
@@ -0,0 +1,50 @@
+#include "checkpoint.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+TEST(CheckpointTest, ResumesOnlyMatchingJobT)
+{
+    const std::filesystem::path kDir = std::filesystem::temp_directory_path() / "checkpoint_test";
+    std::filesystem::remove_all(kDir);
+
+    const dhh::checkpoint::Manifest kManifest = {{"width", "256"}, {"frames", "3"}};
+    {
+        dhh::checkpoint::Checkpoint checkpoint(kDir, kManifest);
+        EXPECT_EQ(checkpoint.MissingFrames(3).size(), 3u);
+        std::ofstream(checkpoint.FramePath(1)) << "frame";
+    }
+
+    dhh::checkpoint::Checkpoint resumed(kDir, kManifest);
+    const std::vector<int> kMissing = {0, 2};
+    EXPECT_EQ(resumed.MissingFrames(3), kMissing);
+
+    dhh::checkpoint::Manifest other = kManifest;
+    other["width"]                  = "512";
+    EXPECT_THROW(dhh::checkpoint::Checkpoint(kDir, other), std::runtime_error);
+
+    std::filesystem::remove_all(kDir);
+}
+
+TEST(CheckpointTest, ManifestIsPublishedWholeT)
+{
+    const std::filesystem::path kDir = std::filesystem::temp_directory_path() / "checkpoint_manifest_test";
+    std::filesystem::remove_all(kDir);
+    std::filesystem::create_directories(kDir);
+
+    // A write cut short before its rename leaves only the temporary file, which must not count as a manifest.
+    std::ofstream(kDir / "manifest.txt.part") << "frames = 3\nwid";
+    const dhh::checkpoint::Manifest kManifest = {{"width", "256"}, {"frames", "3"}};
+    dhh::checkpoint::Checkpoint checkpoint(kDir, kManifest);
+    EXPECT_FALSE(std::filesystem::exists(kDir / "manifest.txt.part"));
+
+    std::ifstream in(kDir / "manifest.txt", std::ios::binary);
+    std::stringstream text;
+    text << in.rdbuf();
+    EXPECT_EQ(text.str(), dhh::checkpoint::ToString(kManifest));
+
+    std::filesystem::remove_all(kDir);
+}
@@ -0,0 +1,118 @@
+#include "colorspace.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace
+{
+    struct Picture
+    {
+        int width, height;
+        std::vector<uint8_t> y, u, v;
+
+        Picture(int w, int h)
+            : width(w), height(h), y(w * h), u(((w + 1) / 2) * ((h + 1) / 2)), v(((w + 1) / 2) * ((h + 1) / 2))
+        {
+        }
+
+        dhh::movie::Yuv420Planes Planes()
+        {
+            return {y.data(), u.data(), v.data(), width, (width + 1) / 2, (width + 1) / 2};
+        }
+    };
+}
+
+TEST(ColorspaceTest, Bt709ReferenceColorsT)
+{
+    // White, black, red and blue in limited-range BT.709.
+    EXPECT_EQ(dhh::movie::LumaFromRgb(1, 1, 1), 235);
+    EXPECT_EQ(dhh::movie::CbFromRgb(1, 1, 1), 128);
+    EXPECT_EQ(dhh::movie::CrFromRgb(1, 1, 1), 128);
+
+    EXPECT_EQ(dhh::movie::LumaFromRgb(0, 0, 0), 16);
+
+    EXPECT_EQ(dhh::movie::LumaFromRgb(1, 0, 0), 63);
+    EXPECT_EQ(dhh::movie::CbFromRgb(1, 0, 0), 102);
+    EXPECT_EQ(dhh::movie::CrFromRgb(1, 0, 0), 240);
+
+    EXPECT_EQ(dhh::movie::LumaFromRgb(0, 0, 1), 32);
+    EXPECT_EQ(dhh::movie::CbFromRgb(0, 0, 1), 240);
+}
+
+TEST(ColorspaceTest, ChromaIsBlockAverageT)
+{
+    // 2x2 image: left column red, right column blue. Chroma is the average of both.
+    const uint8_t kPixels[] = {255, 0, 0, 0, 0, 255, 255, 0, 0, 0, 0, 255};
+    Picture pic(2, 2);
+    dhh::movie::RgbToYuv420<dhh::movie::Rgb8>(kPixels, 6, 2, 2, pic.Planes());
+
+    EXPECT_EQ(pic.y[0], 63);
+    EXPECT_EQ(pic.y[1], 32);
+    EXPECT_EQ(pic.y[2], 63);
+    EXPECT_EQ(pic.y[3], 32);
+    EXPECT_EQ(pic.u[0], dhh::movie::CbFromRgb(0.5f, 0, 0.5f));
+    EXPECT_EQ(pic.v[0], dhh::movie::CrFromRgb(0.5f, 0, 0.5f));
+}
+
+TEST(ColorspaceTest, FloatMatchesBytesWithStrideT)
+{
+    const int kWidth = 5, kHeight = 3;  // odd on purpose
+    const int kStride = kWidth * 3 + 7;
+    std::vector<uint8_t> bytes(kStride * kHeight);
+    std::vector<float> floats(kWidth * 3 * kHeight);
+    for (int row = 0; row < kHeight; ++row)
+    {
+        for (int i = 0; i < kWidth * 3; ++i)
+        {
+            uint8_t value                = static_cast<uint8_t>((row * 37 + i * 11) % 256);
+            bytes[row * kStride + i]     = value;
+            floats[row * kWidth * 3 + i] = value / 255.f;
+        }
+    }
+
+    Picture from_bytes(kWidth, kHeight), from_floats(kWidth, kHeight);
+    dhh::movie::RgbToYuv420<dhh::movie::Rgb8>(bytes.data(), kStride, kWidth, kHeight, from_bytes.Planes());
+    dhh::movie::RgbToYuv420<dhh::movie::Rgb32f>(floats.data(), kWidth * 3 * sizeof(float), kWidth, kHeight,
+        from_floats.Planes());
+
+    EXPECT_EQ(from_bytes.y, from_floats.y);
+    EXPECT_EQ(from_bytes.u, from_floats.u);
+    EXPECT_EQ(from_bytes.v, from_floats.v);
+}
+
+TEST(ColorspaceTest, RgbxIgnoresAlphaT)
+{
+    const uint8_t kRgb[]  = {255, 0, 0, 0, 0, 255, 10, 200, 30, 90, 90, 90};
+    const uint8_t kRgbx[] = {255, 0, 0, 7, 0, 0, 255, 0, 10, 200, 30, 255, 90, 90, 90, 128};
+
+    Picture from_rgb(2, 2), from_rgbx(2, 2);
+    dhh::movie::RgbToYuv420<dhh::movie::Rgb8>(kRgb, 6, 2, 2, from_rgb.Planes());
+    dhh::movie::RgbToYuv420<dhh::movie::Rgbx8>(kRgbx, 8, 2, 2, from_rgbx.Planes());
+
+    EXPECT_EQ(from_rgb.y, from_rgbx.y);
+    EXPECT_EQ(from_rgb.u, from_rgbx.u);
+    EXPECT_EQ(from_rgb.v, from_rgbx.v);
+}
+
+TEST(ColorspaceTest, CopyYuv420KeepsVisiblePixelsT)
+{
+    // 3x3 source with padded rows, into a tightly packed picture.
+    const int kWidth = 3, kHeight = 3, kStride = 8, kChromaStride = 4;
+    std::vector<uint8_t> y(kStride * kHeight), u(kChromaStride * 2), v(kChromaStride * 2);
+    for (size_t i = 0; i < y.size(); ++i)
+        y[i] = static_cast<uint8_t>(i);
+    for (size_t i = 0; i < u.size(); ++i)
+    {
+        u[i] = static_cast<uint8_t>(100 + i);
+        v[i] = static_cast<uint8_t>(200 + i);
+    }
+
+    Picture pic(kWidth, kHeight);
+    dhh::movie::CopyYuv420(
+        {y.data(), u.data(), v.data(), kStride, kChromaStride, kChromaStride}, kWidth, kHeight, pic.Planes());
+
+    EXPECT_EQ(pic.y, std::vector<uint8_t>({0, 1, 2, 8, 9, 10, 16, 17, 18}));
+    EXPECT_EQ(pic.u, std::vector<uint8_t>({100, 101, 104, 105}));
+    EXPECT_EQ(pic.v, std::vector<uint8_t>({200, 201, 204, 205}));
+}
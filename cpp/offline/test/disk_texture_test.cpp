@@ -0,0 +1,128 @@
+#include "disk_texture.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+TEST(DiskTextureTest, BakeHitsTexelCentersT)
+{
+    const dhh::disk::DiskLut kLut = dhh::disk::DiskLut::Bake(8, 4, [](double u, double v) {
+        return dhh::disk::Rgb{float(u), float(v), 0};
+    });
+    ASSERT_EQ(kLut.Levels(), 4);
+    EXPECT_EQ(kLut.Radial(3), 1);
+    EXPECT_EQ(kLut.Azimuthal(3), 1);
+
+    const dhh::disk::Rgb kCenter = kLut.Sample(2.5 / 8, 1.5 / 4);
+    EXPECT_FLOAT_EQ(kCenter.r, 2.5f / 8);
+    EXPECT_FLOAT_EQ(kCenter.g, 1.5f / 4);
+
+    // Halfway between two radial texel centers.
+    EXPECT_FLOAT_EQ(kLut.Sample(3.0 / 8, 1.5 / 4).r, 3.0f / 8);
+
+    // The coarsest level is the mean of the whole table.
+    EXPECT_FLOAT_EQ(kLut.Sample(0.5, 0.5, 3).r, 0.5f);
+    EXPECT_FLOAT_EQ(kLut.Sample(0.5, 0.5, 3).g, 0.5f);
+}
+
+TEST(DiskTextureTest, SampleStaysInBoundsT)
+{
+    std::vector<dhh::disk::Rgb> texels;
+    for (int y = 0; y < 3; ++y)
+    {
+        for (int x = 0; x < 5; ++x)
+        {
+            texels.push_back({float(x), float(y), 0});
+        }
+    }
+    const dhh::disk::DiskLut kLut(5, 3, texels);
+
+    // The radius is clamped to the edge texels.
+    EXPECT_FLOAT_EQ(kLut.Sample(-3, 0.5).r, 0);
+    EXPECT_FLOAT_EQ(kLut.Sample(7, 0.5).r, 4);
+    EXPECT_FLOAT_EQ(kLut.Sample(std::numeric_limits<double>::quiet_NaN(), 0.5).r, 0);
+
+    // The azimuth wraps: past the last row, the first row comes back.
+    EXPECT_NEAR(kLut.Sample(0.5, 1.0 / 6).g, kLut.Sample(0.5, 7.0 / 6).g, 1e-6);
+    EXPECT_NEAR(kLut.Sample(0.5, 1.0 / 6).g, kLut.Sample(0.5, -5.0 / 6).g, 1e-6);
+    EXPECT_FLOAT_EQ(kLut.Sample(0.5, 0).g, 1);
+    EXPECT_FLOAT_EQ(kLut.Sample(0.5, std::numeric_limits<double>::infinity()).g, 1);
+
+    EXPECT_THROW(dhh::disk::DiskLut(4, 3, texels), std::runtime_error);
+}
+
+TEST(DiskTextureTest, FromImageReadsBgrT)
+{
+    // Two columns, one row, with a padded stride.
+    const uint8_t kImage[8]       = {0, 0, 255, 255, 0, 0, 9, 9};
+    const dhh::disk::DiskLut kLut = dhh::disk::DiskLut::FromImage(kImage, 2, 1, 8);
+    EXPECT_FLOAT_EQ(kLut.Sample(0, 0).r, 1);
+    EXPECT_FLOAT_EQ(kLut.Sample(0, 0).b, 0);
+    EXPECT_FLOAT_EQ(kLut.Sample(1, 0).r, 0);
+    EXPECT_FLOAT_EQ(kLut.Sample(1, 0).b, 1);
+}
+
+TEST(DiskTextureTest, UpdateMatchesFromImageT)
+{
+    // Odd sizes, so the folded last column and row are refiltered as well.
+    const int kWidth = 7, kHeight = 5;
+    std::vector<uint8_t> image(kWidth * kHeight * 3);
+    for (size_t i = 0; i < image.size(); ++i)
+    {
+        image[i] = uint8_t(i * 37);
+    }
+    dhh::disk::DiskLut lut = dhh::disk::DiskLut::FromImage(image.data(), kWidth, kHeight, kWidth * 3);
+
+    // A change in the last column only, then one in the first texel.
+    for (const size_t kTexel : {size_t(kWidth * 3 - 1), size_t(0)})
+    {
+        image[kTexel * 3 + 1] += 100;
+        lut.Update(image.data(), kWidth, kHeight, kWidth * 3);
+
+        const dhh::disk::DiskLut kExpected = dhh::disk::DiskLut::FromImage(image.data(), kWidth, kHeight, kWidth * 3);
+        ASSERT_EQ(lut.Levels(), kExpected.Levels());
+        for (int level = 0; level < lut.Levels(); ++level)
+        {
+            for (size_t i = 0; i < lut.Level(level).size(); ++i)
+            {
+                EXPECT_EQ(lut.Level(level)[i].g, kExpected.Level(level)[i].g) << level << " " << i;
+            }
+        }
+    }
+
+    EXPECT_THROW(lut.Update(image.data(), kWidth - 1, kHeight, kWidth * 3), std::runtime_error);
+}
+
+TEST(DiskTextureTest, TemperatureProfileFallsOffOutwardT)
+{
+    const dhh::disk::DiskLut kLut = dhh::disk::TemperatureProfile(8, 18, 10000, 64);
+    EXPECT_EQ(kLut.Azimuthal(), 1);
+
+    // Hottest just outside the inner edge, dimmer and redder further out.
+    const dhh::disk::Rgb kHot  = kLut.Sample(1.0 / 6, 0);
+    const dhh::disk::Rgb kCold = kLut.Sample(1, 0);
+    EXPECT_GT(kHot.r, kCold.r);
+    EXPECT_GT(kHot.b / kHot.r, kCold.b / kCold.r);
+
+    const dhh::disk::Rgb kWhite = dhh::disk::BlackbodyColor(6600);
+    EXPECT_FLOAT_EQ(kWhite.r, 1);
+    EXPECT_GT(kWhite.g, 0.9f);
+    EXPECT_GT(kWhite.b, 0.9f);
+}
+
+TEST(DiskTextureTest, LevelForMatchesFootprintT)
+{
+    const dhh::disk::DiskLut kLut(64, 16, std::vector<dhh::disk::Rgb>(64 * 16, {1, 1, 1}));
+    ASSERT_EQ(kLut.Levels(), 7);
+
+    // A texel or less is level 0; the wider of the two footprints picks the level, rounded to the nearest one.
+    EXPECT_EQ(kLut.LevelFor(1.0 / 64, 1.0 / 16), 0);
+    EXPECT_EQ(kLut.LevelFor(4.0 / 64, 1.0 / 16), 2);
+    EXPECT_EQ(kLut.LevelFor(1.0 / 64, 5.0 / 16), 2);
+    EXPECT_EQ(kLut.LevelFor(3.0 / 64, 0), 2);
+    EXPECT_EQ(kLut.LevelFor(10, 10), 6);
+    EXPECT_EQ(kLut.LevelFor(0, 0), 0);
+    EXPECT_EQ(kLut.LevelFor(std::nan(""), 1.0 / 16), 0);
+}
@@ -0,0 +1,76 @@
+#include "frame_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+TEST(FrameQueueTest, PreservesOrderT)
+{
+    dhh::movie::FrameQueue<int> queue(3);
+    const int kFrames = 1000;
+
+    std::thread producer([&] {
+        for (int i = 0; i < kFrames; ++i)
+        {
+            int* slot = queue.AcquireWrite();
+            ASSERT_NE(slot, nullptr);
+            *slot = i;
+            queue.CommitWrite();
+        }
+        queue.Close();
+    });
+
+    int expected = 0;
+    while (int* slot = queue.AcquireRead())
+    {
+        EXPECT_EQ(*slot, expected++);
+        queue.ReleaseRead();
+    }
+    producer.join();
+    EXPECT_EQ(expected, kFrames);
+}
+
+TEST(FrameQueueTest, BoundedByCapacityT)
+{
+    dhh::movie::FrameQueue<int> queue(2);
+    for (int i = 0; i < 2; ++i)
+    {
+        ASSERT_NE(queue.AcquireWrite(), nullptr);
+        queue.CommitWrite();
+    }
+    EXPECT_EQ(queue.Size(), 2u);
+
+    // A full queue makes the producer wait until the consumer releases a slot.
+    std::atomic<bool> written = false;
+    std::thread producer([&] {
+        queue.AcquireWrite();
+        written = true;
+        queue.CommitWrite();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(written);
+    EXPECT_EQ(queue.Size(), 2u);
+
+    queue.AcquireRead();
+    queue.ReleaseRead();
+    producer.join();
+    EXPECT_TRUE(written);
+    EXPECT_EQ(queue.Size(), 2u);
+}
+
+TEST(FrameQueueTest, CloseDrainsPendingT)
+{
+    dhh::movie::FrameQueue<int> queue(4);
+    *queue.AcquireWrite() = 7;
+    queue.CommitWrite();
+    queue.Close();
+
+    EXPECT_EQ(queue.AcquireWrite(), nullptr);
+    int* slot = queue.AcquireRead();
+    ASSERT_NE(slot, nullptr);
+    EXPECT_EQ(*slot, 7);
+    queue.ReleaseRead();
+    EXPECT_EQ(queue.AcquireRead(), nullptr);
+}
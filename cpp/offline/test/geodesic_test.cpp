@@ -0,0 +1,131 @@
+#include "geodesic.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    using dhh::geodesic::SweptAngle;
+    using dhh::geodesic::SweptAngleMixed;
+
+    double Reference(double r0, double r1, double b) { return SweptAngle<double>(r0, r1, b, 1e-11); }
+
+    // The azimuth swept by the ray Trace follows from the camera at r0 until it escapes or reaches the horizon.
+    template <typename Swept>
+    double Deflection(double r0, double b, Swept swept)
+    {
+        if (b < dhh::geodesic::kCriticalImpact)
+            return swept(r0, 2, b);
+        const double kTurn = dhh::geodesic::ClosestApproach(r0, b);
+        return swept(r0, kTurn, b) - swept(kTurn, 2000, b);
+    }
+
+    // The entry BuildDeflectionTable in trace.comp writes for b, from the double precision reference.
+    dhh::geodesic::Deflection ExactDeflection(double r0, double b, double disk_inner, double disk_outer)
+    {
+        if (b < dhh::geodesic::kCriticalImpact)
+            return {0, Reference(r0, disk_outer, b), Reference(disk_outer, disk_inner, b), 0};
+
+        const double kR3 = dhh::geodesic::ClosestApproach(r0, b);
+        if (kR3 > disk_outer)
+        {
+            const double kDphi = Reference(r0, kR3, b);
+            return {kR3, kDphi, 0, kDphi - Reference(kR3, 2000, b)};
+        }
+        const double kDphi   = Reference(r0, disk_outer, b);
+        const double kInDisk = Reference(disk_outer, std::max(kR3, disk_inner), b);
+        return {kR3, kDphi, kInDisk, kDphi + 2 * kInDisk - Reference(disk_outer, 2000, b)};
+    }
+
+    // The largest difference between the sweeps of a table lookup and of the reference.
+    double SweepError(const dhh::geodesic::Deflection& a, const dhh::geodesic::Deflection& b)
+    {
+        return std::max({std::abs(a.to_outer_edge - b.to_outer_edge), std::abs(a.in_disk - b.in_disk),
+            std::abs(a.to_infinity - b.to_infinity)});
+    }
+}
+
+TEST(GeodesicTest, MatchesLibraryIntegrateT)
+{
+    // The values LibraryTest checks Integrate against.
+    EXPECT_NEAR(Reference(30, 20, 10), -0.18206352097090867, 1.0e-8);
+    EXPECT_NEAR(Reference(10, 60, 8), 0.7641980989670553, 1.0e-8);
+    EXPECT_NEAR(Reference(10, 6000, 8), 0.8965863021431181, 1.0e-6);
+    EXPECT_NEAR(Reference(13, 2000, 14), 1.5835582261400813, 1.0e-6);
+
+    EXPECT_NEAR(SweptAngle<float>(30, 20, 10, 1e-5f), -0.18206352097090867, 5.0e-5);
+    EXPECT_NEAR(SweptAngle<float>(10, 6000, 8, 1e-5f), 0.8965863021431181, 5.0e-5);
+    EXPECT_NEAR(SweptAngle<float>(13, 2000, 14, 1e-5f), 1.5835582261400813, 5.0e-5);
+}
+
+TEST(GeodesicTest, PromotesNearCriticalT)
+{
+    const double kB = dhh::geodesic::kCriticalImpact + 0.001;
+    EXPECT_EQ(SweptAngleMixed(15, 2000, kB), SweptAngle<double>(15, 2000, kB, 1e-9));
+    EXPECT_EQ(SweptAngleMixed(15, 2000, 8), SweptAngle<float>(15, 2000, 8, dhh::geodesic::kSinglePrecisionTolerance));
+}
+
+TEST(GeodesicTest, ImageErrorBelowPixelT)
+{
+    // The GPU tracer's view: 512 pixels across 90 degrees, from 15 M out. Every ray along the diagonal, which covers
+    // the widest range of impact parameters, must land within a tenth of a pixel of the double precision reference.
+    const int kWidth          = 512;
+    const double kR0          = 15;
+    const double kPixelRadian = std::atan(1.0) * 2 / kWidth;
+
+    double worst = 0;
+    for (int col = 0; col < kWidth; ++col)
+    {
+        const double kX     = (col + 0.5) / kWidth * 2 - 1;
+        const double kTheta = std::atan(std::sqrt(2) * std::abs(kX));
+        const double kB     = kR0 * std::sin(kTheta) / std::sqrt(1 - 2 / kR0);
+
+        const double kExpected = Deflection(kR0, kB, Reference);
+        const double kActual   = Deflection(kR0, kB, SweptAngleMixed);
+        worst                  = std::max(worst, std::abs(kActual - kExpected));
+    }
+    EXPECT_LT(worst, 0.1 * kPixelRadian);
+}
+
+TEST(GeodesicTest, DeflectionTableInterpolationT)
+{
+    // The GPU tracer's table and view: 1024 entries per half, the camera 15 M out, the disk from 6 to 10 M, and
+    // 512 pixels across 90 degrees, whose diagonal reaches b = 13.2.
+    const double kR0          = 15, kInner = 6, kOuter = 10;
+    const double kPixelRadian = std::atan(1.0) * 2 / 512;
+    const double kMaxB        = kR0 * std::sin(std::atan(std::sqrt(2))) / std::sqrt(1 - 2 / kR0);
+    const dhh::geodesic::DeflectionTable kTable(kR0, kInner, kOuter, 1024, SweptAngleMixed);
+
+    // Rays that turn around at a disk edge: their sweeps have a square root kink in b, which linear interpolation
+    // only follows at a distance.
+    auto turn_b            = [](double r) { return r / std::sqrt(1 - 2 / r); };
+    const double kKinks[2] = {turn_b(kInner), turn_b(kOuter)};
+
+    double worst_smooth = 0, worst_kink = 0;
+    for (int i = 0; i <= 1000; ++i)
+    {
+        const double kB     = kMaxB * (i + 0.5) / 1001;
+        const double kError = SweepError(kTable.Lookup(kB), ExactDeflection(kR0, kB, kInner, kOuter));
+        if (std::min(std::abs(kB - kKinks[0]), std::abs(kB - kKinks[1])) < 0.1)
+            worst_kink = std::max(worst_kink, kError);
+        else
+            worst_smooth = std::max(worst_smooth, kError);
+    }
+    EXPECT_LT(worst_smooth, 0.1 * kPixelRadian);
+    EXPECT_LT(worst_kink, 0.02);
+
+    // Both sides of the critical impact parameter, where the entries crowd and the sweeps diverge.
+    double worst_critical = 0;
+    for (int i = 1; i <= 100; ++i)
+    {
+        for (double side : {-1.0, 1.0})
+        {
+            const double kB = dhh::geodesic::kCriticalImpact + side * dhh::geodesic::kSinglePrecisionBand * i / 100;
+            worst_critical  = std::max(
+                worst_critical, SweepError(kTable.Lookup(kB), ExactDeflection(kR0, kB, kInner, kOuter)));
+        }
+    }
+    EXPECT_LT(worst_critical, 0.01 * kPixelRadian);
+}
@@ -0,0 +1,185 @@
+#include "image_writer.h"
+
+#include <gtest/gtest.h>
+#include <zlib.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace
+{
+    uint32_t ReadBigEndian32(const uint8_t* p)
+    {
+        return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+    }
+
+    // Minimal decoder for the PNGs written by EncodePng: one IDAT chunk of 8-bit RGB.
+    std::vector<uint8_t> DecodePng(const std::vector<uint8_t>& png, int width, int height)
+    {
+        size_t pos = 8;
+        std::vector<uint8_t> idat;
+        while (pos < png.size())
+        {
+            const uint32_t kLength = ReadBigEndian32(&png[pos]);
+            const uint32_t kCrc    = ReadBigEndian32(&png[pos + 8 + kLength]);
+            EXPECT_EQ(kCrc, crc32(0, &png[pos + 4], kLength + 4));
+            if (std::memcmp(&png[pos + 4], "IDAT", 4) == 0)
+                idat.assign(&png[pos + 8], &png[pos + 8 + kLength]);
+            pos += 12 + kLength;
+        }
+
+        const size_t kRowSize = size_t(width) * 3;
+        std::vector<uint8_t> raw((kRowSize + 1) * height);
+        uLongf raw_size = uLongf(raw.size());
+        EXPECT_EQ(uncompress(raw.data(), &raw_size, idat.data(), uLong(idat.size())), Z_OK);
+        EXPECT_EQ(raw_size, raw.size());
+
+        std::vector<uint8_t> pixels(kRowSize * height);
+        for (int y = 0; y < height; ++y)
+        {
+            const uint8_t* in = &raw[y * (kRowSize + 1)];
+            uint8_t* row      = &pixels[y * kRowSize];
+            uint8_t* prior    = y > 0 ? row - kRowSize : nullptr;
+            for (size_t i = 0; i < kRowSize; ++i)
+            {
+                int a  = i >= 3 ? row[i - 3] : 0;
+                int b  = prior ? prior[i] : 0;
+                int c  = prior && i >= 3 ? prior[i - 3] : 0;
+                int p  = a + b - c;
+                int pa = std::abs(p - a);
+                int pb = std::abs(p - b);
+                int pc = std::abs(p - c);
+
+                const int kPredicted[5] = {0, a, b, (a + b) / 2, pa <= pb && pa <= pc ? a : pb <= pc ? b : c};
+                row[i]                  = uint8_t(in[1 + i] + kPredicted[in[0]]);
+            }
+        }
+        return pixels;
+    }
+
+    std::vector<uint8_t> Gradient(int width, int height)
+    {
+        std::vector<uint8_t> pixels(size_t(width) * height * 3);
+        for (size_t i = 0; i < pixels.size(); ++i)
+        {
+            pixels[i] = uint8_t((i * 7 + (i / 97) * 13) % 256);
+        }
+        return pixels;
+    }
+}
+
+TEST(ImageWriterTest, FloatToHalfT)
+{
+    EXPECT_EQ(dhh::image::FloatToHalf(0.f), 0x0000);
+    EXPECT_EQ(dhh::image::FloatToHalf(1.f), 0x3c00);
+    EXPECT_EQ(dhh::image::FloatToHalf(0.5f), 0x3800);
+    EXPECT_EQ(dhh::image::FloatToHalf(-2.f), 0xc000);
+    EXPECT_EQ(dhh::image::FloatToHalf(65504.f), 0x7bff);
+    EXPECT_EQ(dhh::image::FloatToHalf(1e6f), 0x7c00);
+    EXPECT_EQ(dhh::image::FloatToHalf(5.9604645e-8f), 0x0001);
+}
+
+TEST(ImageWriterTest, ParallelPngRoundTripsT)
+{
+    // Tall enough to be split into many strips.
+    const int kWidth = 61, kHeight = 300;
+    const std::vector<uint8_t> kPixels = Gradient(kWidth, kHeight);
+    const dhh::image::ImageView kImage = {kPixels.data(), kWidth, kHeight, 0, false};
+
+    for (int level : {0, 1, 6})
+    {
+        const std::vector<uint8_t> kPng = dhh::image::EncodePng(kImage, level);
+        EXPECT_EQ(DecodePng(kPng, kWidth, kHeight), kPixels) << "level " << level;
+    }
+}
+
+TEST(ImageWriterTest, QoiRunsAndIndexT)
+{
+    // Four identical pixels, then the first color again: one RGB op, a run of three, an index op.
+    const uint8_t kPixels[] = {10, 20, 30, 10, 20, 30, 10, 20, 30, 10, 20, 30, 200, 0, 0, 10, 20, 30};
+    const std::vector<uint8_t> kQoi = dhh::image::EncodeQoi({kPixels, 6, 1, 0, false});
+
+    const std::vector<uint8_t> kBody(kQoi.begin() + 14, kQoi.end() - 8);
+    const int kHash                      = (10 * 3 + 20 * 5 + 30 * 7 + 255 * 11) % 64;
+    const std::vector<uint8_t> kExpected = {0xfe, 10, 20, 30, 0xc0 | 2, 0xfe, 200, 0, 0, uint8_t(kHash)};
+    EXPECT_EQ(kBody, kExpected);
+}
+
+TEST(ImageWriterTest, PfmIsBottomUpT)
+{
+    const float kPixels[] = {0, 0, 0, 1, 1, 1};
+    const std::vector<uint8_t> kPfm = dhh::image::EncodePfm({kPixels, 1, 2, 0, true});
+
+    const char kHeader[] = "PF\n1 2\n-1.0\n";
+    ASSERT_EQ(kPfm.size(), sizeof(kHeader) - 1 + sizeof(kPixels));
+    float first_row[3];
+    std::memcpy(first_row, &kPfm[sizeof(kHeader) - 1], sizeof(first_row));
+    EXPECT_EQ(first_row[0], 1.f);
+}
+
+TEST(ImageWriterTest, TiledExrResumesT)
+{
+    const std::string kPath = (std::filesystem::temp_directory_path() / "image_writer_test_tiled.exr").string();
+    std::remove(kPath.c_str());
+    std::remove((kPath + ".tiles").c_str());
+
+    // 5x3 in 2x2 tiles: 3x2 tiles, the last column and row clipped.
+    std::vector<float> tile(2 * 2 * 3, 0.5f);
+    {
+        dhh::image::TiledExrWriter writer(kPath, 5, 3, 2, false);
+        EXPECT_EQ(writer.PendingTiles().size(), 6u);
+        writer.WriteTile(2, 1, tile.data(), 2 * 3 * sizeof(float));
+        writer.WriteTile(0, 0, tile.data(), 2 * 3 * sizeof(float));
+        // Interrupted here.
+    }
+
+    dhh::image::TiledExrWriter writer(kPath, 5, 3, 2, false);
+    const std::vector<int> kExpected = {1, 2, 3, 4};
+    EXPECT_EQ(writer.PendingTiles(), kExpected);
+    for (int index : writer.PendingTiles())
+    {
+        writer.WriteTile(index % writer.TilesX(), index / writer.TilesX(), tile.data(), 2 * 3 * sizeof(float));
+    }
+    writer.Finish();
+
+    std::ifstream file(kPath, std::ios::binary);
+    std::vector<uint8_t> exr((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    EXPECT_FALSE(std::filesystem::exists(kPath + ".tiles"));
+
+    // Tile (2, 1) is a single pixel at the end of the file, whatever order the tiles were written in.
+    const size_t kLast = exr.size() - 20 - 3 * sizeof(float);
+    int32_t chunk[5];
+    std::memcpy(chunk, &exr[kLast], sizeof(chunk));
+    EXPECT_EQ(chunk[0], 2);
+    EXPECT_EQ(chunk[1], 1);
+    EXPECT_EQ(chunk[4], 12);
+    float blue;
+    std::memcpy(&blue, &exr[kLast + 20], sizeof(blue));
+    EXPECT_EQ(blue, 0.5f);
+    std::remove(kPath.c_str());
+}
+
+TEST(ImageWriterTest, ExrRoundTripsT)
+{
+    const std::string kPath = (std::filesystem::temp_directory_path() / "image_writer_test.exr").string();
+    const float kPixels[]   = {0.f, 0.25f, 1.f, 2.5f, -1.f, 1024.f};
+
+    for (bool half : {true, false})
+    {
+        dhh::image::WriteOptions options;
+        options.exr_half = half;
+        dhh::image::WriteImage(kPath, {kPixels, 1, 2, 0, true}, options);
+
+        int width, height;
+        const std::vector<float> kRead = dhh::image::ReadExr(kPath, width, height);
+        EXPECT_EQ(width, 1);
+        EXPECT_EQ(height, 2);
+        EXPECT_EQ(kRead, std::vector<float>(std::begin(kPixels), std::end(kPixels)));
+    }
+    EXPECT_FALSE(std::filesystem::exists(kPath + ".part"));
+    std::remove(kPath.c_str());
+}
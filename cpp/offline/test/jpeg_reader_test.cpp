@@ -0,0 +1,94 @@
+#include "jpeg_reader.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <vector>
+
+#include <jpeglib.h>
+
+namespace
+{
+    // Red on the left half, blue on the right, at the highest quality and without chroma subsampling, so each half
+    // decodes to close to its color.
+    std::filesystem::path WriteJpeg(const char* name, int width, int height)
+    {
+        const std::filesystem::path kPath = std::filesystem::temp_directory_path() / name;
+        FILE* file                        = std::fopen(kPath.string().c_str(), "wb");
+
+        jpeg_compress_struct info;
+        jpeg_error_mgr error;
+        info.err = jpeg_std_error(&error);
+        jpeg_create_compress(&info);
+        jpeg_stdio_dest(&info, file);
+        info.image_width      = width;
+        info.image_height     = height;
+        info.input_components = 3;
+        info.in_color_space   = JCS_RGB;
+        jpeg_set_defaults(&info);
+        jpeg_set_quality(&info, 100, TRUE);
+        for (int i = 0; i < info.num_components; ++i)
+        {
+            info.comp_info[i].h_samp_factor = 1;
+            info.comp_info[i].v_samp_factor = 1;
+        }
+        jpeg_start_compress(&info, TRUE);
+
+        std::vector<uint8_t> row(size_t(width) * 3);
+        for (int x = 0; x < width; ++x)
+        {
+            row[x * 3 + (x < width / 2 ? 0 : 2)] = 255;
+        }
+        while (info.next_scanline < info.image_height)
+        {
+            JSAMPROW rows[] = {row.data()};
+            jpeg_write_scanlines(&info, rows, 1);
+        }
+        jpeg_finish_compress(&info);
+        jpeg_destroy_compress(&info);
+        std::fclose(file);
+        return kPath;
+    }
+}
+
+TEST(JpegReaderTest, ReadsStripsAsBgrT)
+{
+    const int kWidth = 40, kHeight = 23, kStrip = 8;
+    const std::filesystem::path kPath = WriteJpeg("jpeg_reader_test.jpg", kWidth, kHeight);
+    dhh::image::JpegStripReader reader(kPath.string());
+    EXPECT_EQ(reader.Width(), kWidth);
+    EXPECT_EQ(reader.Height(), kHeight);
+
+    // Strips of 8 rows, the last one short.
+    std::vector<uint8_t> strip(size_t(kWidth) * 3 * kStrip);
+    std::vector<int> strips;
+    while (const int kRows = reader.ReadRows(strip.data(), kStrip, size_t(kWidth) * 3))
+    {
+        strips.push_back(kRows);
+        for (int y = 0; y < kRows; ++y)
+        {
+            const uint8_t* red  = &strip[size_t(y) * kWidth * 3];
+            const uint8_t* blue = red + (kWidth - 1) * 3;
+            EXPECT_NEAR(red[2], 255, 2);
+            EXPECT_NEAR(red[0], 0, 2);
+            EXPECT_NEAR(blue[0], 255, 2);
+            EXPECT_NEAR(blue[2], 0, 2);
+        }
+    }
+    EXPECT_EQ(strips, std::vector<int>({8, 8, 7}));
+    std::filesystem::remove(kPath);
+}
+
+TEST(JpegReaderTest, RejectsOtherFilesT)
+{
+    const std::filesystem::path kPath = std::filesystem::temp_directory_path() / "jpeg_reader_test.txt";
+    FILE* file                        = std::fopen(kPath.string().c_str(), "wb");
+    std::fputs("not a jpeg", file);
+    std::fclose(file);
+
+    EXPECT_THROW(dhh::image::JpegStripReader reader(kPath.string()), std::runtime_error);
+    EXPECT_THROW(dhh::image::JpegStripReader reader("does_not_exist.jpg"), std::runtime_error);
+    std::filesystem::remove(kPath);
+}
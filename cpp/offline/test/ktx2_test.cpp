@@ -0,0 +1,150 @@
+#include "ktx2.h"
+
+#include <gtest/gtest.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace
+{
+    template <typename T>
+    void Put(std::vector<uint8_t>& out, T value)
+    {
+        uint8_t bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    std::vector<uint8_t> Compress(const std::vector<uint8_t>& level, dhh::texture::Supercompression scheme)
+    {
+        std::vector<uint8_t> out;
+        if (scheme == dhh::texture::kZstd)
+        {
+            out.resize(ZSTD_compressBound(level.size()));
+            out.resize(ZSTD_compress(out.data(), out.size(), level.data(), level.size(), 3));
+        }
+        else if (scheme == dhh::texture::kZlib)
+        {
+            uLongf size = compressBound(uLong(level.size()));
+            out.resize(size);
+            compress(out.data(), &size, level.data(), uLong(level.size()));
+            out.resize(size);
+        }
+        else
+        {
+            out = level;
+        }
+        return out;
+    }
+
+    // A BC1 cubemap of 8x8 with two levels. Block b of face f at level l is filled with the byte f * 16 + l * 8 + b.
+    std::string WriteCubemap(const char* name, dhh::texture::Supercompression scheme)
+    {
+        std::vector<std::vector<uint8_t>> levels;
+        for (int level = 0; level < 2; ++level)
+        {
+            const int kBlocks = level == 0 ? 4 : 1;
+            std::vector<uint8_t> data;
+            for (int face = 0; face < 6; ++face)
+            {
+                for (int block = 0; block < kBlocks; ++block)
+                {
+                    data.insert(data.end(), 8, uint8_t(face * 16 + level * 8 + block));
+                }
+            }
+            levels.push_back(Compress(data, scheme));
+        }
+
+        std::vector<uint8_t> file = {0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n'};
+        for (uint32_t value : {131u, 1u, 8u, 8u, 0u, 0u, 6u, 2u, uint32_t(scheme)})
+        {
+            Put(file, value);
+        }
+        for (int i = 0; i < 4; ++i)
+        {
+            Put(file, uint32_t(0));
+        }
+        Put(file, uint64_t(0));
+        Put(file, uint64_t(0));
+
+        // Level data is stored smallest first, after the level index.
+        uint64_t offset = file.size() + 2 * 24;
+        const uint64_t kOffsets[2] = {offset + levels[1].size(), offset};
+        for (int level = 0; level < 2; ++level)
+        {
+            Put(file, kOffsets[level]);
+            Put(file, uint64_t(levels[level].size()));
+            Put(file, uint64_t(level == 0 ? 6 * 4 * 8 : 6 * 8));
+        }
+        file.insert(file.end(), levels[1].begin(), levels[1].end());
+        file.insert(file.end(), levels[0].begin(), levels[0].end());
+
+        const std::string kPath = (std::filesystem::temp_directory_path() / name).string();
+        std::ofstream(kPath, std::ios::binary).write(reinterpret_cast<const char*>(file.data()), file.size());
+        return kPath;
+    }
+}
+
+TEST(Ktx2Test, DecodesEverySchemeT)
+{
+    for (auto scheme : {dhh::texture::kNoSupercompression, dhh::texture::kZstd, dhh::texture::kZlib})
+    {
+        const std::string kPath = WriteCubemap("ktx2_test.ktx2", scheme);
+        {
+            const dhh::texture::Ktx2Texture kTexture(kPath);
+            EXPECT_EQ(kTexture.Scheme(), scheme);
+            EXPECT_EQ(kTexture.Format(), 131u);
+            EXPECT_EQ(kTexture.Levels(), 2u);
+            EXPECT_EQ(kTexture.Faces(), 6u);
+
+            std::vector<uint8_t> decoded(kTexture.DecodedSize());
+            kTexture.Decode(decoded.data());
+            EXPECT_EQ(kTexture.LevelOffset(1) % 16, 0u);
+            EXPECT_EQ(decoded[kTexture.ImageOffset(0, 0, 3) + 8], 3 * 16 + 1);
+            EXPECT_EQ(decoded[kTexture.ImageOffset(1, 0, 5)], 5 * 16 + 8);
+        }
+        std::filesystem::remove(kPath);
+    }
+}
+
+TEST(Ktx2Test, CubemapFacesT)
+{
+    const std::string kPath = WriteCubemap("ktx2_cubemap_test.ktx2", dhh::texture::kZstd);
+    const std::vector<dhh::texture::BlockTexture> kFaces = dhh::texture::LoadKtx2Cubemap(kPath);
+    ASSERT_EQ(kFaces.size(), 6u);
+    EXPECT_EQ(kFaces[0].Width(), 8);
+    EXPECT_EQ(kFaces[0].Bytes(), 4u * 8);
+
+    // +Z is the back face. Its first block has both endpoints 0x1010 and so decodes to a single color.
+    uint8_t bgr[16 * 3];
+    dhh::texture::DecodeBlock(dhh::texture::kBc1, std::vector<uint8_t>(8, 4 * 16).data(), bgr);
+    const std::array<uint8_t, 3> kExpected = {bgr[0], bgr[1], bgr[2]};
+    EXPECT_EQ(kFaces[1].Texel(0, 0), kExpected);
+    std::filesystem::remove(kPath);
+}
+
+TEST(Ktx2Test, RejectsWrappingLevelIndexT)
+{
+    const std::string kPath = WriteCubemap("ktx2_wrap_test.ktx2", dhh::texture::kNoSupercompression);
+    std::vector<uint8_t> file(std::filesystem::file_size(kPath));
+    std::ifstream(kPath, std::ios::binary).read(reinterpret_cast<char*>(file.data()), file.size());
+
+    // A level count whose index size wraps to 8 bytes in 32 bits.
+    std::vector<uint8_t> levels = file;
+    const uint32_t kLevels      = 0xaaaaaaab;
+    std::memcpy(&levels[40], &kLevels, sizeof(kLevels));
+    std::ofstream(kPath, std::ios::binary).write(reinterpret_cast<const char*>(levels.data()), levels.size());
+    EXPECT_THROW(dhh::texture::Ktx2Texture texture(kPath), std::runtime_error);
+
+    // A level offset whose end wraps to just past zero.
+    std::vector<uint8_t> offset = file;
+    const uint64_t kOffset      = ~uint64_t(0) - 3;
+    std::memcpy(&offset[80], &kOffset, sizeof(kOffset));
+    std::ofstream(kPath, std::ios::binary).write(reinterpret_cast<const char*>(offset.data()), offset.size());
+    EXPECT_THROW(dhh::texture::Ktx2Texture texture(kPath), std::runtime_error);
+    std::filesystem::remove(kPath);
+}
@@ -0,0 +1,30 @@
+#include "ray_class.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+TEST(RayClassTest, ClassifyFollowsTraceBranchesT)
+{
+    using namespace dhh::rays;
+    EXPECT_EQ(Classify(5, 0, 2, 10), kCaptured);
+    EXPECT_EQ(Classify(5.2, 12, 2, 10), kSky);
+    EXPECT_EQ(Classify(8, 6, 2, 10), kDiskBand);
+    EXPECT_EQ(Classify(8, 10, 2, 10), kDiskBand);
+    EXPECT_EQ(Classify(5.2, 3.5, 4, 10), kInnerDisk);
+}
+
+TEST(RayClassTest, GroupByClassIsStableT)
+{
+    using namespace dhh::rays;
+    const std::vector<RayClass> kClasses = {kSky, kCaptured, kSky, kInnerDisk, kCaptured, kSky};
+    std::vector<int> order(kClasses.size());
+
+    const auto kStarts = GroupByClass(kClasses.data(), int(kClasses.size()), order.data());
+    EXPECT_EQ(order, std::vector<int>({1, 4, 0, 2, 5, 3}));
+    EXPECT_EQ(kStarts[kCaptured], 0);
+    EXPECT_EQ(kStarts[kSky], 2);
+    EXPECT_EQ(kStarts[kDiskBand], 5);
+    EXPECT_EQ(kStarts[kInnerDisk], 5);
+    EXPECT_EQ(kStarts[kRayClasses], 6);
+}
@@ -0,0 +1,55 @@
+#include "redshift.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <limits>
+
+namespace
+{
+    double Luminance(const dhh::disk::Rgb& color) { return 0.2126 * color.r + 0.7152 * color.g + 0.0722 * color.b; }
+}
+
+TEST(RedshiftTest, ReferenceHasUnitLuminanceT)
+{
+    const dhh::disk::ShadingLut kLut(6500);
+    EXPECT_NEAR(Luminance(kLut.Sample(1, 6500)), 1, 0.05);
+
+    // Near white, as the sRGB white point is close to a 6500 K black body.
+    const dhh::disk::Rgb kWhite = kLut.Sample(1, 6500);
+    EXPECT_NEAR(kWhite.r / kWhite.b, 1, 0.15);
+}
+
+TEST(RedshiftTest, BlueshiftIsBrighterAndBluerT)
+{
+    const dhh::disk::ShadingLut kLut(6500);
+    const dhh::disk::Rgb kApproaching = kLut.Sample(1.4, 6000);
+    const dhh::disk::Rgb kReceding    = kLut.Sample(0.7, 6000);
+    EXPECT_GT(Luminance(kApproaching), 4 * Luminance(kReceding));
+    EXPECT_GT(kApproaching.b / kApproaching.r, kReceding.b / kReceding.r);
+
+    // The observed spectrum of a shifted black body is a black body at g times the temperature.
+    const dhh::disk::Rgb kShifted = kLut.Sample(2, 4000);
+    const dhh::disk::Rgb kHotter  = kLut.Sample(1, 8000);
+    EXPECT_NEAR(kShifted.r, kHotter.r, 0.05 * kHotter.r);
+    EXPECT_NEAR(kShifted.b, kHotter.b, 0.05 * kHotter.b);
+}
+
+TEST(RedshiftTest, SampleStaysInBoundsT)
+{
+    const dhh::disk::ShadingLut kLut(6500);
+    const double kNan = std::numeric_limits<double>::quiet_NaN();
+    EXPECT_TRUE(std::isfinite(kLut.Sample(kNan, kNan).r));
+    EXPECT_TRUE(std::isfinite(kLut.Sample(-1, 0).g));
+    EXPECT_TRUE(std::isfinite(kLut.Sample(100, 1e9).b));
+    EXPECT_EQ(kLut.Sample(0, 6500).r, kLut.Sample(-1, 6500).r);
+}
+
+TEST(RedshiftTest, RedshiftFactorT)
+{
+    // Light leaving sideways only sees the gravitational redshift and time dilation.
+    EXPECT_DOUBLE_EQ(dhh::disk::RedshiftFactor(12, 0), std::sqrt(0.75));
+    EXPECT_GT(dhh::disk::RedshiftFactor(12, 10), 1);
+    EXPECT_LT(dhh::disk::RedshiftFactor(12, -10), std::sqrt(0.75));
+    EXPECT_EQ(dhh::disk::RedshiftFactor(2.5, 0), 0);
+}
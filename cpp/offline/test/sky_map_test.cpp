@@ -0,0 +1,137 @@
+#include "sky_map.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <vector>
+
+namespace
+{
+    // Texel (x, y) of image holds (x, y, tag).
+    std::vector<uint8_t> Coordinates(int width, int height, int tag)
+    {
+        std::vector<uint8_t> pixels(size_t(width) * height * 3);
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                uint8_t* texel = &pixels[(size_t(y) * width + x) * 3];
+                texel[0]       = uint8_t(x);
+                texel[1]       = uint8_t(y);
+                texel[2]       = uint8_t(tag);
+            }
+        }
+        return pixels;
+    }
+
+    std::array<uint8_t, 3> Bgr(int b, int g, int r) { return {uint8_t(b), uint8_t(g), uint8_t(r)}; }
+}
+
+TEST(SkyMapTest, AngleTableMatchesAtan2T)
+{
+    const dhh::skybox::AngleTable kAngles;
+    for (int i = 0; i < 1000; ++i)
+    {
+        const double kY = std::sin(i * 0.37) * (i % 7 + 1), kX = std::cos(i * 0.53) * (i % 5);
+        EXPECT_NEAR(kAngles.Atan2(kY, kX), std::atan2(kY, kX), 1e-5) << kY << " " << kX;
+    }
+}
+
+TEST(SkyMapTest, CubePicksDominantAxisT)
+{
+    std::vector<std::vector<uint8_t>> pixels;
+    std::array<dhh::skybox::TexelView, 6> faces;
+    for (int face = 0; face < 6; ++face)
+    {
+        pixels.push_back(Coordinates(5, 5, face));
+        faces[face] = {pixels.back().data(), 5, 5, 5 * 3};
+    }
+    const dhh::skybox::CubeSkyMap kCube(faces, nullptr);
+
+    // -z is the front face; x and y become the column and row after dividing by z.
+    EXPECT_EQ(kCube.Texel(0.5, -1, -2), Bgr(2, 3, 0));
+    EXPECT_EQ(kCube.Texel(0, 3, 0), Bgr(2, 2, 2));
+    EXPECT_EQ(kCube.Texel(-4, 4, 0), Bgr(0, 2, 4));
+}
+
+TEST(SkyMapTest, ReplacedFaceKeepsOthersT)
+{
+    std::vector<std::vector<uint8_t>> pixels;
+    std::array<dhh::skybox::TexelView, 6> faces;
+    for (int face = 0; face < 6; ++face)
+    {
+        pixels.push_back(Coordinates(5, 5, face));
+        faces[face] = {pixels.back().data(), 5, 5, 5 * 3};
+    }
+    auto cube = std::make_shared<dhh::skybox::CubeSkyMap>(faces, nullptr);
+
+    // A 9x3 back face: the image decides the texel grid, not the face it replaces.
+    const std::vector<uint8_t> kBack = Coordinates(9, 3, 7);
+    const dhh::skybox::ReplacedFaceSkyMap kMap(cube, 1, {kBack.data(), 9, 3, 9 * 3}, nullptr);
+
+    EXPECT_EQ(kMap.FaceWidth(1), 9);
+    EXPECT_EQ(kMap.FaceWidth(0), 5);
+    EXPECT_EQ(kMap.Texel(0.9, 0.9, 1), Bgr(8, 2, 7));
+    EXPECT_EQ(kMap.Texel(0.5, -1, -2), cube->Texel(0.5, -1, -2));
+}
+
+TEST(SkyMapTest, EquirectTexelCentersT)
+{
+    const int kWidth = 16, kHeight = 8;
+    const std::vector<uint8_t> kPixels = Coordinates(kWidth, kHeight, 0);
+    const dhh::skybox::EquirectSkyMap kMap({kPixels.data(), kWidth, kHeight, kWidth * 3}, nullptr);
+
+    for (int row = 0; row < kHeight; ++row)
+    {
+        for (int column = 0; column < kWidth; ++column)
+        {
+            const double kLongitude = (column + 0.5) / kWidth * dhh::skybox::kTwoPi - dhh::skybox::kPi;
+            const double kLatitude  = dhh::skybox::kHalfPi - (row + 0.5) / kHeight * dhh::skybox::kPi;
+            EXPECT_EQ(kMap.Texel(std::cos(kLatitude) * std::sin(kLongitude), std::sin(kLatitude),
+                          std::cos(kLatitude) * std::cos(kLongitude)),
+                Bgr(column, row, 0));
+        }
+    }
+}
+
+TEST(SkyMapTest, HealpixPixelCentersT)
+{
+    // Pixel p holds (p % 256, p / 256, 0) in an image of 12 rows of nside^2 pixels.
+    const int kNside = 8, kPixels = 12 * kNside * kNside;
+    std::vector<uint8_t> pixels(size_t(kPixels) * 3);
+    for (int p = 0; p < kPixels; ++p)
+    {
+        pixels[p * 3]     = uint8_t(p % 256);
+        pixels[p * 3 + 1] = uint8_t(p / 256);
+    }
+    const dhh::skybox::HealpixSkyMap kMap(kNside, {pixels.data(), kNside * kNside, 12, kNside * kNside * 3}, nullptr);
+
+    // Pixel centers from the reference RING pix2ang.
+    const int kCap = 2 * kNside * (kNside - 1);
+    for (int p = 0; p < kPixels; ++p)
+    {
+        double z, phi;
+        if (p < kCap)
+        {
+            const int kRing = (1 + int(std::sqrt(1.0 + 2 * p))) / 2;
+            z               = 1 - kRing * kRing * 4.0 / kPixels;
+            phi             = (p + 1 - 2 * kRing * (kRing - 1) - 0.5) * dhh::skybox::kHalfPi / kRing;
+        }
+        else if (p < kPixels - kCap)
+        {
+            const int kRing    = (p - kCap) / (4 * kNside) + kNside;
+            const double kOdd  = (kRing + kNside) & 1 ? 1 : 0.5;
+            z                  = (2 * kNside - kRing) * 2.0 / (3 * kNside);
+            phi                = ((p - kCap) % (4 * kNside) + 1 - kOdd) * dhh::skybox::kPi / (2 * kNside);
+        }
+        else
+        {
+            const int kFromEnd = kPixels - p;
+            const int kRing    = (1 + int(std::sqrt(2.0 * kFromEnd - 1))) / 2;
+            z                  = kRing * kRing * 4.0 / kPixels - 1;
+            phi = (4 * kRing + 1 - (kFromEnd - 2 * kRing * (kRing - 1)) - 0.5) * dhh::skybox::kHalfPi / kRing;
+        }
+        const double kSin = std::sqrt(1 - z * z);
+        EXPECT_EQ(kMap.Texel(kSin * std::cos(phi), z, kSin * std::sin(phi)), Bgr(p % 256, p / 256, 0)) << p;
+    }
+}
@@ -0,0 +1,264 @@
+#include "tiled_skybox.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Writes six faces of width x height plus one half-size level, texel (x, y) of face f being (x, y, f).
+    std::filesystem::path WriteFaces(const char* name, int width, int height, int tile_size)
+    {
+        const std::filesystem::path kPath = std::filesystem::temp_directory_path() / name;
+        dhh::skybox::TiledSkyboxWriter writer(kPath, tile_size);
+        for (int face = 0; face < 6; ++face)
+        {
+            for (int level = 0; level < 2; ++level)
+            {
+                const int kWidth = width >> level, kHeight = height >> level;
+                std::vector<uint8_t> pixels(size_t(kWidth) * kHeight * 3);
+                for (int y = 0; y < kHeight; ++y)
+                {
+                    for (int x = 0; x < kWidth; ++x)
+                    {
+                        uint8_t* texel = &pixels[(size_t(y) * kWidth + x) * 3];
+                        texel[0]       = uint8_t(x);
+                        texel[1]       = uint8_t(y);
+                        texel[2]       = uint8_t(face + level * 10);
+                    }
+                }
+                writer.AddLevel(face, pixels.data(), kWidth, kHeight, size_t(kWidth) * 3);
+            }
+        }
+        writer.Finish();
+        return kPath;
+    }
+}
+
+TEST(TiledSkyboxTest, TexelsMatchSourceT)
+{
+    // 21x13 in 8x8 tiles: the last column and row of tiles are padded.
+    const std::filesystem::path kPath = WriteFaces("tiled_skybox_test.tiles", 21, 13, 8);
+    dhh::skybox::TiledSkybox tiled(kPath, 1 << 20);
+    EXPECT_EQ(tiled.Levels(), 2);
+    EXPECT_EQ(tiled.Width(3, 1), 10);
+
+    for (int face = 0; face < 6; ++face)
+    {
+        for (int y = 0; y < 13; ++y)
+        {
+            for (int x = 0; x < 21; ++x)
+            {
+                const std::array<uint8_t, 3> kExpected = {uint8_t(x), uint8_t(y), uint8_t(face)};
+                ASSERT_EQ(tiled.Texel(face, 0, x, y), kExpected);
+            }
+        }
+    }
+    const std::array<uint8_t, 3> kMip = {9, 5, 14};
+    EXPECT_EQ(tiled.Texel(4, 1, 9, 5), kMip);
+
+    // Every tile was read exactly once: 3x2 tiles per face at level 0, and one tile of level 1.
+    EXPECT_EQ(tiled.Misses(), 6u * 6 + 1);
+    std::filesystem::remove(kPath);
+}
+
+TEST(TiledSkyboxTest, ResidencyStaysWithinBudgetT)
+{
+    const std::filesystem::path kPath = WriteFaces("tiled_skybox_budget_test.tiles", 64, 64, 4);
+    const size_t kTileBytes           = 4 * 4 * 3;
+    const size_t kShards              = 4;
+    dhh::skybox::TiledSkybox tiled(kPath, 8 * kTileBytes, kShards);
+
+    std::vector<std::thread> threads;
+    for (int face = 0; face < 4; ++face)
+    {
+        threads.emplace_back([&tiled, face] {
+            for (int y = 0; y < 64; ++y)
+            {
+                for (int x = 0; x < 64; ++x)
+                {
+                    const std::array<uint8_t, 3> kExpected = {uint8_t(x), uint8_t(y), uint8_t(face)};
+                    EXPECT_EQ(tiled.Texel(face, 0, x, y), kExpected);
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_LE(tiled.ResidentBytes(), 8 * kTileBytes);
+    EXPECT_GT(tiled.Hits() + tiled.Misses(), 0u);
+    std::filesystem::remove(kPath);
+}
+
+TEST(TiledSkyboxTest, RowsStreamIntoTilesT)
+{
+    // The same 21x13 face fed in uneven runs of rows must give the same tiles as a whole level.
+    const std::filesystem::path kPath = std::filesystem::temp_directory_path() / "tiled_skybox_rows_test.tiles";
+    {
+        dhh::skybox::TiledSkyboxWriter writer(kPath, 8);
+        std::vector<uint8_t> row(21 * 3);
+        for (int face = 0; face < 6; ++face)
+        {
+            writer.BeginLevel(face, 21, 13);
+            for (int y = 0; y < 13;)
+            {
+                const int kRows = std::min(1 + y % 4, 13 - y);
+                std::vector<uint8_t> rows(size_t(kRows) * 21 * 3);
+                for (int i = 0; i < kRows; ++i)
+                {
+                    for (int x = 0; x < 21; ++x)
+                    {
+                        rows[(size_t(i) * 21 + x) * 3]     = uint8_t(x);
+                        rows[(size_t(i) * 21 + x) * 3 + 1] = uint8_t(y + i);
+                        rows[(size_t(i) * 21 + x) * 3 + 2] = uint8_t(face);
+                    }
+                }
+                writer.AddRows(rows.data(), kRows, 21 * 3);
+                y += kRows;
+            }
+        }
+        writer.Finish();
+    }
+
+    dhh::skybox::TiledSkybox tiled(kPath, 1 << 20);
+    EXPECT_EQ(tiled.Levels(), 1);
+    for (int face = 0; face < 6; ++face)
+    {
+        for (int y = 0; y < 13; ++y)
+        {
+            for (int x = 0; x < 21; ++x)
+            {
+                const std::array<uint8_t, 3> kExpected = {uint8_t(x), uint8_t(y), uint8_t(face)};
+                ASSERT_EQ(tiled.Texel(face, 0, x, y), kExpected);
+            }
+        }
+    }
+    EXPECT_TRUE(tiled.Error().empty());
+    std::filesystem::remove(kPath);
+}
+
+TEST(TiledSkyboxTest, UnreadableTileIsReportedT)
+{
+    const std::filesystem::path kPath = WriteFaces("tiled_skybox_error_test.tiles", 16, 16, 8);
+    dhh::skybox::TiledSkybox tiled(kPath, 1 << 20, 1);
+
+    // Cut the file after the first face; lookups on other threads must not throw.
+    std::filesystem::resize_file(kPath, tiled.Header().offset[1][0]);
+    std::array<uint8_t, 3> texel;
+    std::thread worker([&] { texel = tiled.Texel(5, 0, 3, 3); });
+    worker.join();
+
+    EXPECT_EQ(texel, dhh::skybox::kMissingTexel);
+    EXPECT_FALSE(tiled.Error().empty());
+    const std::array<uint8_t, 3> kFirstFace = {3, 3, 0};
+    EXPECT_EQ(tiled.Texel(0, 0, 3, 3), kFirstFace);
+    std::filesystem::remove(kPath);
+}
+
+TEST(TiledSkyboxTest, BeginFaceFiltersLevelsT)
+{
+    // A 21x13 face streamed row by row must carry a chain down to 1x1, each texel the rounded mean of the texels
+    // above it; the odd last column and row fold into the last texel.
+    const int kWidth = 21, kHeight = 13;
+    std::vector<uint8_t> pixels(size_t(kWidth) * kHeight * 3);
+    for (size_t i = 0; i < pixels.size(); ++i)
+    {
+        pixels[i] = uint8_t(i * 37 % 251);
+    }
+
+    const std::filesystem::path kPath = std::filesystem::temp_directory_path() / "tiled_skybox_mip_test.tiles";
+    {
+        dhh::skybox::TiledSkyboxWriter writer(kPath, 4);
+        for (int face = 0; face < 6; ++face)
+        {
+            writer.BeginFace(face, kWidth, kHeight);
+            for (int y = 0; y < kHeight; ++y)
+            {
+                writer.AddRows(&pixels[size_t(y) * kWidth * 3], 1, size_t(kWidth) * 3);
+            }
+        }
+        writer.Finish();
+    }
+
+    dhh::skybox::TiledSkybox tiled(kPath, 1 << 20);
+    ASSERT_EQ(tiled.Levels(), dhh::skybox::MipLevels(kWidth, kHeight));
+    ASSERT_EQ(tiled.Levels(), 5);
+
+    std::vector<uint8_t> level = pixels;
+    int width = kWidth, height = kHeight;
+    for (int l = 0; l < tiled.Levels(); ++l)
+    {
+        ASSERT_EQ(tiled.Width(2, l), width);
+        ASSERT_EQ(tiled.Height(2, l), height);
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                const uint8_t* texel                   = &level[(size_t(y) * width + x) * 3];
+                const std::array<uint8_t, 3> kExpected = {texel[0], texel[1], texel[2]};
+                ASSERT_EQ(tiled.Texel(2, l, x, y), kExpected) << "level " << l << " at " << x << ", " << y;
+            }
+        }
+
+        // The next level from the rounded texels of this one, as the writer builds it.
+        const int kNextWidth = std::max(width / 2, 1), kNextHeight = std::max(height / 2, 1);
+        std::vector<uint32_t> sums(size_t(kNextWidth) * kNextHeight * 3);
+        std::vector<uint32_t> counts(size_t(kNextWidth) * kNextHeight);
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                const size_t kTexel = size_t(std::min(y / 2, kNextHeight - 1)) * kNextWidth
+                                    + std::min(x / 2, kNextWidth - 1);
+                for (int c = 0; c < 3; ++c)
+                {
+                    sums[kTexel * 3 + c] += level[(size_t(y) * width + x) * 3 + c];
+                }
+                ++counts[kTexel];
+            }
+        }
+        level.assign(sums.size(), 0);
+        for (size_t i = 0; i < sums.size(); ++i)
+        {
+            level[i] = uint8_t((sums[i] + counts[i / 3] / 2) / counts[i / 3]);
+        }
+        width  = kNextWidth;
+        height = kNextHeight;
+    }
+    std::filesystem::remove(kPath);
+}
+
+TEST(TiledSkyboxTest, FootprintPicksLevelT)
+{
+    // Faces of 64x64 with 7 levels, every texel of level l reading l.
+    const std::filesystem::path kPath = std::filesystem::temp_directory_path() / "tiled_skybox_footprint_test.tiles";
+    {
+        dhh::skybox::TiledSkyboxWriter writer(kPath, 16);
+        for (int face = 0; face < 6; ++face)
+        {
+            for (int level = 0; level < 7; ++level)
+            {
+                const int kSize = 64 >> level;
+                std::vector<uint8_t> pixels(size_t(kSize) * kSize * 3, uint8_t(level));
+                writer.AddLevel(face, pixels.data(), kSize, kSize, size_t(kSize) * 3);
+            }
+        }
+        writer.Finish();
+    }
+
+    const dhh::skybox::TiledSkyMap kSky(std::make_shared<dhh::skybox::TiledSkybox>(kPath, 1 << 20));
+    ASSERT_TRUE(kSky.Filtered());
+    const double kTexel = dhh::skybox::kHalfPi / 64;
+    EXPECT_EQ(kSky.Texel(0.2, 0.1, 1)[0], 0);
+    EXPECT_EQ(kSky.FilteredTexel(0.2, 0.1, 1, 0)[0], 0);
+    EXPECT_EQ(kSky.FilteredTexel(0.2, 0.1, 1, kTexel)[0], 0);
+    EXPECT_EQ(kSky.FilteredTexel(0.2, 0.1, 1, 4 * kTexel)[0], 2);
+    EXPECT_EQ(kSky.FilteredTexel(0.2, 0.1, 1, 30 * kTexel)[0], 5);
+    EXPECT_EQ(kSky.FilteredTexel(0.2, 0.1, 1, dhh::skybox::kPi)[0], 6);
+    std::filesystem::remove(kPath);
+}